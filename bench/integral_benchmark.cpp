@@ -0,0 +1,157 @@
+///
+/// \file
+/// Benchmarks of the integral image computation stages. Run with
+/// --benchmark_format=json or --benchmark_out=<file> to track regressions.
+///
+
+#include <algorithm>
+#include <memory>
+#include <streambuf>
+#include <thread>
+#include "benchmark/benchmark.h"
+#include "integral_processing.hpp"
+#include "opencv2/imgproc.hpp"
+#include "processing_context.hpp"
+#include "text_writer.hpp"
+
+namespace {
+
+// Arguments of the benchmarks: depth, channels, rows, cols and threads.
+const int depths[] = {CV_8U, CV_16U, CV_16S, CV_32S, CV_32F, CV_64F};
+const int channel_counts[] = {1, 3};
+const cv::Size sizes[] = {{640, 480}, {1920, 1080}, {4096, 2560}};
+
+cv::Mat make_image(const benchmark::State& state) {
+    const auto depth = static_cast<int>(state.range(0));
+    const auto channels = static_cast<int>(state.range(1));
+    cv::Mat image(
+        static_cast<int>(state.range(2)), static_cast<int>(state.range(3)),
+        CV_MAKETYPE(depth, channels));
+    const auto high = depth == CV_8U ? 256 : 4096;
+    cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(high));
+    return image;
+}
+
+//! @brief Reports throughput of the source image per iteration.
+void set_processed(benchmark::State& state, const cv::Mat& image) {
+    const auto iterations = static_cast<double>(state.iterations());
+    state.SetBytesProcessed(
+        static_cast<int64_t>(iterations * image.total() * image.elemSize()));
+    state.counters["pixels"] = benchmark::Counter(
+        iterations * image.total(), benchmark::Counter::kIsRate);
+}
+
+void image_args(benchmark::internal::Benchmark* bench) {
+    for(const auto depth : depths)
+        for(const auto channels : channel_counts)
+            for(const auto& size : sizes)
+                bench->Args({depth, channels, size.height, size.width});
+}
+
+void thread_args(benchmark::internal::Benchmark* bench) {
+    const auto max_threads =
+        std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    for(const auto depth : depths)
+        for(const auto channels : channel_counts)
+            for(const auto& size : sizes)
+                for(auto threads = 1; threads <= max_threads; threads *= 2)
+                    bench->Args(
+                        {depth, channels, size.height, size.width, threads});
+}
+
+//! @brief Discards the output to measure formatting only.
+class null_buffer : public std::streambuf {
+protected:
+    std::streamsize xsputn(const char*, std::streamsize count) override {
+        return count;
+    }
+
+    int_type overflow(int_type ch) override {
+        return ch;
+    }
+};
+
+//! @brief Single-threaded computation of all the channels by the kernels.
+void compute(benchmark::State& state) {
+    const auto image = make_image(state);
+    std::vector<sp::processing_context::ptr> channels;
+    for(auto i = 0; i < image.channels(); ++i)
+        channels.emplace_back(
+            std::make_unique<sp::processing_context>("bench", image, i));
+
+    for(auto _ : state) {
+        sp::processing_context::execute(channels, cv::Range(0, image.rows));
+        benchmark::DoNotOptimize(channels.front()->get_result().data);
+    }
+    set_processed(state, image);
+}
+
+//! @brief Whole executor path, including the thread pools.
+void execute(benchmark::State& state) {
+    auto image = make_image(state);
+    const auto threads = static_cast<unsigned int>(state.range(4));
+    for(auto _ : state) {
+        sp::integral_computation executor(threads);
+        executor.enqueue_file("bench", image);
+        executor.wait_for_complete();
+    }
+    set_processed(state, image);
+}
+
+//! @brief Executor path of the long-lived executor, without pool creation.
+void submit(benchmark::State& state) {
+    const auto image = make_image(state);
+    const auto threads = static_cast<unsigned int>(state.range(4));
+    sp::integral_computation executor(threads);
+    executor.set_logging(false);
+    for(auto _ : state) {
+        auto tasks = executor.submit("bench", image).get();
+        benchmark::DoNotOptimize(tasks.front()->get_result().data);
+    }
+    set_processed(state, image);
+}
+
+//! @brief Text serialization of the computed results.
+void write_text(benchmark::State& state) {
+    const auto image = make_image(state);
+    std::vector<cv::Mat> results;
+    for(auto i = 0; i < image.channels(); ++i) {
+        sp::processing_context context("bench", image, i);
+        context.execute();
+        results.push_back(context.get_result());
+    }
+
+    null_buffer buffer;
+    std::ostream output(&buffer);
+    sp::text_writer writer;
+    for(auto _ : state)
+        writer.write(output, results);
+    set_processed(state, image);
+}
+
+//! @brief Reference computation by OpenCV.
+void opencv_integral(benchmark::State& state) {
+    const auto image = make_image(state);
+    cv::Mat result;
+    for(auto _ : state) {
+        cv::integral(image, result, CV_64F);
+        benchmark::DoNotOptimize(result.data);
+    }
+    set_processed(state, image);
+}
+
+} // namespace
+
+BENCHMARK(compute)->Apply(image_args)->Unit(benchmark::kMillisecond);
+BENCHMARK(execute)
+    ->Apply(thread_args)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK(submit)
+    ->Apply(thread_args)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK(write_text)->Apply(image_args)->Unit(benchmark::kMillisecond);
+BENCHMARK(opencv_integral)->Apply(image_args)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
\ No newline at end of file
@@ -0,0 +1,496 @@
+#include "async_writer.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#if defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define SP_IO_URING
+#endif
+#endif
+#endif
+
+namespace sp {
+namespace {
+
+constexpr std::size_t min_buffer_size = 64 << 10;
+
+std::size_t round_up(std::size_t size, std::size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+std::exception_ptr write_error(const std::string& path, int code) {
+    std::stringstream error;
+    error << "Unable to write: " << path << ", " << std::strerror(code)
+          << ";";
+    return std::make_exception_ptr(std::runtime_error(error.str()));
+}
+
+} // namespace
+
+struct async_writer::file_state {
+    ~file_state() {
+#if defined(SP_IO_URING)
+        if(fd >= 0)
+            ::close(fd);
+#endif
+    }
+
+    std::string path;
+    //! @brief Descriptor of the file written by io_uring.
+    int fd = -1;
+    //! @brief Stream of the file written synchronously.
+    std::ofstream stream;
+    bool direct = false;
+    //! @brief End of the submitted data.
+    std::uint64_t offset = 0;
+    std::size_t pending = 0;
+    bool closing = false;
+    std::exception_ptr error;
+    on_close_t on_close;
+};
+
+#if defined(SP_IO_URING)
+/** @brief Submission and completion queues shared with the kernel.
+
+Queues are accessed under the lock of the writer, so only the indices shared
+with the kernel are accessed atomically. Waiting for the completions doesn't
+touch the queues, so it's done outside of the lock.
+*/
+struct async_writer::ring {
+    //! @brief Returns ring of the entries or nullptr if unsupported.
+    static std::unique_ptr<ring> create(unsigned entries) {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        const auto fd = static_cast<int>(
+            syscall(__NR_io_uring_setup, entries, &params));
+        if(fd < 0)
+            return nullptr;
+
+        std::unique_ptr<ring> result(new ring);
+        result->fd = fd;
+        result->iovecs.resize(entries);
+        result->sq_size =
+            params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        result->cq_size =
+            params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const auto single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if(single)
+            result->sq_size = result->cq_size =
+                std::max(result->sq_size, result->cq_size);
+
+        result->sq_ptr = map(fd, result->sq_size, IORING_OFF_SQ_RING);
+        if(result->sq_ptr == MAP_FAILED)
+            return nullptr;
+        result->cq_ptr = single
+            ? result->sq_ptr
+            : map(fd, result->cq_size, IORING_OFF_CQ_RING);
+        if(result->cq_ptr == MAP_FAILED)
+            return nullptr;
+        result->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        const auto sqes = map(fd, result->sqes_size, IORING_OFF_SQES);
+        if(sqes == MAP_FAILED)
+            return nullptr;
+        result->sqes = static_cast<io_uring_sqe*>(sqes);
+
+        const auto sq = static_cast<char*>(result->sq_ptr);
+        result->sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        result->sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        result->sq_mask =
+            *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        result->sq_array =
+            reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        const auto cq = static_cast<char*>(result->cq_ptr);
+        result->cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        result->cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        result->cq_mask =
+            *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        result->cqes =
+            reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        return result;
+    }
+
+    ~ring() {
+        if(sqes)
+            munmap(sqes, sqes_size);
+        if(cq_ptr != MAP_FAILED && cq_ptr != sq_ptr)
+            munmap(cq_ptr, cq_size);
+        if(sq_ptr != MAP_FAILED)
+            munmap(sq_ptr, sq_size);
+        ::close(fd);
+    }
+
+    static void* map(int fd, std::size_t size, off_t offset) {
+        return mmap(
+            nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            fd, offset);
+    }
+
+    //! @brief Queues write of the slot, submitted by the next submit().
+    void push(
+        std::size_t index, int file, char* data, std::size_t size,
+        std::uint64_t offset) {
+        const auto tail = *sq_tail;
+        const auto position = tail & sq_mask;
+        iovecs[index].iov_base = data;
+        iovecs[index].iov_len = size;
+        auto& sqe = sqes[position];
+        std::memset(&sqe, 0, sizeof(sqe));
+        // IORING_OP_WRITE appeared in 5.6, vectored one is supported since 5.1
+        sqe.opcode = IORING_OP_WRITEV;
+        sqe.fd = file;
+        sqe.addr = reinterpret_cast<std::uint64_t>(&iovecs[index]);
+        sqe.len = 1;
+        sqe.off = offset;
+        sqe.user_data = index;
+        sq_array[position] = position;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    //! @brief Submits queued writes.
+    void submit() {
+        enter(*sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE), 0);
+    }
+
+    //! @brief Waits for at least one completion without submitting.
+    void wait() {
+        enter(0, 1);
+    }
+
+    void enter(unsigned to_submit, unsigned min_complete) {
+        const auto flags = min_complete ? IORING_ENTER_GETEVENTS : 0u;
+        while(syscall(
+                  __NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                  nullptr, 0)
+              < 0) {
+            if(errno == EINTR)
+                continue;
+
+            std::stringstream error;
+            error << "Unable to submit writes: " << std::strerror(errno)
+                  << ";";
+            throw std::runtime_error(error.str());
+        }
+    }
+
+    //! @brief Takes completed writes as pairs of the slot and the result.
+    std::vector<std::pair<std::size_t, long>> completed() {
+        std::vector<std::pair<std::size_t, long>> result;
+        auto head = *cq_head;
+        const auto tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        for(; head != tail; ++head) {
+            const auto& cqe = cqes[head & cq_mask];
+            result.emplace_back(
+                static_cast<std::size_t>(cqe.user_data), cqe.res);
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        return result;
+    }
+
+    int fd = -1;
+    void* sq_ptr = MAP_FAILED;
+    std::size_t sq_size = 0;
+    void* cq_ptr = MAP_FAILED;
+    std::size_t cq_size = 0;
+    io_uring_sqe* sqes = nullptr;
+    std::size_t sqes_size = 0;
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned sq_mask = 0;
+    unsigned* sq_array = nullptr;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+    std::vector<iovec> iovecs;
+};
+#else
+//! @brief Stub of the ring, which is never created.
+struct async_writer::ring {
+    static std::unique_ptr<ring> create(unsigned) {
+        return nullptr;
+    }
+
+    void push(std::size_t, int, char*, std::size_t, std::uint64_t) {
+    }
+
+    void submit() {
+    }
+
+    void wait() {
+    }
+
+    std::vector<std::pair<std::size_t, long>> completed() {
+        return {};
+    }
+};
+#endif
+
+constexpr std::size_t async_writer::block_size;
+
+async_writer::async_writer(
+    std::size_t buffer_size, unsigned buffer_count, bool direct,
+    bool synchronous)
+    : buffer_size(round_up(std::max(buffer_size, min_buffer_size), block_size))
+    , direct(direct) {
+    if(buffer_count == 0)
+        throw std::invalid_argument("Unsupported number of buffers: 0;");
+
+    // storage is aligned manually, since C++14 has no aligned allocation
+    storage.reset(new char[this->buffer_size * buffer_count + block_size]);
+    const auto address = reinterpret_cast<std::uintptr_t>(storage.get());
+    const auto first = storage.get() + round_up(address, block_size) - address;
+    for(auto i = 0u; i < buffer_count; ++i) {
+        slots.push_back({first + i * this->buffer_size, nullptr, 0, 0, 0});
+        free_slots.push_back(buffer_count - 1 - i);
+    }
+
+    if(!synchronous)
+        uring = ring::create(buffer_count);
+    this->direct = direct && uring;
+}
+
+async_writer::~async_writer() {
+    try {
+        drain();
+    }
+    catch(const std::exception&) {
+        // files are closed by their states anyway
+    }
+}
+
+bool async_writer::is_async() const noexcept {
+    return uring != nullptr;
+}
+
+bool async_writer::is_direct() const noexcept {
+    return direct;
+}
+
+std::size_t async_writer::get_buffer_size() const noexcept {
+    return buffer_size;
+}
+
+std::size_t async_writer::get_write_granularity() const noexcept {
+    return direct ? block_size : 1;
+}
+
+async_writer::file_t async_writer::open(const std::string& path) {
+    // existing file may be the hard link of the cached output
+    std::remove(path.c_str());
+    auto file = std::make_shared<file_state>();
+    file->path = path;
+    auto opened = false;
+#if defined(SP_IO_URING)
+    if(uring) {
+        const auto flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+        // O_DIRECT isn't supported by some file systems, e.g. tmpfs
+        if(direct)
+            file->fd = ::open(path.c_str(), flags | O_DIRECT, 0666);
+        file->direct = file->fd >= 0;
+        if(file->fd < 0)
+            file->fd = ::open(path.c_str(), flags, 0666);
+        opened = file->fd >= 0;
+    }
+    else
+#endif
+    {
+        file->stream.open(path, std::ios::binary);
+        opened = file->stream.is_open();
+    }
+
+    if(!opened) {
+        std::stringstream error;
+        error << "Unable to open for writing: " << path << ";";
+        throw std::runtime_error(error.str());
+    }
+    return file;
+}
+
+char* async_writer::acquire() {
+    handlers_t handlers;
+    std::unique_lock<std::mutex> lock(mutex);
+    // buffers may be held by the other threads rather than be in flight
+    while(free_slots.empty()) {
+        if(in_flight)
+            reap(lock, handlers);
+        else
+            released.wait(lock);
+    }
+
+    const auto index = free_slots.back();
+    free_slots.pop_back();
+    lock.unlock();
+    call(handlers);
+    return slots[index].data;
+}
+
+void async_writer::submit(const file_t& file, char* buffer, std::size_t size) {
+    const auto first = reinterpret_cast<std::uintptr_t>(slots.front().data);
+    const auto address = reinterpret_cast<std::uintptr_t>(buffer);
+    const auto index = static_cast<std::size_t>(address - first) / buffer_size;
+    if(address < first || index >= slots.size()
+       || slots[index].data != buffer || size > buffer_size) {
+        std::stringstream error;
+        error << "Unsupported buffer of " << size << " bytes;";
+        throw std::invalid_argument(error.str());
+    }
+
+    handlers_t handlers;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& item = slots[index];
+        item.file = file;
+        item.offset = file->offset;
+        item.size = size;
+        item.written = 0;
+        file->offset += size;
+        ++file->pending;
+        ++in_flight;
+        if(file->direct) {
+            // the last block is truncated when the file is closed
+            item.size = round_up(size, block_size);
+            std::memset(buffer + size, 0, item.size - size);
+        }
+        if(item.size)
+            start(index, handlers);
+        else
+            complete(index, 0, handlers);
+    }
+    released.notify_all();
+    call(handlers);
+}
+
+void async_writer::close(const file_t& file, on_close_t on_close) {
+    handlers_t handlers;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        file->closing = true;
+        file->on_close = std::move(on_close);
+        if(!file->pending)
+            finish(file, handlers);
+    }
+    call(handlers);
+}
+
+void async_writer::drain() {
+    handlers_t handlers;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while(in_flight)
+            reap(lock, handlers);
+    }
+    call(handlers);
+}
+
+void async_writer::start(std::size_t index, handlers_t& handlers) {
+    auto& item = slots[index];
+    auto& file = *item.file;
+    if(!uring) {
+        file.stream.write(item.data, item.size);
+        complete(index, file.stream ? static_cast<long>(item.size) : -EIO,
+                 handlers);
+        return;
+    }
+
+    uring->push(
+        index, file.fd, item.data + item.written, item.size - item.written,
+        item.offset + item.written);
+    uring->submit();
+}
+
+void async_writer::complete(
+    std::size_t index, long result, handlers_t& handlers) {
+    auto& item = slots[index];
+    auto& file = *item.file;
+    if(result > 0 && item.written + result < item.size) {
+        // short write, e.g. interrupted by the signal, is continued
+        item.written += static_cast<std::size_t>(result);
+        start(index, handlers);
+        return;
+    }
+
+    const auto failed = result < 0 || item.written + result < item.size;
+    if(failed && !file.error)
+        file.error = write_error(
+            file.path, result < 0 ? static_cast<int>(-result) : EIO);
+
+    const auto owner = std::move(item.file);
+    free_slots.push_back(index);
+    --in_flight;
+    if(!--owner->pending && owner->closing)
+        finish(owner, handlers);
+}
+
+void async_writer::reap(
+    std::unique_lock<std::mutex>& lock, handlers_t& handlers) {
+    if(reaping) {
+        // completions are handled by the other thread
+        released.wait(lock);
+        return;
+    }
+
+    // writes are submitted and buffers are released meanwhile
+    reaping = true;
+    lock.unlock();
+    try {
+        uring->wait();
+    }
+    catch(const std::exception&) {
+        lock.lock();
+        reaping = false;
+        released.notify_all();
+        throw;
+    }
+
+    lock.lock();
+    reaping = false;
+    for(const auto& item : uring->completed())
+        complete(item.first, item.second, handlers);
+    released.notify_all();
+}
+
+void async_writer::finish(const file_t& file, handlers_t& handlers) {
+#if defined(SP_IO_URING)
+    if(file->fd >= 0) {
+        // padding of the last direct write is cut off
+        const auto size = static_cast<off_t>(file->offset);
+        if(file->direct && ftruncate(file->fd, size) != 0 && !file->error)
+            file->error = write_error(file->path, errno);
+        if(::close(file->fd) != 0 && !file->error)
+            file->error = write_error(file->path, errno);
+        file->fd = -1;
+    }
+#endif
+    if(file->stream.is_open()) {
+        file->stream.close();
+        if(!file->stream && !file->error)
+            file->error = write_error(file->path, EIO);
+    }
+
+    if(!file->on_close)
+        return;
+    auto on_close = std::move(file->on_close);
+    const auto error = file->error;
+    handlers.push_back([on_close, error] { on_close(error); });
+}
+
+void async_writer::call(handlers_t& handlers) {
+    for(const auto& handler : handlers)
+        handler();
+    handlers.clear();
+}
+
+} // namespace sp
\ No newline at end of file
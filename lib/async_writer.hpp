@@ -0,0 +1,179 @@
+///
+/// \file
+/// Defines the sp::async_writer class, which writes output files by the pool
+/// of buffers submitted to io_uring.
+///
+
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace sp {
+
+/** @brief Writes files asynchronously by the pool of the aligned buffers.
+
+The caller acquires the buffer, fills it and submits it to the file, then
+acquires the next one while the previous is being written. Buffers of the
+completed writes return to the pool, so the caller waits for the disk only
+when all the buffers are in flight. Files are closed asynchronously too, so
+buffers of many files are in flight at the same time and the batch of files
+is written at the bandwidth of the device instead of one by one.
+
+On Linux the writes are submitted to io_uring by the system calls, so no
+library is required; files may be opened with O_DIRECT to bypass the page
+cache. If io_uring is unavailable, e.g. on kernels older than 5.1 or on other
+systems, buffers are written synchronously by the submitting thread.
+
+Writer is thread safe, and the completion handlers are called by the thread
+waiting for the buffers or the completion, after the file is closed.
+
+Usage example:
+@code
+    async_writer writer;
+    const auto file = writer.open("Lena.integral");
+    const auto buffer = writer.acquire();
+    const auto size = format(buffer, writer.get_buffer_size());
+    writer.submit(file, buffer, size);
+    writer.close(file, [](std::exception_ptr error) {
+        // file is written unless error is set
+    });
+    writer.drain();
+@endcode
+*/
+class async_writer {
+public:
+    struct file_state;
+
+    //! @brief File opened by the writer.
+    using file_t = std::shared_ptr<file_state>;
+
+    //! @brief Handler of the closed file, which receives the write error.
+    using on_close_t = std::function<void(std::exception_ptr)>;
+
+    //! @brief Alignment of the buffers and of the direct writes.
+    static constexpr std::size_t block_size = 4096;
+
+public:
+    /** @brief Constructs writer.
+
+    @param buffer_size Size of each buffer, rounded up to the block size,
+    at least 64 KiB.
+    @param buffer_count Number of the buffers, which limits writes in flight.
+    @param direct Whether to open files with O_DIRECT if supported.
+    @param synchronous Whether to write by the submitting thread anyway.
+    @throw std::invalid_argument In case of no buffers.
+    */
+    explicit async_writer(
+        std::size_t buffer_size = 1 << 20, unsigned buffer_count = 16,
+        bool direct = false, bool synchronous = false);
+
+    //! @brief Waits for all the writes and closes the files.
+    ~async_writer();
+
+    async_writer(const async_writer&) = delete;
+    async_writer& operator=(const async_writer&) = delete;
+
+    //! @brief Retruns whether writes are submitted to io_uring.
+    bool is_async() const noexcept;
+
+    //! @brief Retruns whether files are opened with O_DIRECT.
+    bool is_direct() const noexcept;
+
+    //! @brief Retruns size of the buffers.
+    std::size_t get_buffer_size() const noexcept;
+
+    /** @brief Returns granularity of the submitted sizes.
+
+    Every buffer but the last one of the file should be the multiple of it,
+    which is the block size for direct writes and one otherwise.
+    */
+    std::size_t get_write_granularity() const noexcept;
+
+    /** @brief Creates file, the existing one is replaced.
+
+    @param path Output file.
+    @throw std::runtime_error In case of the failure.
+    */
+    file_t open(const std::string& path);
+
+    //! @brief Returns free buffer, waits for the completed write if needed.
+    char* acquire();
+
+    /** @brief Appends buffer to the file.
+
+    Buffer returns to the pool when written. Write errors are reported to the
+    handler of the closed file.
+    @param file Opened file.
+    @param buffer Buffer returned by acquire().
+    @param size Number of bytes to write.
+    @throw std::runtime_error In case of the failure of io_uring.
+    */
+    void submit(const file_t& file, char* buffer, std::size_t size);
+
+    /** @brief Closes file after its pending writes.
+
+    @param file Opened file, which mustn't be used anymore.
+    @param on_close Handler of the closed file.
+    */
+    void close(const file_t& file, on_close_t on_close = on_close_t());
+
+    //! @brief Waits for all the submitted writes and closes of the files.
+    void drain();
+
+private:
+    struct ring;
+
+    //! @brief Buffer of the pool and its write in flight.
+    struct slot {
+        char* data;
+        file_t file;
+        std::uint64_t offset;
+        std::size_t size;
+        std::size_t written;
+    };
+
+    using handlers_t = std::vector<std::function<void()>>;
+
+    //! @brief Starts write of the slot.
+    void start(std::size_t index, handlers_t& handlers);
+
+    //! @brief Handles result of the write of the slot.
+    void complete(std::size_t index, long result, handlers_t& handlers);
+
+    /** @brief Waits for at least one write and handles completed ones.
+
+    Only one thread waits for the completions, without holding the lock, while
+    the others wait until it handles them.
+    @param lock Lock of the mutex, released while waiting.
+    @param handlers Handlers of the closed files.
+    */
+    void reap(std::unique_lock<std::mutex>& lock, handlers_t& handlers);
+
+    //! @brief Closes file without pending writes.
+    void finish(const file_t& file, handlers_t& handlers);
+
+    //! @brief Calls handlers of the closed files outside of the lock.
+    static void call(handlers_t& handlers);
+
+private:
+    std::size_t buffer_size;
+    bool direct;
+    std::unique_ptr<char[]> storage;
+    std::vector<slot> slots;
+    std::vector<std::size_t> free_slots;
+    std::size_t in_flight = 0;
+    //! @brief Whether some thread waits for the completions.
+    bool reaping = false;
+    std::unique_ptr<ring> uring;
+    std::mutex mutex;
+    std::condition_variable released;
+};
+
+} // namespace sp
\ No newline at end of file
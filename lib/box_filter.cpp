@@ -0,0 +1,163 @@
+#include "box_filter.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include "integral_kernels.hpp"
+
+namespace sp {
+namespace {
+
+//! @brief Number of rows computed by the single parallel task.
+constexpr int band_rows = 32;
+
+/** @brief Clipped windows along the rows or the columns.
+
+Window of the position k spans [begin[k], end[k]) in coordinates of the
+element boundaries, so its sum is combined from the integral image elements
+begin[k] - 1 and end[k] - 1. Windows of the positions [first, last) aren't
+clipped and don't start at the border.
+*/
+struct extents {
+    extents(int size, int length) : begin(length), end(length) {
+        const auto anchor = size / 2;
+        for(auto k = 0; k < length; ++k) {
+            begin[k] = std::max(k - anchor, 0);
+            end[k] = std::min(k - anchor + size, length);
+        }
+        first = std::min(anchor + 1, length);
+        last = std::max(first, length - size + anchor + 1);
+    }
+
+    std::vector<int> begin;
+    std::vector<int> end;
+    int first;
+    int last;
+};
+
+//! @brief Returns integral image element before the boundary or zero.
+template<typename A>
+double element(const A* row, int boundary) {
+    return row && boundary > 0 ? static_cast<double>(row[boundary - 1]) : 0;
+}
+
+//! @brief Computes sums of the windows of the row.
+template<typename A>
+void sum_row(
+    const cv::Mat& integral, const extents& rows, const extents& cols, int i,
+    double* dst) {
+    const auto top = rows.begin[i] > 0
+        ? integral.ptr<A>(rows.begin[i] - 1)
+        : nullptr;
+    const auto bottom = integral.ptr<A>(rows.end[i] - 1);
+    auto clipped = [&](int j) {
+        const auto left = cols.begin[j];
+        const auto right = cols.end[j];
+        dst[j] = element(bottom, right) - element(bottom, left)
+            - element(top, right) + element(top, left);
+    };
+
+    for(auto j = 0; j < cols.first; ++j)
+        clipped(j);
+    if(cols.last > cols.first) {
+        const auto offset = cols.begin[cols.first] - 1;
+        kernel::sum_boxes(
+            top ? top + offset : nullptr, bottom + offset,
+            cols.end[cols.first] - cols.begin[cols.first],
+            cols.last - cols.first, dst + cols.first);
+    }
+    for(auto j = cols.last; j < integral.cols; ++j)
+        clipped(j);
+}
+
+void validate(const cv::Mat& integral) {
+    const auto type = integral.type();
+    if(type == CV_32SC1 || type == CV_64FC1)
+        return;
+
+    std::stringstream error;
+    error << "Unsupported integral image type: " << type << ";";
+    throw std::invalid_argument(error.str());
+}
+
+//! @brief Invokes functor for the bands of the rows in parallel.
+template<typename Fn>
+void for_bands(int rows, Fn&& fn) {
+    const auto bands = (rows + band_rows - 1) / band_rows;
+    cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range& range) {
+        const auto end = std::min(range.end * band_rows, rows);
+        for(auto i = range.start * band_rows; i < end; ++i)
+            fn(i);
+    });
+}
+
+} // namespace
+
+box_filter::box_filter(int size) : size(size) {
+    if(size <= 0) {
+        std::stringstream error;
+        error << "Unsupported window size: " << size << ";";
+        throw std::invalid_argument(error.str());
+    }
+}
+
+int box_filter::get_size() const noexcept {
+    return size;
+}
+
+cv::Mat box_filter::sum(const cv::Mat& integral) const {
+    validate(integral);
+    cv::Mat result(integral.size(), CV_64F);
+    const extents rows(size, integral.rows);
+    const extents cols(size, integral.cols);
+    for_bands(integral.rows, [&](int i) {
+        if(integral.depth() == CV_32S)
+            sum_row<std::int32_t>(
+                integral, rows, cols, i, result.ptr<double>(i));
+        else
+            sum_row<double>(integral, rows, cols, i, result.ptr<double>(i));
+    });
+    return result;
+}
+
+void box_filter::mean_variance(
+    const cv::Mat& sum, const cv::Mat& sqsum, cv::Mat& mean,
+    cv::Mat& variance) const {
+    validate(sum);
+    if(sqsum.type() != CV_64FC1 || sqsum.size() != sum.size()) {
+        std::stringstream error;
+        error << "Unsupported squared integral image: " << sqsum.rows << "x"
+              << sqsum.cols << " of type " << sqsum.type() << ";";
+        throw std::invalid_argument(error.str());
+    }
+
+    mean.create(sum.size(), CV_64F);
+    variance.create(sum.size(), CV_64F);
+    const extents rows(size, sum.rows);
+    const extents cols(size, sum.cols);
+    std::vector<double> widths(sum.cols);
+    for(auto j = 0; j < sum.cols; ++j)
+        widths[j] = cols.end[j] - cols.begin[j];
+
+    for_bands(sum.rows, [&](int i) {
+        // sums are computed in-place, then divided by the window areas
+        const auto m = mean.ptr<double>(i);
+        const auto v = variance.ptr<double>(i);
+        if(sum.depth() == CV_32S)
+            sum_row<std::int32_t>(sum, rows, cols, i, m);
+        else
+            sum_row<double>(sum, rows, cols, i, m);
+        sum_row<double>(sqsum, rows, cols, i, v);
+
+        const double height = rows.end[i] - rows.begin[i];
+        for(auto j = 0; j < sum.cols; ++j) {
+            const auto area = height * widths[j];
+            m[j] /= area;
+            v[j] = std::max(v[j] / area - m[j] * m[j], 0.0);
+        }
+    });
+}
+
+} // namespace sp
\ No newline at end of file
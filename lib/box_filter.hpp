@@ -0,0 +1,75 @@
+///
+/// \file
+/// Defines the sp::box_filter class, which computes local sums, means and
+/// variances over the sliding window by the integral images.
+///
+
+#pragma once
+#include "opencv2/core.hpp"
+
+namespace sp {
+
+/** @brief Sliding K x K window statistics by the computed integral images.
+
+Window of the element (i, j) spans rows [i - K/2, i - K/2 + K) and the same
+columns, as the window of cv::boxFilter with the default anchor. Windows are
+clipped by the image, so the mean and the variance near the border are of
+the elements inside the image only, which suits adaptive thresholding.
+
+Each sum costs four lookups regardless of K. Windows lying inside the image
+are summed by the vector kernel without any boundary checks, and only the
+clipped columns near the left and right borders are summed one by one.
+Rows are splitted to bands processed in parallel.
+
+Usage example:
+@code
+    auto context = processing_context(
+        "Lena", LenaMat, 0, accumulator::automatic,
+        output::sum | output::sqsum);
+    context.execute();
+    cv::Mat mean, variance;
+    box_filter(15).mean_variance(
+        context.get_result(), context.get_sqsum(), mean, variance);
+    const auto mask = LenaMat > mean - 0.2 * sqrt(variance);
+@endcode
+*/
+class box_filter {
+public:
+    /** @brief Constructs filter.
+
+    @param size Size K of the window.
+    @throw std::invalid_argument In case of the non-positive size.
+    */
+    explicit box_filter(int size);
+
+    //! @brief Retruns size of the window.
+    int get_size() const noexcept;
+
+    /** @brief Returns sums of the windows.
+
+    @param integral Single channel integral image of CV_32S or CV_64F depth.
+    @return Matrix of CV_64F depth and the same size.
+    @throw std::invalid_argument In case of the unsupported matrix type.
+    */
+    cv::Mat sum(const cv::Mat& integral) const;
+
+    /** @brief Computes means and variances of the windows.
+
+    Variance is the mean of the squares minus the squared mean, clamped to
+    zero against rounding.
+    @param sum Single channel integral image of CV_32S or CV_64F depth.
+    @param sqsum Squared integral image of the same size.
+    @param mean Output means of CV_64F depth.
+    @param variance Output variances of CV_64F depth.
+    @throw std::invalid_argument In case of the unsupported matrix types or
+    sizes.
+    */
+    void mean_variance(
+        const cv::Mat& sum, const cv::Mat& sqsum, cv::Mat& mean,
+        cv::Mat& variance) const;
+
+private:
+    int size;
+};
+
+} // namespace sp
\ No newline at end of file
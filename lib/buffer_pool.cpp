@@ -0,0 +1,189 @@
+#include "buffer_pool.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#if defined(_WIN32)
+#include <malloc.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace sp {
+namespace {
+
+//! @brief Alignment of the buffers to the cache line.
+constexpr std::size_t line_size = 64;
+
+//! @brief Buffers of that size and above are aligned to the huge page.
+constexpr std::size_t huge_page_size = std::size_t(1) << 21;
+
+void* aligned_malloc(std::size_t size, std::size_t alignment) {
+#if defined(_WIN32)
+    const auto buffer = _aligned_malloc(size, alignment);
+#else
+    void* buffer = nullptr;
+    if(posix_memalign(&buffer, alignment, size))
+        buffer = nullptr;
+#endif
+    if(!buffer)
+        throw std::bad_alloc();
+    return buffer;
+}
+
+void aligned_free(void* buffer) {
+#if defined(_WIN32)
+    _aligned_free(buffer);
+#else
+    std::free(buffer);
+#endif
+}
+
+//! @brief Node of the buffers allocated by the current thread.
+thread_local int current_node = -1;
+
+} // namespace
+
+buffer_pool::node_scope::node_scope(int node) noexcept
+    : previous(current_node) {
+    current_node = node;
+}
+
+buffer_pool::node_scope::~node_scope() {
+    current_node = previous;
+}
+
+buffer_pool::buffer_pool(std::size_t max_cached_bytes)
+    : max_cached_bytes(max_cached_bytes) {
+}
+
+buffer_pool::~buffer_pool() {
+    trim();
+}
+
+buffer_pool& buffer_pool::instance() {
+    // matrices may be released by the destructors of the other statics
+    static auto pool = new buffer_pool();
+    return *pool;
+}
+
+std::size_t buffer_pool::size_class(std::size_t bytes) noexcept {
+    if(bytes <= line_size)
+        return line_size;
+
+    auto power = line_size;
+    while(power * 2 < bytes)
+        power *= 2;
+    const auto granule = std::max(line_size, power / 8);
+    return (bytes + granule - 1) / granule * granule;
+}
+
+std::size_t buffer_pool::cached_bytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return cached;
+}
+
+std::size_t buffer_pool::system_allocations() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return allocations;
+}
+
+void buffer_pool::trim() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for(auto& list : free_lists)
+        for(auto buffer : list.second)
+            aligned_free(buffer);
+    free_lists.clear();
+    cached = 0;
+}
+
+cv::UMatData* buffer_pool::allocate(
+    int dims, const int* sizes, int type, void* data, std::size_t* step,
+    int flags, cv::UMatUsageFlags usage) const {
+    if(data)
+        return cv::Mat::getStdAllocator()->allocate(
+            dims, sizes, type, data, step, flags, usage);
+
+    auto total = static_cast<std::size_t>(CV_ELEM_SIZE(type));
+    for(auto i = dims - 1; i >= 0; --i) {
+        if(step)
+            step[i] = total;
+        total *= sizes[i];
+    }
+
+    auto u = new cv::UMatData(this);
+    try {
+        u->data = u->origdata = static_cast<unsigned char*>(acquire(total));
+    }
+    catch(...) {
+        delete u;
+        throw;
+    }
+    u->size = total;
+    return u;
+}
+
+bool buffer_pool::allocate(
+    cv::UMatData* data, int, cv::UMatUsageFlags) const {
+    return data != nullptr;
+}
+
+void buffer_pool::deallocate(cv::UMatData* data) const {
+    if(!data)
+        return;
+
+    release(data->origdata, data->size);
+    delete data;
+}
+
+void* buffer_pool::acquire(std::size_t bytes) const {
+    const auto size = size_class(bytes);
+    const auto node = current_node;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto list = free_lists.find({node, size});
+        if(list != free_lists.end() && !list->second.empty()) {
+            auto buffer = list->second.back();
+            list->second.pop_back();
+            cached -= size;
+            if(node >= 0)
+                nodes[buffer] = node;
+            return buffer;
+        }
+        ++allocations;
+    }
+
+    const auto alignment = size >= huge_page_size ? huge_page_size : line_size;
+    const auto buffer = aligned_malloc(size, alignment);
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if(size >= huge_page_size)
+        madvise(buffer, size, MADV_HUGEPAGE);
+#endif
+    if(node >= 0) {
+        std::lock_guard<std::mutex> lock(mutex);
+        nodes[buffer] = node;
+    }
+    return buffer;
+}
+
+void buffer_pool::release(void* buffer, std::size_t bytes) const {
+    const auto size = size_class(bytes);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto node = -1;
+        const auto it = nodes.find(buffer);
+        if(it != nodes.end()) {
+            node = it->second;
+            nodes.erase(it);
+        }
+        if(cached + size <= max_cached_bytes) {
+            free_lists[{node, size}].push_back(buffer);
+            cached += size;
+            return;
+        }
+    }
+
+    aligned_free(buffer);
+}
+
+} // namespace sp
\ No newline at end of file
@@ -0,0 +1,132 @@
+///
+/// \file
+/// Defines the sp::buffer_pool class, which recycles memory of the integral
+/// images.
+///
+
+#pragma once
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "opencv2/core.hpp"
+
+namespace sp {
+
+/** @brief Matrix allocator recycling released buffers by size classes.
+
+Buffer of the released matrix is kept in the free list of its size class and
+is handed out to the next matrix of the same class, so the steady flow of the
+similar matrices doesn't allocate their data at all. Sizes are rounded up to
+the classes spaced by 1/8 of the power of two, which bounds the waste by
+12.5%. Buffers are aligned to the cache line, and the large ones to the huge
+page, which is advised to the kernel.
+
+Buffers may be tagged by the NUMA node of the threads, which will fill them.
+Fresh buffers aren't written by the pool, so their pages are placed to the
+node of the thread writing them first, and the cached ones are handed out
+only to the matrices of the same node, so the recycled memory stays local.
+
+Buffers are returned to the pool when the last matrix referencing them is
+released, e.g. when the caller drops the tasks of the completed matrix, so
+the pool must outlive all its matrices. Pool is thread safe.
+
+Usage example:
+@code
+    cv::Mat result;
+    result.allocator = &buffer_pool::instance();
+    result.create(rows, cols, CV_64F);
+@endcode
+*/
+class buffer_pool : public cv::MatAllocator {
+public:
+    /** @brief Tags buffers allocated by the thread within the scope.
+
+    Usage example:
+    @code
+        {
+            buffer_pool::node_scope scope(1);
+            result.create(rows, cols, CV_64F); // filled by the node 1
+        }
+    @endcode
+    */
+    class node_scope {
+    public:
+        //! @brief Tags buffers by the index of the node, -1 for any node.
+        explicit node_scope(int node) noexcept;
+
+        //! @brief Restores the tag of the enclosing scope.
+        ~node_scope();
+
+        node_scope(const node_scope&) = delete;
+        node_scope& operator=(const node_scope&) = delete;
+
+    private:
+        int previous;
+    };
+
+public:
+    /** @brief Constructs empty pool.
+
+    @param max_cached_bytes Maximal size of the buffers kept in the free
+    lists; buffers released above it are freed.
+    */
+    explicit buffer_pool(std::size_t max_cached_bytes = std::size_t(1) << 30);
+
+    //! @brief Frees the cached buffers.
+    ~buffer_pool() override;
+
+    /** @brief Returns the process wide pool.
+
+    Pool is never destroyed, so it may be used by the matrices of any
+    lifetime.
+    */
+    static buffer_pool& instance();
+
+    //! @brief Returns size of the class of the buffer of that size.
+    static std::size_t size_class(std::size_t bytes) noexcept;
+
+    //! @brief Retruns size of the buffers kept in the free lists.
+    std::size_t cached_bytes() const;
+
+    //! @brief Retruns number of the buffers allocated from the system.
+    std::size_t system_allocations() const;
+
+    //! @brief Frees the cached buffers.
+    void trim();
+
+    cv::UMatData* allocate(
+        int dims, const int* sizes, int type, void* data, std::size_t* step,
+        int flags, cv::UMatUsageFlags usage) const override;
+
+    bool allocate(
+        cv::UMatData* data, int access, cv::UMatUsageFlags usage)
+        const override;
+
+    void deallocate(cv::UMatData* data) const override;
+
+private:
+    //! @brief Free list of the size class of the node.
+    using list_key = std::pair<int, std::size_t>;
+
+private:
+    //! @brief Takes the cached buffer of the class or allocates the new one.
+    void* acquire(std::size_t bytes) const;
+
+    //! @brief Caches the buffer of the class or frees it.
+    void release(void* buffer, std::size_t bytes) const;
+
+private:
+    std::size_t max_cached_bytes;
+
+    mutable std::mutex mutex;
+    mutable std::map<list_key, std::vector<void*>> free_lists;
+    // nodes of the tagged buffers in use
+    mutable std::unordered_map<void*, int> nodes;
+    mutable std::size_t cached = 0;
+    mutable std::size_t allocations = 0;
+};
+
+} // namespace sp
\ No newline at end of file
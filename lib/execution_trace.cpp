@@ -0,0 +1,185 @@
+#include "execution_trace.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <utility>
+
+namespace sp {
+namespace {
+
+//! @brief Writes the string as JSON string literal.
+void write_json_string(std::ostream& output, const std::string& value) {
+    output << '"';
+    for(const auto ch : value) {
+        switch(ch) {
+        case '"':
+            output << "\\\"";
+            break;
+        case '\\':
+            output << "\\\\";
+            break;
+        case '\n':
+            output << "\\n";
+            break;
+        default:
+            if(static_cast<unsigned char>(ch) < 0x20)
+                output << "\\u" << std::hex << std::setw(4)
+                       << std::setfill('0') << static_cast<int>(ch)
+                       << std::dec << std::setfill(' ');
+            else
+                output << ch;
+        }
+    }
+    output << '"';
+}
+
+//! @brief Serial number of the next trace, zero isn't used.
+std::atomic<std::uint64_t> next_serial{1};
+
+//! @brief Adds the value to the counter, which has the single writer.
+template<typename T>
+void add_relaxed(std::atomic<T>& counter, T value) noexcept {
+    counter.store(
+        counter.load(std::memory_order_relaxed) + value,
+        std::memory_order_relaxed);
+}
+
+} // namespace
+
+const char* stage_name(stage kind) noexcept {
+    static const char* names[stage_count] = {
+        "decode", "queue", "compute", "carry", "merge", "write"};
+    return names[static_cast<std::size_t>(kind)];
+}
+
+execution_trace::execution_trace()
+    : start(clock::now()), serial(next_serial++) {
+}
+
+void execution_trace::set_keep_events(bool keep) noexcept {
+    keep_events = keep;
+}
+
+void execution_trace::record(
+    stage kind, const std::string& id, int channel, clock::time_point begin,
+    clock::time_point end) {
+    const auto duration =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin)
+            .count();
+
+    auto& slot = current_slot();
+    auto& stats = slot.stages[static_cast<std::size_t>(kind)];
+    add_relaxed<std::size_t>(stats.count, 1);
+    add_relaxed<std::int64_t>(stats.total_ns, duration);
+    if(duration > stats.max_ns.load(std::memory_order_relaxed))
+        stats.max_ns.store(duration, std::memory_order_relaxed);
+
+    // waiting in the queue doesn't occupy the thread
+    if(kind != stage::queue)
+        add_relaxed<std::int64_t>(slot.busy_ns, duration);
+
+    if(keep_events) {
+        trace_event event{
+            id, kind, channel, slot.number, since_start(begin),
+            since_start(end)};
+        std::lock_guard<std::mutex> lock(mutex);
+        events.push_back(std::move(event));
+    }
+}
+
+void execution_trace::on_queued() noexcept {
+    const auto depth = ++queue_depth;
+    auto max_depth = max_queue_depth.load();
+    while(depth > max_depth
+          && !max_queue_depth.compare_exchange_weak(max_depth, depth)) {
+    }
+}
+
+void execution_trace::on_dequeued() noexcept {
+    --queue_depth;
+}
+
+void execution_trace::on_enqueued() noexcept {
+    ++images_enqueued;
+}
+
+void execution_trace::on_completed() noexcept {
+    ++images_completed;
+}
+
+execution_stats execution_trace::get_stats() const {
+    execution_stats stats;
+    stats.queue_depth = queue_depth;
+    stats.max_queue_depth = max_queue_depth;
+    stats.images_enqueued = images_enqueued;
+    stats.images_completed = images_completed;
+    stats.elapsed_ns = since_start(clock::now());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for(const auto& thread : threads) {
+        const auto& slot = *thread.second;
+        for(std::size_t k = 0; k < stage_count; ++k) {
+            auto& total = stats.stages[k];
+            const auto& counters = slot.stages[k];
+            total.count += counters.count;
+            total.total_ns += counters.total_ns;
+            total.max_ns =
+                std::max<std::int64_t>(total.max_ns, counters.max_ns);
+        }
+        stats.thread_busy_ns[slot.number] = slot.busy_ns;
+    }
+    return stats;
+}
+
+std::vector<trace_event> execution_trace::get_events() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return events;
+}
+
+void execution_trace::write_chrome_trace(std::ostream& output) const {
+    const auto kept = get_events();
+
+    // complete events ("X") in microseconds
+    const auto flags = output.flags();
+    const auto precision = output.precision();
+    output << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+    for(std::size_t i = 0; i < kept.size(); ++i) {
+        const auto& event = kept[i];
+        output << (i ? ",\n" : "\n") << "{\"name\":\""
+               << stage_name(event.kind)
+               << "\",\"cat\":\"integral\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+               << event.thread << ",\"ts\":" << event.begin / 1000.0
+               << ",\"dur\":" << (event.end - event.begin) / 1000.0
+               << ",\"args\":{\"id\":";
+        write_json_string(output, event.id);
+        output << ",\"channel\":" << event.channel << "}}";
+    }
+    output << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    output.flags(flags);
+    output.precision(precision);
+}
+
+execution_trace::thread_slot& execution_trace::current_slot() {
+    // the thread keeps the slot of the last trace it recorded to, so the
+    // lock is taken once per thread unless it alternates between traces
+    thread_local std::uint64_t cached_serial = 0;
+    thread_local thread_slot* cached_slot = nullptr;
+    if(cached_serial == serial)
+        return *cached_slot;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& slot = threads[std::this_thread::get_id()];
+    if(!slot)
+        slot = std::make_unique<thread_slot>(
+            static_cast<unsigned int>(threads.size() - 1));
+    cached_serial = serial;
+    cached_slot = slot.get();
+    return *slot;
+}
+
+std::int64_t execution_trace::since_start(clock::time_point time) const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time - start)
+        .count();
+}
+
+} // namespace sp
\ No newline at end of file
@@ -0,0 +1,181 @@
+///
+/// \file
+/// Defines the sp::execution_trace class, which collects timings of the
+/// processing stages.
+///
+
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace sp {
+
+//! @brief Stages of the matrix processing.
+enum class stage {
+    //! @brief Reading and decoding of the image, measured by the caller.
+    decode,
+    //! @brief Waiting of the task in the queue of the thread pool.
+    queue,
+    //! @brief Computation of the band or the channel.
+    compute,
+    //! @brief Fix up of the bands by the carry of the preceding ones.
+    carry,
+    //! @brief Grouping of the completed channels of the matrix.
+    merge,
+    //! @brief Invocation of the completion handler.
+    write
+};
+
+//! @brief Number of the stages.
+constexpr std::size_t stage_count = 6;
+
+//! @brief Returns name of the stage.
+const char* stage_name(stage kind) noexcept;
+
+//! @brief Time interval of the stage performed for the matrix.
+struct trace_event {
+    std::string id;
+    stage kind;
+    //! @brief Channel or -1 for all the channels of the matrix.
+    int channel;
+    //! @brief Sequential number of the thread, which performed the stage.
+    unsigned int thread;
+    //! @brief Nanoseconds since the trace is created.
+    std::int64_t begin;
+    std::int64_t end;
+};
+
+//! @brief Aggregated durations of the stage.
+struct stage_stats {
+    std::size_t count = 0;
+    std::int64_t total_ns = 0;
+    std::int64_t max_ns = 0;
+};
+
+//! @brief Snapshot of the execution counters.
+struct execution_stats {
+    std::array<stage_stats, stage_count> stages;
+    //! @brief Tasks posted to the thread pool, but not started yet.
+    std::size_t queue_depth = 0;
+    std::size_t max_queue_depth = 0;
+    std::size_t images_enqueued = 0;
+    std::size_t images_completed = 0;
+    //! @brief Busy time by the sequential thread number.
+    std::map<unsigned int, std::int64_t> thread_busy_ns;
+    //! @brief Nanoseconds since the trace is created.
+    std::int64_t elapsed_ns = 0;
+};
+
+/** @brief Collects timings of the processing stages.
+
+Durations of the stages are aggregated always, that costs two clock reads
+and few relaxed atomic updates per task, which is negligible comparing to
+the computation of the band. Each thread updates its own counters, which are
+allocated at its first record and summed by get_stats(), so the lock is taken
+only to keep the separated events. Events are kept only if requested, they
+may be written in the Chrome trace event format and viewed by
+chrome://tracing or Perfetto.
+
+Usage example:
+@code
+    execution_trace trace;
+    trace.set_keep_events(true);
+    const auto begin = execution_trace::clock::now();
+    decode(file);
+    trace.record(stage::decode, file, -1, begin, execution_trace::clock::now());
+    trace.write_chrome_trace(std::cout);
+@endcode
+*/
+class execution_trace {
+public:
+    using clock = std::chrono::steady_clock;
+
+public:
+    execution_trace();
+
+    //! @brief Enables keeping of the separated events.
+    void set_keep_events(bool keep) noexcept;
+
+    /** @brief Records the stage performed by the current thread.
+
+    @param kind Stage.
+    @param id Matrix identification.
+    @param channel Channel or -1 for all the channels.
+    @param begin Start of the stage.
+    @param end Finish of the stage.
+    */
+    void record(
+        stage kind, const std::string& id, int channel, clock::time_point begin,
+        clock::time_point end);
+
+    //! @brief Counts the task posted to the thread pool.
+    void on_queued() noexcept;
+
+    //! @brief Counts the task taken from the queue of the thread pool.
+    void on_dequeued() noexcept;
+
+    //! @brief Counts the matrix taken to the processing.
+    void on_enqueued() noexcept;
+
+    //! @brief Counts the matrix passed to the completion handler.
+    void on_completed() noexcept;
+
+    //! @brief Retruns current counters.
+    execution_stats get_stats() const;
+
+    //! @brief Retruns kept events.
+    std::vector<trace_event> get_events() const;
+
+    //! @brief Writes kept events in the Chrome trace event format.
+    void write_chrome_trace(std::ostream& output) const;
+
+private:
+    //! @brief Durations of the stage performed by the thread.
+    struct stage_counters {
+        std::atomic<std::size_t> count{0};
+        std::atomic<std::int64_t> total_ns{0};
+        std::atomic<std::int64_t> max_ns{0};
+    };
+
+    //! @brief Counters of the thread, which are updated by it only.
+    struct thread_slot {
+        explicit thread_slot(unsigned int number) : number(number) {
+        }
+
+        //! @brief Sequential number of the thread.
+        const unsigned int number;
+        std::array<stage_counters, stage_count> stages;
+        std::atomic<std::int64_t> busy_ns{0};
+    };
+
+    //! @brief Returns counters of the current thread, creates them if needed.
+    thread_slot& current_slot();
+
+    //! @brief Returns nanoseconds since the trace is created.
+    std::int64_t since_start(clock::time_point time) const;
+
+private:
+    const clock::time_point start;
+    //! @brief Identifies the trace for the slots cached by the threads.
+    const std::uint64_t serial;
+    std::atomic<bool> keep_events{false};
+    std::atomic<std::size_t> queue_depth{0};
+    std::atomic<std::size_t> max_queue_depth{0};
+    std::atomic<std::size_t> images_enqueued{0};
+    std::atomic<std::size_t> images_completed{0};
+
+    mutable std::mutex mutex;
+    std::map<std::thread::id, std::unique_ptr<thread_slot>> threads;
+    std::vector<trace_event> events;
+};
+
+} // namespace sp
\ No newline at end of file
@@ -0,0 +1,29 @@
+#include "image_decoder.hpp"
+
+#include <climits>
+#include "boost/iostreams/device/mapped_file.hpp"
+
+namespace sp {
+
+cv::Mat decode_image(const std::string& path, int flags) {
+    boost::iostreams::mapped_file_source file;
+    try {
+        file.open(path);
+    }
+    catch(const std::exception&) {
+        // missing and empty files can't be mapped
+        return cv::Mat();
+    }
+
+    // buffer of cv::imdecode is the single row of int columns
+    if(file.size() > INT_MAX)
+        return cv::imread(path, flags);
+
+    // header refers to the mapped pages and is read only by the decoder
+    const cv::Mat buffer(
+        1, static_cast<int>(file.size()), CV_8UC1,
+        const_cast<char*>(file.data()));
+    return cv::imdecode(buffer, flags);
+}
+
+} // namespace sp
\ No newline at end of file
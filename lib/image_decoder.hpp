@@ -0,0 +1,25 @@
+///
+/// \file
+/// Defines decoding of the image files mapped to memory.
+///
+
+#pragma once
+#include <string>
+#include "opencv2/imgcodecs.hpp"
+
+namespace sp {
+
+/** @brief Decodes the image file like cv::imread.
+
+cv::imread reads the whole file into the buffer of its own before decoding.
+Instead the file is mapped to memory and the decoder reads the mapped pages
+directly, so the encoded image isn't copied and its pages are read ahead by
+the system. Function may be called from several threads concurrently.
+@param path Image file.
+@param flags Flags of cv::imdecode, e.g. cv::IMREAD_COLOR.
+@return Decoded image or empty matrix if the file is missing or malformed.
+*/
+cv::Mat decode_image(
+    const std::string& path, int flags = cv::IMREAD_COLOR);
+
+} // namespace sp
\ No newline at end of file
@@ -0,0 +1,122 @@
+#include "integral_file.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace sp {
+namespace {
+
+constexpr char magic[8] = "SPINTGR";
+
+[[noreturn]] void malformed_file(
+    const std::string& path, const std::string& reason) {
+    std::stringstream error;
+    error << "Malformed integral file: " << path << ", " << reason << ";";
+    throw std::runtime_error(error.str());
+}
+
+//! @brief Returns size of all the integral images in bytes.
+std::size_t data_size(const integral_file::header& header) {
+    return static_cast<std::size_t>(header.rows) * header.cols
+        * header.channels * CV_ELEM_SIZE1(header.result_depth);
+}
+
+} // namespace
+
+integral_file::header integral_file::make_header(
+    const cv::Size& size, int channels, int depth, int result_depth) {
+    if(result_depth != CV_32S && result_depth != CV_64F) {
+        std::stringstream error;
+        error << "Unsupported result depth: " << result_depth << ";";
+        throw std::invalid_argument(error.str());
+    }
+
+    header head = {};
+    std::memcpy(head.magic, magic, sizeof(magic));
+    head.version = version;
+    head.depth = depth;
+    head.rows = size.height;
+    head.cols = size.width;
+    head.channels = channels;
+    head.result_depth = result_depth;
+    return head;
+}
+
+integral_file::integral_file(
+    const std::string& path, const cv::Size& size, int channels, int depth,
+    int result_depth) {
+    const auto head = make_header(size, channels, depth, result_depth);
+
+    // Existing file may be the hard link of the cached output, so it is
+    // replaced instead of being truncated. Mapping creates missing file
+    // accessible to the owner only, so it is created by the stream with the
+    // default permissions at first.
+    std::remove(path.c_str());
+    std::ofstream(path, std::ios::binary | std::ios::trunc);
+
+    boost::iostreams::mapped_file_params params(path);
+    params.flags = boost::iostreams::mapped_file::readwrite;
+    params.new_file_size = sizeof(header) + data_size(head);
+    file.open(params);
+    std::memcpy(file.data(), &head, sizeof(head));
+}
+
+integral_file::integral_file(const std::string& path) {
+    file.open(path, boost::iostreams::mapped_file::readonly);
+    validate(path);
+}
+
+const integral_file::header& integral_file::get_header() const noexcept {
+    return *reinterpret_cast<const header*>(file.const_data());
+}
+
+cv::Mat integral_file::get_channel(int channel) const {
+    const auto& head = get_header();
+    if(channel < 0 || channel >= head.channels) {
+        std::stringstream error;
+        error << "Channel is out of range: " << channel << ";";
+        throw std::out_of_range(error.str());
+    }
+
+    const auto channel_size = data_size(head) / head.channels;
+    const auto data = file.const_data() + sizeof(header)
+        + channel_size * static_cast<std::size_t>(channel);
+    // cv::Mat has no constant header, so modification is prevented by the
+    // read-only mapping
+    return cv::Mat(
+        head.rows, head.cols, CV_MAKETYPE(head.result_depth, 1),
+        const_cast<char*>(data));
+}
+
+std::vector<cv::Mat> integral_file::get_channels() const {
+    std::vector<cv::Mat> channels;
+    for(auto i = 0; i < get_header().channels; ++i)
+        channels.push_back(get_channel(i));
+    return channels;
+}
+
+void integral_file::close() {
+    file.close();
+}
+
+void integral_file::validate(const std::string& path) const {
+    if(file.size() < sizeof(header))
+        malformed_file(path, "header is truncated");
+
+    const auto& head = get_header();
+    if(std::memcmp(head.magic, magic, sizeof(magic)) != 0)
+        malformed_file(path, "magic mismatch");
+    if(head.version != version)
+        malformed_file(path, "unsupported version");
+    if(head.result_depth != CV_32S && head.result_depth != CV_64F)
+        malformed_file(path, "unsupported result depth");
+    if(head.rows < 0 || head.cols < 0 || head.channels <= 0)
+        malformed_file(path, "invalid size");
+    if(file.size() != sizeof(header) + data_size(head))
+        malformed_file(path, "data size mismatch");
+}
+
+} // namespace sp
\ No newline at end of file
@@ -0,0 +1,124 @@
+///
+/// \file
+/// Defines the sp::integral_file class, which maps binary .integral files.
+///
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "boost/iostreams/device/mapped_file.hpp"
+#include "opencv2/core.hpp"
+
+namespace sp {
+
+/** @brief Memory mapped binary .integral file.
+
+File starts with the fixed size header followed by integral images of all the
+channels, stored one after another (planar) row by row without padding.
+Values are stored in the byte order of the host. Integral images are
+accessed as cv::Mat headers over the mapped pages, so results may be computed
+directly into the file and queried by the consumer without parsing.
+
+The .box outputs of the box filter reuse the format: the mean and the variance
+of each source channel follow each other, so `channels` is twice the number
+of the image channels and `result_depth` is CV_64F, while `depth` is still the
+one of the image. Such channels aren't integral images and mustn't be viewed
+by sp::integral_view.
+
+Usage example:
+@code
+    integral_file output("Lena.integral", image.size(), image.channels(),
+        image.depth(), CV_64F);
+    auto results = output.get_channels(); // compute into results
+    output.close();
+
+    const integral_file input("Lena.integral");
+    const auto sum = input.get_channel(0).at<double>(255, 255);
+@endcode
+*/
+class integral_file {
+public:
+    //! @brief Header of the file.
+    struct header {
+        //! @brief Identifies the file format, "SPINTGR" followed by zero.
+        char magic[8];
+        //! @brief Version of the file format.
+        std::uint32_t version;
+        //! @brief Depth of the source image, e.g. CV_8U.
+        std::int32_t depth;
+        std::int32_t rows;
+        std::int32_t cols;
+        std::int32_t channels;
+        //! @brief Depth of the integral images, CV_32S or CV_64F.
+        std::int32_t result_depth;
+        //! @brief Aligns data to the cache line.
+        char reserved[32];
+    };
+
+    //! @brief Current version of the file format.
+    static constexpr std::uint32_t version = 1;
+
+public:
+    /** @brief Returns header of the file of the image.
+
+    Intended for the files written sequentially instead of being mapped.
+    @param size Size of the source image.
+    @param channels Number of the source image channels.
+    @param depth Depth of the source image.
+    @param result_depth Depth of the integral images, CV_32S or CV_64F.
+    @throw std::invalid_argument In case of the unsupported result depth.
+    */
+    static header make_header(
+        const cv::Size& size, int channels, int depth, int result_depth);
+
+    /** @brief Creates file of the integral images and maps it for writing.
+
+    Existing file is replaced by the new one.
+    @param path Output file.
+    @param size Size of the source image.
+    @param channels Number of the source image channels.
+    @param depth Depth of the source image.
+    @param result_depth Depth of the integral images, CV_32S or CV_64F.
+    */
+    integral_file(
+        const std::string& path, const cv::Size& size, int channels,
+        int depth, int result_depth);
+
+    /** @brief Maps existing file for reading.
+
+    @param path Input file.
+    @throw std::runtime_error In case of the malformed file.
+    */
+    explicit integral_file(const std::string& path);
+
+    //! @brief Retruns header of the file.
+    const header& get_header() const noexcept;
+
+    /** @brief Retruns integral image of the channel.
+
+    Matrix refers to the mapped memory, so it is valid until the file is
+    closed. Matrices of the file mapped for reading must not be modified.
+    */
+    cv::Mat get_channel(int channel) const;
+
+    //! @brief Retruns integral images of all the channels.
+    std::vector<cv::Mat> get_channels() const;
+
+    //! @brief Unmaps the file, so modified pages are written by the system.
+    void close();
+
+private:
+    //! @brief Checks that the header describes the mapped file.
+    void validate(const std::string& path) const;
+
+private:
+    boost::iostreams::mapped_file file;
+};
+
+static_assert(
+    sizeof(integral_file::header) == 64,
+    "header of the binary .integral file must be 64 bytes");
+
+} // namespace sp
\ No newline at end of file
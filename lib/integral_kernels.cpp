@@ -0,0 +1,985 @@
+#include "integral_kernels.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SP_X86 1
+#define SP_TARGET(name) __attribute__((target(name)))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && defined(_M_X64)
+#define SP_X86 1
+#define SP_TARGET(name)
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+namespace sp {
+namespace kernel {
+namespace {
+
+template<typename T, typename A>
+using row_fn_t = void (*)(const T*, int, int, const A*, A*);
+
+//! @brief Tail of the row, which doesn't fill the whole vector register.
+template<typename T, typename A>
+void integrate_tail(
+    const T* src, int begin, int cols, int channels, const A* above, A* dst,
+    A row_sum) {
+    for(auto j = begin; j < cols; ++j) {
+        row_sum += src[j * channels];
+        dst[j] = above ? row_sum + above[j] : row_sum;
+    }
+}
+
+template<typename T, typename A>
+void integrate_scalar(
+    const T* src, int cols, int channels, const A* above, A* dst) {
+    integrate_tail(src, 0, cols, channels, above, dst, A{});
+}
+
+//! @brief Computes sum and its rounding error exactly.
+void two_sum(double a, double b, double& sum, double& error) {
+    sum = a + b;
+    const auto b_part = sum - a;
+    error = (a - (sum - b_part)) + (b - b_part);
+}
+
+/** @brief Computes compensated prefix of the row.
+
+Prefix is written to the output and its rounding error is added to the
+errors of the previous row, which are replaced for the top row. Each step
+depends on the previous one, so the prefix is scalar.
+*/
+template<typename T>
+void prefix_compensated(
+    const T* src, int cols, int channels, bool top, double* error,
+    double* dst) {
+    double row_sum = 0;
+    double row_error = 0;
+    for(auto j = 0; j < cols; ++j) {
+        double rounding;
+        two_sum(row_sum, src[j * channels], row_sum, rounding);
+        row_error += rounding;
+        dst[j] = row_sum;
+        error[j] = top ? row_error : error[j] + row_error;
+    }
+}
+
+using columns_fn_t = void (*)(const double*, int, double*, double*);
+
+//! @brief Adds the previous row to the prefix and rounds the errors back,
+//! each column independently of the others.
+void add_columns_scalar(
+    const double* above, int cols, double* error, double* dst) {
+    for(auto j = 0; j < cols; ++j) {
+        double sum = dst[j];
+        auto sum_error = error[j];
+        if(above) {
+            double rounding;
+            two_sum(above[j], dst[j], sum, rounding);
+            sum_error += rounding;
+        }
+        dst[j] = sum + sum_error;
+        error[j] = sum_error - (dst[j] - sum);
+    }
+}
+
+template<typename A>
+using rects_fn_t =
+    void (*)(const A*, std::ptrdiff_t, const int*, std::size_t, double*);
+
+template<typename A>
+void sum_rects_scalar(
+    const A* data, std::ptrdiff_t step, const int* rects, std::size_t count,
+    double* dst) {
+    for(std::size_t i = 0; i < count; ++i, rects += 4) {
+        const auto x = rects[0], y = rects[1];
+        const auto width = rects[2], height = rects[3];
+        if(width <= 0 || height <= 0) {
+            dst[i] = 0;
+            continue;
+        }
+
+        const auto right = x + width - 1;
+        const auto bottom = data + (y + height - 1) * step;
+        double sum = bottom[right];
+        if(x > 0)
+            sum -= bottom[x - 1];
+        if(y > 0) {
+            // row above the image isn't formed even as the pointer
+            const auto top = data + (y - 1) * step;
+            sum -= top[right];
+            if(x > 0)
+                sum += top[x - 1];
+        }
+        dst[i] = sum;
+    }
+}
+
+template<typename A>
+using boxes_fn_t = void (*)(const A*, const A*, int, int, double*);
+
+template<typename A>
+void sum_boxes_scalar(
+    const A* top, const A* bottom, int width, int count, double* dst) {
+    for(auto j = 0; j < count; ++j) {
+        auto sum = bottom[j + width] - bottom[j];
+        if(top)
+            sum -= top[j + width] - top[j];
+        dst[j] = static_cast<double>(sum);
+    }
+}
+
+#ifdef SP_X86
+
+// Elements of the integer types are exactly representable in double and so
+// are their sums up to 2^53, hence the order of additions inside the prefix
+// scan doesn't affect the result. Sums of the floating-point elements depend
+// on the order, so they may differ from the scalar ones by rounding.
+
+template<typename T>
+SP_TARGET("sse2")
+__m128d load2(const T* src, int channels) {
+    return _mm_set_pd(src[channels], src[0]);
+}
+
+SP_TARGET("sse2")
+__m128d load2(const double* src, int channels) {
+    if(channels == 1)
+        return _mm_loadu_pd(src);
+    return _mm_set_pd(src[channels], src[0]);
+}
+
+template<typename T>
+SP_TARGET("sse2")
+void integrate_sse2(
+    const T* src, int cols, int channels, const double* above, double* dst) {
+    const auto zero = _mm_setzero_pd();
+    auto carry = zero;
+    auto j = 0;
+    for(; j + 2 <= cols; j += 2) {
+        // [a, b] -> [a, a + b]
+        auto x = load2(src + j * channels, channels);
+        x = _mm_add_pd(x, _mm_unpacklo_pd(zero, x));
+        x = _mm_add_pd(x, carry);
+        carry = _mm_unpackhi_pd(x, x);
+        if(above)
+            x = _mm_add_pd(x, _mm_loadu_pd(above + j));
+        _mm_storeu_pd(dst + j, x);
+    }
+    integrate_tail(src, j, cols, channels, above, dst, _mm_cvtsd_f64(carry));
+}
+
+SP_TARGET("avx2")
+__m256d load4(const std::uint8_t* src) {
+    std::int32_t packed;
+    std::memcpy(&packed, src, sizeof(packed));
+    return _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed)));
+}
+
+SP_TARGET("avx2")
+__m256d load4(const std::int8_t* src) {
+    std::int32_t packed;
+    std::memcpy(&packed, src, sizeof(packed));
+    return _mm256_cvtepi32_pd(_mm_cvtepi8_epi32(_mm_cvtsi32_si128(packed)));
+}
+
+SP_TARGET("avx2")
+__m256d load4(const std::uint16_t* src) {
+    const auto packed = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src));
+    return _mm256_cvtepi32_pd(_mm_cvtepu16_epi32(packed));
+}
+
+SP_TARGET("avx2")
+__m256d load4(const std::int16_t* src) {
+    const auto packed = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src));
+    return _mm256_cvtepi32_pd(_mm_cvtepi16_epi32(packed));
+}
+
+SP_TARGET("avx2")
+__m256d load4(const std::int32_t* src) {
+    const auto packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    return _mm256_cvtepi32_pd(packed);
+}
+
+SP_TARGET("avx2")
+__m256d load4(const float* src) {
+    return _mm256_cvtps_pd(_mm_loadu_ps(src));
+}
+
+SP_TARGET("avx2")
+__m256d load4(const double* src) {
+    return _mm256_loadu_pd(src);
+}
+
+template<typename T>
+SP_TARGET("avx2")
+__m256d load4(const T* src, int channels) {
+    if(channels == 1)
+        return load4(src);
+    return _mm256_set_pd(
+        src[3 * channels], src[2 * channels], src[channels], src[0]);
+}
+
+template<typename T>
+SP_TARGET("avx2")
+void integrate_avx2(
+    const T* src, int cols, int channels, const double* above, double* dst) {
+    const auto zero = _mm256_setzero_pd();
+    auto carry = zero;
+    auto j = 0;
+    for(; j + 4 <= cols; j += 4) {
+        // [a, b, c, d] -> [a, a + b, b + c, c + d] -> [a, .., a + b + c + d]
+        auto x = load4(src + j * channels, channels);
+        auto shifted = _mm256_permute4x64_pd(x, _MM_SHUFFLE(2, 1, 0, 0));
+        x = _mm256_add_pd(x, _mm256_blend_pd(shifted, zero, 0x1));
+        shifted = _mm256_permute4x64_pd(x, _MM_SHUFFLE(1, 0, 0, 0));
+        x = _mm256_add_pd(x, _mm256_blend_pd(shifted, zero, 0x3));
+        x = _mm256_add_pd(x, carry);
+        carry = _mm256_permute4x64_pd(x, _MM_SHUFFLE(3, 3, 3, 3));
+        if(above)
+            x = _mm256_add_pd(x, _mm256_loadu_pd(above + j));
+        _mm256_storeu_pd(dst + j, x);
+    }
+    integrate_tail(
+        src, j, cols, channels, above, dst,
+        _mm_cvtsd_f64(_mm256_castpd256_pd128(carry)));
+}
+
+// Masked forms with the explicit source are used instead of the plain ones,
+// which are implemented in GCC through self-initialized undefined registers and
+// trigger false -Wuninitialized warnings.
+
+SP_TARGET("avx512f")
+__m512d widen8(__m256i packed) {
+    return _mm512_mask_cvtepi32_pd(_mm512_setzero_pd(), 0xff, packed);
+}
+
+SP_TARGET("avx512f")
+__m512d load8(const std::uint8_t* src) {
+    const auto packed = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src));
+    return widen8(_mm256_cvtepu8_epi32(packed));
+}
+
+SP_TARGET("avx512f")
+__m512d load8(const std::int8_t* src) {
+    const auto packed = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src));
+    return widen8(_mm256_cvtepi8_epi32(packed));
+}
+
+SP_TARGET("avx512f")
+__m512d load8(const std::uint16_t* src) {
+    const auto packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    return widen8(_mm256_cvtepu16_epi32(packed));
+}
+
+SP_TARGET("avx512f")
+__m512d load8(const std::int16_t* src) {
+    const auto packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    return widen8(_mm256_cvtepi16_epi32(packed));
+}
+
+SP_TARGET("avx512f")
+__m512d load8(const std::int32_t* src) {
+    return widen8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src)));
+}
+
+SP_TARGET("avx512f")
+__m512d load8(const float* src) {
+    const auto packed = _mm256_loadu_ps(src);
+    return _mm512_mask_cvtps_pd(_mm512_setzero_pd(), 0xff, packed);
+}
+
+SP_TARGET("avx512f")
+__m512d load8(const double* src) {
+    return _mm512_loadu_pd(src);
+}
+
+template<typename T>
+SP_TARGET("avx512f")
+__m512d load8(const T* src, int channels) {
+    if(channels == 1)
+        return load8(src);
+    return _mm512_setr_pd(
+        src[0], src[channels], src[2 * channels], src[3 * channels],
+        src[4 * channels], src[5 * channels], src[6 * channels],
+        src[7 * channels]);
+}
+
+template<typename T>
+SP_TARGET("avx512f")
+void integrate_avx512(
+    const T* src, int cols, int channels, const double* above, double* dst) {
+    // lanes shifted by 1, 2 and 4 positions; vacant lanes are zeroed by mask
+    const auto by1 = _mm512_setr_epi64(0, 0, 1, 2, 3, 4, 5, 6);
+    const auto by2 = _mm512_setr_epi64(0, 0, 0, 1, 2, 3, 4, 5);
+    const auto by4 = _mm512_setr_epi64(0, 0, 0, 0, 0, 1, 2, 3);
+    const auto last = _mm512_set1_epi64(7);
+    auto carry = _mm512_setzero_pd();
+    auto j = 0;
+    for(; j + 8 <= cols; j += 8) {
+        auto x = load8(src + j * channels, channels);
+        x = _mm512_add_pd(x, _mm512_maskz_permutexvar_pd(0xfe, by1, x));
+        x = _mm512_add_pd(x, _mm512_maskz_permutexvar_pd(0xfc, by2, x));
+        x = _mm512_add_pd(x, _mm512_maskz_permutexvar_pd(0xf0, by4, x));
+        x = _mm512_add_pd(x, carry);
+        carry = _mm512_maskz_permutexvar_pd(0xff, last, x);
+        if(above)
+            x = _mm512_add_pd(x, _mm512_loadu_pd(above + j));
+        _mm512_storeu_pd(dst + j, x);
+    }
+    alignas(64) double lanes[8];
+    _mm512_store_pd(lanes, carry);
+    integrate_tail(src, j, cols, channels, above, dst, lanes[0]);
+}
+
+// Integer accumulator is chosen only if sums can't overflow it, so the order
+// of additions doesn't matter as well.
+
+SP_TARGET("sse2")
+__m128i load4i(const std::uint8_t* src) {
+    std::int32_t packed;
+    std::memcpy(&packed, src, sizeof(packed));
+    const auto zero = _mm_setzero_si128();
+    const auto x = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero);
+    return _mm_unpacklo_epi16(x, zero);
+}
+
+SP_TARGET("sse2")
+__m128i load4i(const std::int8_t* src) {
+    std::int32_t packed;
+    std::memcpy(&packed, src, sizeof(packed));
+    auto x = _mm_cvtsi32_si128(packed);
+    x = _mm_unpacklo_epi8(x, x);
+    return _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 24);
+}
+
+SP_TARGET("sse2")
+__m128i load4i(const std::uint16_t* src) {
+    const auto x = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src));
+    return _mm_unpacklo_epi16(x, _mm_setzero_si128());
+}
+
+SP_TARGET("sse2")
+__m128i load4i(const std::int16_t* src) {
+    const auto x = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src));
+    return _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+}
+
+SP_TARGET("sse2")
+__m128i load4i(const std::int32_t* src) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+}
+
+template<typename T>
+SP_TARGET("sse2")
+__m128i load4i(const T* src, int channels) {
+    if(channels == 1)
+        return load4i(src);
+    return _mm_setr_epi32(
+        src[0], src[channels], src[2 * channels], src[3 * channels]);
+}
+
+template<typename T>
+SP_TARGET("sse2")
+void integrate_sse2(
+    const T* src, int cols, int channels, const std::int32_t* above,
+    std::int32_t* dst) {
+    auto carry = _mm_setzero_si128();
+    auto j = 0;
+    for(; j + 4 <= cols; j += 4) {
+        auto x = load4i(src + j * channels, channels);
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+        x = _mm_add_epi32(x, carry);
+        carry = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+        if(above) {
+            const auto row = reinterpret_cast<const __m128i*>(above + j);
+            x = _mm_add_epi32(x, _mm_loadu_si128(row));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + j), x);
+    }
+    integrate_tail(
+        src, j, cols, channels, above, dst, _mm_cvtsi128_si32(carry));
+}
+
+SP_TARGET("avx2")
+__m256i load8i(const std::uint8_t* src) {
+    const auto x = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src));
+    return _mm256_cvtepu8_epi32(x);
+}
+
+SP_TARGET("avx2")
+__m256i load8i(const std::int8_t* src) {
+    const auto x = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src));
+    return _mm256_cvtepi8_epi32(x);
+}
+
+SP_TARGET("avx2")
+__m256i load8i(const std::uint16_t* src) {
+    const auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    return _mm256_cvtepu16_epi32(x);
+}
+
+SP_TARGET("avx2")
+__m256i load8i(const std::int16_t* src) {
+    const auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    return _mm256_cvtepi16_epi32(x);
+}
+
+SP_TARGET("avx2")
+__m256i load8i(const std::int32_t* src) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+}
+
+template<typename T>
+SP_TARGET("avx2")
+__m256i load8i(const T* src, int channels) {
+    if(channels == 1)
+        return load8i(src);
+    return _mm256_setr_epi32(
+        src[0], src[channels], src[2 * channels], src[3 * channels],
+        src[4 * channels], src[5 * channels], src[6 * channels],
+        src[7 * channels]);
+}
+
+template<typename T>
+SP_TARGET("avx2")
+void integrate_avx2(
+    const T* src, int cols, int channels, const std::int32_t* above,
+    std::int32_t* dst) {
+    const auto last = _mm256_set1_epi32(7);
+    auto carry = _mm256_setzero_si256();
+    auto j = 0;
+    for(; j + 8 <= cols; j += 8) {
+        // scan inside 128-bit lanes, then add total of the low lane to the
+        // high one
+        auto x = load8i(src + j * channels, channels);
+        x = _mm256_add_epi32(x, _mm256_slli_si256(x, 4));
+        x = _mm256_add_epi32(x, _mm256_slli_si256(x, 8));
+        const auto low = _mm256_permute2x128_si256(x, x, 0x08);
+        x = _mm256_add_epi32(x, _mm256_shuffle_epi32(low, 0xff));
+        x = _mm256_add_epi32(x, carry);
+        carry = _mm256_permutevar8x32_epi32(x, last);
+        if(above) {
+            const auto row = reinterpret_cast<const __m256i*>(above + j);
+            x = _mm256_add_epi32(x, _mm256_loadu_si256(row));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + j), x);
+    }
+    integrate_tail(
+        src, j, cols, channels, above, dst,
+        _mm_cvtsi128_si32(_mm256_castsi256_si128(carry)));
+}
+
+// Rectangles are transposed to the vectors of coordinates, so corners of four
+// rectangles are loaded by the single gather. Corners outside of the image
+// are masked out and read as zero, so the sums are the same as scalar ones.
+
+SP_TARGET("avx2")
+void transpose4(
+    const int* rects, __m128i& x, __m128i& y, __m128i& width,
+    __m128i& height) {
+    const auto src = reinterpret_cast<const __m128i*>(rects);
+    const auto r0 = _mm_loadu_si128(src);
+    const auto r1 = _mm_loadu_si128(src + 1);
+    const auto r2 = _mm_loadu_si128(src + 2);
+    const auto r3 = _mm_loadu_si128(src + 3);
+    const auto xy01 = _mm_unpacklo_epi32(r0, r1);
+    const auto xy23 = _mm_unpacklo_epi32(r2, r3);
+    const auto wh01 = _mm_unpackhi_epi32(r0, r1);
+    const auto wh23 = _mm_unpackhi_epi32(r2, r3);
+    x = _mm_unpacklo_epi64(xy01, xy23);
+    y = _mm_unpackhi_epi64(xy01, xy23);
+    width = _mm_unpacklo_epi64(wh01, wh23);
+    height = _mm_unpackhi_epi64(wh01, wh23);
+}
+
+SP_TARGET("avx2")
+__m256i offsets(__m128i row, __m128i col, __m256i step) {
+    const auto rows = _mm256_mul_epi32(_mm256_cvtepi32_epi64(row), step);
+    return _mm256_add_epi64(rows, _mm256_cvtepi32_epi64(col));
+}
+
+SP_TARGET("avx2")
+__m256d gather(const double* data, __m256i index, __m128i mask) {
+    const auto lanes = _mm256_castsi256_pd(_mm256_cvtepi32_epi64(mask));
+    return _mm256_mask_i64gather_pd(
+        _mm256_setzero_pd(), data, index, lanes, sizeof(double));
+}
+
+SP_TARGET("avx2")
+__m256d gather(const std::int32_t* data, __m256i index, __m128i mask) {
+    return _mm256_cvtepi32_pd(_mm256_mask_i64gather_epi32(
+        _mm_setzero_si128(), reinterpret_cast<const int*>(data), index, mask,
+        sizeof(std::int32_t)));
+}
+
+template<typename A>
+SP_TARGET("avx2")
+void sum_rects_avx2(
+    const A* data, std::ptrdiff_t step, const int* rects, std::size_t count,
+    double* dst) {
+    // row offsets are multiplied as 32-bit values
+    if(step > INT_MAX)
+        return sum_rects_scalar(data, step, rects, count, dst);
+
+    const auto one = _mm_set1_epi32(1);
+    const auto zero = _mm_setzero_si128();
+    const auto row_step = _mm256_set1_epi64x(step);
+    std::size_t i = 0;
+    for(; i + 4 <= count; i += 4, rects += 16) {
+        __m128i x, y, width, height;
+        transpose4(rects, x, y, width, height);
+        const auto left = _mm_sub_epi32(x, one);
+        const auto top = _mm_sub_epi32(y, one);
+        const auto right = _mm_add_epi32(left, width);
+        const auto bottom = _mm_add_epi32(top, height);
+
+        const auto filled = _mm_and_si128(
+            _mm_cmpgt_epi32(width, zero), _mm_cmpgt_epi32(height, zero));
+        const auto has_left = _mm_and_si128(filled, _mm_cmpgt_epi32(x, zero));
+        const auto has_top = _mm_and_si128(filled, _mm_cmpgt_epi32(y, zero));
+        const auto a = gather(
+            data, offsets(top, left, row_step),
+            _mm_and_si128(has_left, has_top));
+        const auto b = gather(data, offsets(top, right, row_step), has_top);
+        const auto c = gather(data, offsets(bottom, left, row_step), has_left);
+        const auto d = gather(data, offsets(bottom, right, row_step), filled);
+        const auto sum = _mm256_sub_pd(_mm256_sub_pd(d, c), b);
+        _mm256_storeu_pd(dst + i, _mm256_add_pd(sum, a));
+    }
+
+    sum_rects_scalar(data, step, rects, count - i, dst + i);
+}
+
+SP_TARGET("avx2")
+__m256d box_sums(const double* top, const double* bottom, int width) {
+    const auto sum = _mm256_sub_pd(
+        _mm256_loadu_pd(bottom + width), _mm256_loadu_pd(bottom));
+    if(!top)
+        return sum;
+    return _mm256_sub_pd(
+        sum,
+        _mm256_sub_pd(_mm256_loadu_pd(top + width), _mm256_loadu_pd(top)));
+}
+
+SP_TARGET("avx2")
+__m256d box_sums(
+    const std::int32_t* top, const std::int32_t* bottom, int width) {
+    // box sums fit the accumulator as well as the sums of the whole image
+    auto load = [](const std::int32_t* src) {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    };
+    auto sum = _mm_sub_epi32(load(bottom + width), load(bottom));
+    if(top)
+        sum = _mm_sub_epi32(sum, _mm_sub_epi32(load(top + width), load(top)));
+    return _mm256_cvtepi32_pd(sum);
+}
+
+template<typename A>
+SP_TARGET("avx2")
+void sum_boxes_avx2(
+    const A* top, const A* bottom, int width, int count, double* dst) {
+    auto j = 0;
+    for(; j + 4 <= count; j += 4)
+        _mm256_storeu_pd(
+            dst + j, box_sums(top ? top + j : nullptr, bottom + j, width));
+    sum_boxes_scalar(
+        top ? top + j : nullptr, bottom + j, width, count - j, dst + j);
+}
+
+//! @brief Returns index of the source byte of the shuffled lane, which
+//! gathers bytes of each channel of 4 pixels together.
+constexpr char gather_index(int channels, int lane) {
+    return lane / 4 < channels
+        ? static_cast<char>(lane % 4 * channels + lane / 4)
+        : static_cast<char>(-1);
+}
+
+SP_TARGET("avx2")
+__m128i widen4(__m128i bytes, std::uint8_t) {
+    return _mm_cvtepu8_epi32(bytes);
+}
+
+SP_TARGET("avx2")
+__m128i widen4(__m128i bytes, std::int8_t) {
+    return _mm_cvtepi8_epi32(bytes);
+}
+
+SP_TARGET("avx2")
+void store4(__m128i values, double* dst) {
+    _mm256_storeu_pd(dst, _mm256_cvtepi32_pd(values));
+}
+
+SP_TARGET("avx2")
+void store4(__m128i values, std::int32_t* dst) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), values);
+}
+
+/** @brief De-interleaves 8-bit channels of the row by byte shuffles.
+
+Compilers don't vectorize the strided loads of the plain loop, e.g. GCC before
+12 at -O2, so bytes of 4 pixels are gathered by channels with one shuffle.
+@return Number of the de-interleaved pixels, the rest is left to the caller.
+*/
+template<int C, typename T, typename A>
+SP_TARGET("avx2")
+int deinterleave_avx2(const T* src, int cols, A* const* dst) {
+    const auto gather = _mm_setr_epi8(
+        gather_index(C, 0), gather_index(C, 1), gather_index(C, 2),
+        gather_index(C, 3), gather_index(C, 4), gather_index(C, 5),
+        gather_index(C, 6), gather_index(C, 7), gather_index(C, 8),
+        gather_index(C, 9), gather_index(C, 10), gather_index(C, 11),
+        gather_index(C, 12), gather_index(C, 13), gather_index(C, 14),
+        gather_index(C, 15));
+    auto j = 0;
+    // whole 16 bytes are loaded, which may be beyond the 4 pixels
+    for(; j * C + 16 <= cols * C; j += 4) {
+        const auto x = _mm_shuffle_epi8(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + j * C)),
+            gather);
+        store4(widen4(x, T()), dst[0] + j);
+        store4(widen4(_mm_srli_si128(x, 4), T()), dst[1] + j);
+        if(C > 2)
+            store4(widen4(_mm_srli_si128(x, 8), T()), dst[2] + j);
+        if(C > 3)
+            store4(widen4(_mm_srli_si128(x, 12), T()), dst[3] + j);
+    }
+    return j;
+}
+
+SP_TARGET("avx2")
+void add_columns_avx2(
+    const double* above, int cols, double* error, double* dst) {
+    auto j = 0;
+    for(; j + 4 <= cols; j += 4) {
+        auto sum = _mm256_loadu_pd(dst + j);
+        auto sum_error = _mm256_loadu_pd(error + j);
+        if(above) {
+            // two_sum() of the lanes
+            const auto a = _mm256_loadu_pd(above + j);
+            const auto b = sum;
+            sum = _mm256_add_pd(a, b);
+            const auto b_part = _mm256_sub_pd(sum, a);
+            const auto rounding = _mm256_add_pd(
+                _mm256_sub_pd(a, _mm256_sub_pd(sum, b_part)),
+                _mm256_sub_pd(b, b_part));
+            sum_error = _mm256_add_pd(sum_error, rounding);
+        }
+        const auto rounded = _mm256_add_pd(sum, sum_error);
+        _mm256_storeu_pd(dst + j, rounded);
+        _mm256_storeu_pd(
+            error + j,
+            _mm256_sub_pd(sum_error, _mm256_sub_pd(rounded, sum)));
+    }
+    add_columns_scalar(
+        above ? above + j : nullptr, cols - j, error + j, dst + j);
+}
+
+#endif // SP_X86
+
+//! @brief De-interleaves head of the row by the vector instructions, returns
+//! number of the de-interleaved pixels.
+template<int C, typename T, typename A>
+int deinterleave_head(const T*, int, A* const*, isa) noexcept {
+    return 0;
+}
+
+template<int C, typename A>
+int deinterleave_head(
+    const std::uint8_t* src, int cols, A* const* dst, isa level) {
+#ifdef SP_X86
+    if(level >= isa::avx2)
+        return deinterleave_avx2<C>(src, cols, dst);
+#endif
+    return 0;
+}
+
+template<int C, typename A>
+int deinterleave_head(
+    const std::int8_t* src, int cols, A* const* dst, isa level) {
+#ifdef SP_X86
+    if(level >= isa::avx2)
+        return deinterleave_avx2<C>(src, cols, dst);
+#endif
+    return 0;
+}
+
+//! @brief De-interleaves and widens channels of the row to planar rows.
+template<int C, typename T, typename A>
+void deinterleave(const T* src, int cols, A* const* dst, isa level) {
+    for(auto j = deinterleave_head<C>(src, cols, dst, level); j < cols; ++j)
+        for(auto c = 0; c < C; ++c)
+            dst[c][j] = src[j * C + c];
+}
+
+template<typename T, typename A>
+void deinterleave(
+    const T* src, int cols, int channels, A* const* dst, isa level) {
+    switch(channels) {
+    case 2:
+        return deinterleave<2>(src, cols, dst, level);
+    case 3:
+        return deinterleave<3>(src, cols, dst, level);
+    case 4:
+        return deinterleave<4>(src, cols, dst, level);
+    default:
+        for(auto j = 0; j < cols; ++j)
+            for(auto c = 0; c < channels; ++c)
+                dst[c][j] = src[j * channels + c];
+    }
+}
+
+isa detect_isa() noexcept {
+#if defined(SP_X86) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f"))
+        return isa::avx512;
+    if(__builtin_cpu_supports("avx2"))
+        return isa::avx2;
+    if(__builtin_cpu_supports("sse2"))
+        return isa::sse2;
+#elif defined(SP_X86)
+    int info[4];
+    __cpuid(info, 0);
+    const auto max_leaf = info[0];
+    __cpuid(info, 1);
+    const auto osxsave = (info[2] & (1 << 27)) != 0;
+    const auto xcr0 = osxsave ? _xgetbv(0) : 0;
+    if(max_leaf >= 7 && (xcr0 & 0x6) == 0x6) {
+        __cpuidex(info, 7, 0);
+        if((info[1] & (1 << 16)) && (xcr0 & 0xe6) == 0xe6)
+            return isa::avx512;
+        if(info[1] & (1 << 5))
+            return isa::avx2;
+    }
+    return isa::sse2;
+#endif
+    return isa::scalar;
+}
+
+std::atomic<isa>& selected() noexcept {
+    static std::atomic<isa> level{detect()};
+    return level;
+}
+
+template<typename T>
+row_fn_t<T, double> row_kernel(isa level, double*) noexcept {
+    switch(level) {
+#ifdef SP_X86
+    case isa::avx512:
+        return integrate_avx512<T>;
+    case isa::avx2:
+        return integrate_avx2<T>;
+    case isa::sse2:
+        return integrate_sse2<T>;
+#endif
+    default:
+        return integrate_scalar<T, double>;
+    }
+}
+
+template<typename T>
+row_fn_t<T, std::int32_t> row_kernel(isa level, std::int32_t*) noexcept {
+    // integer scan of the 8 lanes is already limited by the memory bandwidth,
+    // so there is no separated AVX-512 variant
+    switch(level) {
+#ifdef SP_X86
+    case isa::avx512:
+    case isa::avx2:
+        return integrate_avx2<T>;
+    case isa::sse2:
+        return integrate_sse2<T>;
+#endif
+    default:
+        return integrate_scalar<T, std::int32_t>;
+    }
+}
+
+template<typename T, typename A>
+row_fn_t<T, A> row_kernel(isa level) noexcept {
+    return row_kernel<T>(level, static_cast<A*>(nullptr));
+}
+
+template<typename A>
+rects_fn_t<A> rects_kernel(isa level) noexcept {
+#ifdef SP_X86
+    // there are no gather instructions before AVX2
+    if(level >= isa::avx2)
+        return sum_rects_avx2<A>;
+#endif
+    return sum_rects_scalar<A>;
+}
+
+columns_fn_t columns_kernel(isa level) noexcept {
+#ifdef SP_X86
+    if(level >= isa::avx2)
+        return add_columns_avx2;
+#endif
+    return add_columns_scalar;
+}
+
+//! @brief Integrates the row with compensated summation.
+template<typename T>
+void integrate_compensated(
+    const T* src, int cols, int channels, const double* above, double* error,
+    double* dst, isa level) {
+    // Row prefix and the output are kept as pairs of the value and its
+    // rounding error, which is added back at the next step. Only the prefix
+    // is sequential, while the columns are added by the vector kernel.
+    prefix_compensated(src, cols, channels, !above, error, dst);
+    columns_kernel(level)(above, cols, error, dst);
+}
+
+template<typename A>
+boxes_fn_t<A> boxes_kernel(isa level) noexcept {
+#ifdef SP_X86
+    if(level >= isa::avx2)
+        return sum_boxes_avx2<A>;
+#endif
+    return sum_boxes_scalar<A>;
+}
+
+} // namespace
+
+isa detect() noexcept {
+    static const auto level = detect_isa();
+    return level;
+}
+
+isa current() noexcept {
+    return selected();
+}
+
+void select(isa level) noexcept {
+    selected() = std::min(level, detect());
+}
+
+template<typename T, typename A>
+void integrate_row(
+    const T* src, int cols, int channels, const A* above, A* dst) {
+    row_kernel<T, A>(selected().load(std::memory_order_relaxed))(
+        src, cols, channels, above, dst);
+}
+
+template<typename T, typename A>
+void integrate_rows(
+    const T* src, int cols, int channels, const A* const* above,
+    A* const* dst) {
+    const auto level = selected().load(std::memory_order_relaxed);
+    deinterleave(src, cols, channels, dst, level);
+
+    // widened values are integrated in-place
+    const auto kernel = row_kernel<A, A>(level);
+    for(auto c = 0; c < channels; ++c)
+        kernel(dst[c], cols, 1, above ? above[c] : nullptr, dst[c]);
+}
+
+template<typename T>
+void integrate_row_compensated(
+    const T* src, int cols, int channels, const double* above, double* error,
+    double* dst) {
+    integrate_compensated(
+        src, cols, channels, above, error, dst,
+        selected().load(std::memory_order_relaxed));
+}
+
+template<typename T>
+void integrate_rows_compensated(
+    const T* src, int cols, int channels, const double* const* above,
+    double* const* error, double* const* dst) {
+    const auto level = selected().load(std::memory_order_relaxed);
+    deinterleave(src, cols, channels, dst, level);
+    for(auto c = 0; c < channels; ++c)
+        integrate_compensated(
+            dst[c], cols, 1, above ? above[c] : nullptr, error[c], dst[c],
+            level);
+}
+
+template<typename T>
+void integrate_sq_row(
+    const T* src, int cols, int channels, const double* above, double* dst) {
+    for(auto j = 0; j < cols; ++j) {
+        const double value = src[j * channels];
+        dst[j] = value * value;
+    }
+
+    row_kernel<double, double>(selected().load(std::memory_order_relaxed))(
+        dst, cols, 1, above, dst);
+}
+
+#define SP_INSTANTIATE(T)                                                     \
+    template void integrate_sq_row<T>(                                        \
+        const T*, int, int, const double*, double*);
+
+SP_INSTANTIATE(std::uint8_t)
+SP_INSTANTIATE(std::int8_t)
+SP_INSTANTIATE(std::uint16_t)
+SP_INSTANTIATE(std::int16_t)
+SP_INSTANTIATE(std::int32_t)
+SP_INSTANTIATE(float)
+SP_INSTANTIATE(double)
+
+#undef SP_INSTANTIATE
+
+#define SP_INSTANTIATE(T)                                                     \
+    template void integrate_row_compensated<T>(                               \
+        const T*, int, int, const double*, double*, double*);                 \
+    template void integrate_rows_compensated<T>(                              \
+        const T*, int, int, const double* const*, double* const*,             \
+        double* const*);
+
+SP_INSTANTIATE(double)
+
+#undef SP_INSTANTIATE
+
+template<typename A>
+void sum_rects(
+    const A* data, std::ptrdiff_t step, const int* rects, std::size_t count,
+    double* dst) {
+    rects_kernel<A>(selected().load(std::memory_order_relaxed))(
+        data, step, rects, count, dst);
+}
+
+template void sum_rects<double>(
+    const double*, std::ptrdiff_t, const int*, std::size_t, double*);
+template void sum_rects<std::int32_t>(
+    const std::int32_t*, std::ptrdiff_t, const int*, std::size_t, double*);
+
+template<typename A>
+void sum_boxes(
+    const A* top, const A* bottom, int width, int count, double* dst) {
+    boxes_kernel<A>(selected().load(std::memory_order_relaxed))(
+        top, bottom, width, count, dst);
+}
+
+template void sum_boxes<double>(
+    const double*, const double*, int, int, double*);
+template void sum_boxes<std::int32_t>(
+    const std::int32_t*, const std::int32_t*, int, int, double*);
+
+#define SP_INSTANTIATE(T, A)                                                  \
+    template void integrate_row<T, A>(const T*, int, int, const A*, A*);      \
+    template void integrate_rows<T, A>(                                       \
+        const T*, int, int, const A* const*, A* const*);
+
+SP_INSTANTIATE(std::uint8_t, double)
+SP_INSTANTIATE(std::int8_t, double)
+SP_INSTANTIATE(std::uint16_t, double)
+SP_INSTANTIATE(std::int16_t, double)
+SP_INSTANTIATE(std::int32_t, double)
+SP_INSTANTIATE(float, double)
+SP_INSTANTIATE(double, double)
+SP_INSTANTIATE(std::uint8_t, std::int32_t)
+SP_INSTANTIATE(std::int8_t, std::int32_t)
+SP_INSTANTIATE(std::uint16_t, std::int32_t)
+SP_INSTANTIATE(std::int16_t, std::int32_t)
+
+#undef SP_INSTANTIATE
+
+} // namespace kernel
+} // namespace sp
\ No newline at end of file
@@ -0,0 +1,210 @@
+///
+/// \file
+/// Defines the row kernels of integral image computation.
+///
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace sp {
+namespace kernel {
+
+//! @brief Instruction sets, which kernels are implemented for.
+enum class isa { scalar, sse2, avx2, avx512 };
+
+//! @brief Returns the best instruction set supported by the CPU.
+isa detect() noexcept;
+
+//! @brief Returns the instruction set used by kernels.
+isa current() noexcept;
+
+/** @brief Restricts instruction set used by kernels.
+
+Intended for testing and benchmarking purposes. Instruction set unsupported
+by the CPU is replaced by the best supported one.
+@param level Instruction set to use.
+*/
+void select(isa level) noexcept;
+
+/** @brief Computes one row of the integral image.
+
+Widens elements of the channel to the accumulator type, computes their prefix
+sum and adds row above: `dst[j] = sum(src[0:j]) + above[j]`. The whole row is
+the one dependency chain, so the prefix sum is computed inside vector
+registers and vertical accumulation reuses the previous output row instead of
+the separate column sums buffer.
+@param src Pointer to the first element of the channel in the source row.
+@param cols Number of elements in the row.
+@param channels Distance between adjacent elements of the channel.
+@param above Previous row of the integral image or nullptr for the top row.
+@param dst Output row.
+@note Accumulator type A is either double or std::int32_t. Integer
+accumulator doesn't detect overflow, so it must be chosen only if sums of
+the channel fit it, which excludes std::int32_t, float and double elements.
+*/
+template<typename T, typename A>
+void integrate_row(
+    const T* src, int cols, int channels, const A* above, A* dst);
+
+/** @brief Computes one row of the integral image for all the channels.
+
+Reads each interleaved pixel once: channels are de-interleaved and widened
+into planar output rows, then rows are integrated in-place.
+@param src Pointer to the source row.
+@param cols Number of pixels in the row.
+@param channels Number of interleaved channels.
+@param above Previous rows of the integral image for each channel or nullptr
+for the top row.
+@param dst Output rows for each channel.
+*/
+template<typename T, typename A>
+void integrate_rows(
+    const T* src, int cols, int channels, const A* const* above,
+    A* const* dst);
+
+/** @brief Computes one row of the integral image with compensated summation.
+
+Rounding errors of floating-point sums grow with the number of summed
+elements, so each output element is kept together with its rounding error,
+which is added back by the next element of the row and by the element below
+(Kahan-Babuska summation). Result differs from the exact sum by a few
+roundings regardless of the size of the image.
+@param src Pointer to the first element of the channel in the source row.
+@param cols Number of elements in the row.
+@param channels Distance between adjacent elements of the channel.
+@param above Previous row of the integral image or nullptr for the top row.
+@param error Rounding errors of the previous row, overwritten by the errors
+of the output row; its contents are ignored for the top row.
+@param dst Output row.
+*/
+template<typename T>
+void integrate_row_compensated(
+    const T* src, int cols, int channels, const double* above, double* error,
+    double* dst);
+
+/** @brief Computes one row of the integral image for all the channels with
+compensated summation.
+
+@param src Pointer to the source row.
+@param cols Number of pixels in the row.
+@param channels Number of interleaved channels.
+@param above Previous rows of the integral image for each channel or nullptr
+for the top row.
+@param error Rounding errors of the previous rows for each channel,
+overwritten by the errors of the output rows.
+@param dst Output rows for each channel.
+@see integrate_row_compensated
+*/
+template<typename T>
+void integrate_rows_compensated(
+    const T* src, int cols, int channels, const double* const* above,
+    double* const* error, double* const* dst);
+
+/** @brief Computes one row of the squared integral image.
+
+Squares of the elements are written to the output row and integrated
+in-place by the row kernel. They are exact in double for the elements up to
+16 bits and for float ones.
+@param src Pointer to the first element of the channel in the source row.
+@param cols Number of elements in the row.
+@param channels Distance between adjacent elements of the channel.
+@param above Previous row of the squared integral image or nullptr for the
+top row.
+@param dst Output row.
+*/
+template<typename T>
+void integrate_sq_row(
+    const T* src, int cols, int channels, const double* above, double* dst);
+
+/** @brief Computes sums of the rectangles over the integral image.
+
+Each sum is obtained from four corners of the rectangle in the inclusive
+integral image; corners outside of the image are zero. Corners of several
+rectangles are gathered into the vector register at once.
+@param data Pointer to the first element of the integral image.
+@param step Distance between rows of the integral image in elements.
+@param rects Rectangles as x, y, width and height quadruples, lying inside
+the image.
+@param count Number of rectangles.
+@param dst Output sums.
+*/
+template<typename A>
+void sum_rects(
+    const A* data, std::ptrdiff_t step, const int* rects, std::size_t count,
+    double* dst);
+
+extern template void sum_rects<double>(
+    const double*, std::ptrdiff_t, const int*, std::size_t, double*);
+extern template void sum_rects<std::int32_t>(
+    const std::int32_t*, std::ptrdiff_t, const int*, std::size_t, double*);
+
+/** @brief Computes sums of the adjacent boxes of the same rows.
+
+Box j spans the columns (j, j + width] and the rows between the top and the
+bottom rows of the inclusive integral image: `dst[j] = bottom[j + width] -
+bottom[j] - top[j + width] + top[j]`. Sums don't depend on each other, so
+whole vector registers of them are computed without branches.
+@param top Row above the boxes or nullptr for the boxes starting at the top
+row of the image.
+@param bottom Last row of the boxes.
+@param width Width of the boxes.
+@param count Number of the boxes.
+@param dst Output sums.
+*/
+template<typename A>
+void sum_boxes(
+    const A* top, const A* bottom, int width, int count, double* dst);
+
+extern template void sum_boxes<double>(
+    const double*, const double*, int, int, double*);
+extern template void sum_boxes<std::int32_t>(
+    const std::int32_t*, const std::int32_t*, int, int, double*);
+
+#define SP_DECLARE(T, A)                                                      \
+    extern template void integrate_row<T, A>(                                 \
+        const T*, int, int, const A*, A*);                                    \
+    extern template void integrate_rows<T, A>(                                \
+        const T*, int, int, const A* const*, A* const*);
+
+SP_DECLARE(std::uint8_t, double)
+SP_DECLARE(std::int8_t, double)
+SP_DECLARE(std::uint16_t, double)
+SP_DECLARE(std::int16_t, double)
+SP_DECLARE(std::int32_t, double)
+SP_DECLARE(float, double)
+SP_DECLARE(double, double)
+SP_DECLARE(std::uint8_t, std::int32_t)
+SP_DECLARE(std::int8_t, std::int32_t)
+SP_DECLARE(std::uint16_t, std::int32_t)
+SP_DECLARE(std::int16_t, std::int32_t)
+
+#undef SP_DECLARE
+
+#define SP_DECLARE(T)                                                         \
+    extern template void integrate_sq_row<T>(                                 \
+        const T*, int, int, const double*, double*);
+
+SP_DECLARE(std::uint8_t)
+SP_DECLARE(std::int8_t)
+SP_DECLARE(std::uint16_t)
+SP_DECLARE(std::int16_t)
+SP_DECLARE(std::int32_t)
+SP_DECLARE(float)
+SP_DECLARE(double)
+
+#undef SP_DECLARE
+
+#define SP_DECLARE(T)                                                         \
+    extern template void integrate_row_compensated<T>(                        \
+        const T*, int, int, const double*, double*, double*);                 \
+    extern template void integrate_rows_compensated<T>(                       \
+        const T*, int, int, const double* const*, double* const*,             \
+        double* const*);
+
+SP_DECLARE(double)
+
+#undef SP_DECLARE
+
+} // namespace kernel
+} // namespace sp
\ No newline at end of file
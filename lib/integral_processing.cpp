@@ -1,66 +1,585 @@
 #include "integral_processing.hpp"
 
+#include <atomic>
 #include <iostream>
+#include <sstream>
 #include "boost/asio.hpp"
-#include "boost/thread/thread.hpp"
+#include "numa_topology.hpp"
 
 namespace sp {
+namespace {
 
-integral_computation::integral_computation(unsigned int thread_count) {
-    const auto possible_threads = boost::thread::hardware_concurrency();
+//! @brief Band smaller than that isn't worth of the separated task.
+constexpr auto min_band_pixels = 1 << 16;
+
+//! @brief Minimal number of rows in the band.
+constexpr auto min_band_rows = 16;
+
+//! @brief Bands of the large matrix per thread, spare ones are stolen by the
+//! threads, which are done with the other matrices.
+constexpr auto bands_per_thread = 2;
+
+//! @brief Matrices smaller than the band are coalesced to the batch of that
+//! number of pixels, which is computed by the single work item.
+constexpr std::size_t max_batch_pixels = 1 << 18;
+
+//! @brief Larger updates are computed from scratch by bands in parallel.
+constexpr auto max_update_share = 0.5;
+
+} // namespace
+
+struct integral_computation::image_job {
+    image_job(std::size_t channels, priority prio)
+        : tasks(channels)
+        , pending(channels)
+        , prio(prio) {
+    }
+
+    //! @brief Keeps the first failure, returns whether it is the first one.
+    bool fail(std::exception_ptr exception) {
+        if(failed.exchange(true))
+            return false;
+        error = exception;
+        return true;
+    }
+
+    //! @brief Tasks of the matrix, indexed by channel.
+    task_set_t tasks;
+    std::atomic<std::size_t> pending;
+    priority prio;
+    //! @brief Node of the threads computing the matrix.
+    int node = work_scheduler::any_node;
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;
+    //! @brief Handler of the matrix, replacing the common one if set.
+    on_complete_fn_t on_complete;
+    //! @brief Promise of the submitted matrix, replacing any handler.
+    std::unique_ptr<std::promise<task_set_t>> promise;
+};
+
+struct integral_computation::band_job {
+    band_job(
+        std::shared_ptr<image_job> image, task_set_t tasks,
+        std::vector<cv::Range> bands)
+        : image(std::move(image))
+        , tasks(std::move(tasks))
+        , bands(std::move(bands))
+        , pending(this->bands.size()) {
+    }
+
+    //! @brief Returns channel of the job or -1 for all the channels.
+    int channel() const {
+        return tasks.size() > 1 ? -1 : tasks.front()->get_channel();
+    }
+
+    //! @brief Computes band of all the tasks of the job.
+    void execute(const cv::Range& rows) {
+        if(tasks.size() > 1)
+            processing_context::execute(tasks, rows);
+        else
+            tasks.front()->execute(rows);
+    }
+
+    //! @brief Reports the handled failure of the job once per matrix.
+    void fail(const std::exception& exception) {
+        failed = true;
+        if(image->fail(std::current_exception()) && !image->promise)
+            std::cerr << tasks.front()->get_id() << ": " << exception.what();
+    }
+
+    std::shared_ptr<image_job> image;
+    task_set_t tasks;
+    std::vector<cv::Range> bands;
+    std::atomic<std::size_t> pending;
+    std::atomic<bool> failed{false};
+};
+
+struct integral_computation::small_batch {
+    //! @brief Single band jobs of the matrices.
+    std::vector<std::unique_ptr<band_job>> jobs;
+    std::size_t pixels = 0;
+    //! @brief Node of the first matrix of the batch.
+    int node = work_scheduler::any_node;
+};
+
+integral_computation::integral_computation(
+    unsigned int thread_count, unsigned int writer_count, bool pinned) {
+    const auto topology = numa_topology::detect();
+    const auto possible_threads = topology.cpu_count();
     if(thread_count == 0 || thread_count > possible_threads)
         thread_count = possible_threads;
-    workers = std::make_unique<thread_pool_t>(thread_count);
+    this->thread_count = thread_count;
+    workers = std::make_unique<work_scheduler>(
+        thread_count, pinned ? &topology : nullptr);
+    writers = std::make_unique<thread_pool_t>(std::max(writer_count, 1u));
+}
+
+integral_computation::~integral_computation() {
+    shutdown();
+}
+
+bool integral_computation::enqueue_file(
+    const std::string& id, cv::Mat& mat, priority prio) {
+    enqueue_image(std::make_shared<image_job>(mat.channels(), prio), id, mat);
+    return true;
+}
+
+std::future<integral_computation::task_set_t> integral_computation::submit(
+    const std::string& id, const cv::Mat& mat, priority prio) {
+    auto image = std::make_shared<image_job>(mat.channels(), prio);
+    image->promise = std::make_unique<std::promise<task_set_t>>();
+    auto future = image->promise->get_future();
+    enqueue_image(std::move(image), id, mat);
+    return future;
+}
+
+void integral_computation::submit(
+    const std::string& id, const cv::Mat& mat, on_complete_fn_t fn,
+    priority prio) {
+    auto image = std::make_shared<image_job>(mat.channels(), prio);
+    image->on_complete = std::move(fn);
+    enqueue_image(std::move(image), id, mat);
+}
+
+void integral_computation::enqueue_image(
+    std::shared_ptr<image_job> image, const std::string& id,
+    const cv::Mat& mat) {
+    image->node = next_node();
+    auto tasks = create_tasks(id, mat, {}, image->node);
+    enqueue_tasks(std::move(image), std::move(tasks), mat);
 }
 
-bool integral_computation::enqueue_file(const std::string& id, cv::Mat& mat) {
-    for(auto i = 0; i < mat.channels(); ++i) {
-        auto task = std::make_unique<processing_context>(id, mat, i);
-        boost::asio::post(*workers, [this, task = std::move(task)]() mutable {
+bool integral_computation::enqueue_update(
+    const std::string& id, cv::Mat& mat, const std::vector<cv::Mat>& results,
+    const std::vector<cv::Rect>& dirty, priority prio) {
+    if(results.size() != static_cast<std::size_t>(mat.channels())) {
+        std::stringstream error;
+        error << "Unexpected number of results: " << results.size() << ";";
+        throw std::invalid_argument(error.str());
+    }
+
+    const auto node = next_node();
+    auto tasks = create_tasks(id, mat, results, node);
+    auto image = std::make_shared<image_job>(tasks.size(), prio);
+    image->node = node;
+    const auto area = processing_context::update_area(mat.size(), dirty);
+    // squared integral images of the new tasks don't hold the previous sums
+    const auto whole = output::sqsum | output::tilted;
+    if((outputs & whole) || area > mat.total() * max_update_share) {
+        enqueue_tasks(std::move(image), std::move(tasks), mat);
+        return true;
+    }
+
+    for(auto& task : tasks) {
+        const auto channel = task->get_channel();
+        auto work = [this, image, dirty, task = std::move(task)]() mutable {
             try {
-                task->execute();
+                task->update(dirty);
             }
             catch(const std::exception& exception) {
-                std::cerr << task->get_id() << ": " << exception.what();
+                if(image->fail(std::current_exception()) && !image->promise)
+                    std::cerr << task->get_id() << ": " << exception.what();
             }
-            boost::asio::post(io, [this, task = std::move(task)]() mutable {
-                on_complete(std::move(task));
-            });
-        });
+            complete(image, std::move(task));
+        };
+        post_work(id, channel, stage::compute, prio, node, std::move(work));
     }
 
     return true;
 }
 
+int integral_computation::next_node() {
+    const auto count = workers->node_count();
+    if(count == 1)
+        return work_scheduler::any_node;
+    return static_cast<int>(next_image++ % count);
+}
+
+integral_computation::task_set_t integral_computation::create_tasks(
+    const std::string& id, const cv::Mat& mat, std::vector<cv::Mat> results,
+    int node) {
+    if(stopped)
+        throw std::runtime_error("Executor is shut down;");
+
+    const auto depth = results.empty()
+        ? processing_context::result_depth(mat, acc)
+        : results.front().depth();
+    const auto bytes = footprint(mat, depth, outputs);
+    acquire_flight(bytes);
+
+    trace.on_enqueued();
+    task_set_t tasks;
+    try {
+        // pages of the new results are placed by the threads of the node,
+        // which write them first
+        buffer_pool::node_scope scope(node);
+        if(results.empty() && result_allocator_fn)
+            results = result_allocator_fn(id, mat, depth);
+        for(auto i = 0; i < mat.channels(); ++i) {
+            if(results.empty())
+                tasks.emplace_back(std::make_unique<processing_context>(
+                    id, mat, i, acc, outputs, pool));
+            else
+                tasks.emplace_back(std::make_unique<processing_context>(
+                    id, mat, i, results.at(i), outputs, pool));
+        }
+    }
+    catch(...) {
+        release_flight(bytes);
+        throw;
+    }
+
+    return tasks;
+}
+
+void integral_computation::enqueue_tasks(
+    std::shared_ptr<image_job> image, task_set_t tasks, const cv::Mat& mat) {
+    if(mat.total() < static_cast<std::size_t>(min_band_pixels)) {
+        enqueue_small(std::move(image), std::move(tasks), mat);
+        return;
+    }
+
+    // Single pass over all the channels reads the matrix once, so separated
+    // channel tasks are used only if bands can't employ enough threads.
+    // Tilted image depends on the whole rows above, so it isn't banded.
+    const auto channels = static_cast<unsigned int>(mat.channels());
+    const auto banded = !(outputs & output::tilted);
+    auto bands = split_rows(mat, banded ? thread_count : 1);
+    if(channels == 1 || thread_count == 1 || bands.size() >= channels) {
+        enqueue_bands(std::move(image), std::move(tasks), std::move(bands));
+        return;
+    }
+
+    bands = split_rows(
+        mat, banded ? (thread_count + channels - 1) / channels : 1);
+    for(auto& task : tasks) {
+        task_set_t channel;
+        channel.emplace_back(std::move(task));
+        enqueue_bands(image, std::move(channel), bands);
+    }
+}
+
+void integral_computation::enqueue_small(
+    std::shared_ptr<image_job> image, task_set_t tasks, const cv::Mat& mat) {
+    // Batch is open until its work item is taken by the thread, so the small
+    // matrices are coalesced only while the threads are busy, without delay.
+    const auto level = static_cast<std::size_t>(image->prio);
+    const auto prio = image->prio;
+    const auto node = image->node;
+    const auto id = tasks.front()->get_id();
+    auto job = std::make_unique<band_job>(
+        std::move(image), std::move(tasks),
+        std::vector<cv::Range>{cv::Range(0, mat.rows)});
+    std::shared_ptr<small_batch> batch;
+    {
+        std::lock_guard<std::mutex> lock(batch_mutex);
+        auto& open = open_batches[level];
+        if(open && open->pixels + mat.total() <= max_batch_pixels) {
+            open->pixels += mat.total();
+            open->jobs.emplace_back(std::move(job));
+            return;
+        }
+
+        open = std::make_shared<small_batch>();
+        open->pixels = mat.total();
+        open->node = node;
+        open->jobs.emplace_back(std::move(job));
+        batch = open;
+    }
+
+    auto work = [this, batch, level] {
+        {
+            std::lock_guard<std::mutex> lock(batch_mutex);
+            if(open_batches[level] == batch)
+                open_batches[level].reset();
+        }
+
+        for(auto& job : batch->jobs) {
+            try {
+                job->execute(job->bands.front());
+            }
+            catch(const std::exception& exception) {
+                job->fail(exception);
+            }
+            for(auto& task : job->tasks)
+                complete(job->image, std::move(task));
+        }
+    };
+    post_work(id, -1, stage::compute, prio, node, std::move(work));
+}
+
+std::vector<cv::Range> integral_computation::split_rows(
+    const cv::Mat& mat, unsigned int threads) const {
+    const auto by_pixels = mat.total() / min_band_pixels;
+    const auto by_rows = static_cast<std::size_t>(mat.rows / min_band_rows);
+    const auto spare = threads > 1 ? threads * bands_per_thread : 1;
+    const auto count = std::max<std::size_t>(
+        1, std::min<std::size_t>({spare, by_pixels, by_rows}));
+
+    std::vector<cv::Range> bands;
+    bands.reserve(count);
+    const auto rows = static_cast<std::size_t>(mat.rows);
+    for(std::size_t k = 0; k < count; ++k) {
+        const auto begin = static_cast<int>(rows * k / count);
+        const auto end = static_cast<int>(rows * (k + 1) / count);
+        bands.emplace_back(begin, end);
+    }
+
+    return bands;
+}
+
+template<typename Fn>
+void integral_computation::post_work(
+    const std::string& id, int channel, stage kind, priority prio, int node,
+    Fn fn) {
+    begin_work();
+    trace.on_queued();
+    const auto queued = execution_trace::clock::now();
+    workers->post(
+        [this, id, channel, kind, queued, fn = std::move(fn)]() mutable {
+            trace.on_dequeued();
+            const auto begin = execution_trace::clock::now();
+            trace.record(stage::queue, id, channel, queued, begin);
+            fn();
+            trace.record(
+                kind, id, channel, begin, execution_trace::clock::now());
+            end_work();
+        },
+        prio, node);
+}
+
+void integral_computation::enqueue_bands(
+    std::shared_ptr<image_job> image, task_set_t tasks,
+    std::vector<cv::Range> bands) {
+    auto job = std::make_shared<band_job>(
+        std::move(image), std::move(tasks), std::move(bands));
+    const auto id = job->tasks.front()->get_id();
+    auto on_done = [this, job] {
+        for(auto& task : job->tasks)
+            complete(job->image, std::move(task));
+    };
+
+    // The second pass is enqueued by the band which has completed the first
+    // pass last. Top band is final after the first pass already.
+    auto on_carried = [job, on_done] {
+        if(--job->pending == 0)
+            on_done();
+    };
+    auto on_computed = [this, id, job, on_done, on_carried] {
+        if(--job->pending)
+            return;
+
+        if(job->failed || job->bands.size() == 1) {
+            on_done();
+            return;
+        }
+
+        for(const auto& task : job->tasks)
+            task->propagate(job->bands);
+        job->pending = job->bands.size() - 1;
+        for(auto k = 1u; k < job->bands.size(); ++k) {
+            const auto rows = job->bands[k];
+            auto work = [job, rows, on_carried] {
+                for(const auto& task : job->tasks)
+                    task->apply_carry(rows);
+                on_carried();
+            };
+            post_work(
+                id, job->channel(), stage::carry, job->image->prio,
+                job->image->node, std::move(work));
+        }
+    };
+
+    for(const auto& rows : job->bands) {
+        auto work = [job, rows, on_computed] {
+            try {
+                job->execute(rows);
+            }
+            catch(const std::exception& exception) {
+                job->fail(exception);
+            }
+            on_computed();
+        };
+        post_work(
+            id, job->channel(), stage::compute, job->image->prio,
+            job->image->node, std::move(work));
+    }
+}
+
+void integral_computation::complete(
+    const std::shared_ptr<image_job>& image, processing_context::ptr task) {
+    const auto begin = execution_trace::clock::now();
+    const auto id = task->get_id();
+    const auto channel = task->get_channel();
+    if(logging)
+        std::cout << "Task completed: " << id << " [" << channel + 1 << "/"
+                  << image->tasks.size() << "]" << std::endl;
+
+    // each channel owns its slot, and the decrement publishes the slot to the
+    // thread, which completes the last channel
+    image->tasks[channel] = std::move(task);
+    if(image->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        // completion handler is invoked by the writers, so several matrices
+        // may be written concurrently
+        boost::asio::post(*writers, [this, image]() mutable {
+            on_complete(std::move(image));
+        });
+    }
+    trace.record(
+        stage::merge, id, channel, begin, execution_trace::clock::now());
+}
+
+void integral_computation::set_in_flight_limit(
+    std::size_t images, std::size_t bytes) {
+    {
+        std::lock_guard<std::mutex> lock(flight_mutex);
+        max_flight_images = images;
+        max_flight_bytes = bytes;
+    }
+    flight_cv.notify_all();
+}
+
+std::size_t integral_computation::footprint(
+    const cv::Mat& mat, int result_depth, unsigned outputs) {
+    auto element_bytes = CV_ELEM_SIZE1(result_depth);
+    if(outputs & output::sqsum)
+        element_bytes += CV_ELEM_SIZE1(CV_64F);
+    if(outputs & output::tilted)
+        element_bytes += CV_ELEM_SIZE1(result_depth);
+    const auto result_bytes = mat.total() * mat.channels() * element_bytes;
+    return mat.total() * mat.elemSize() + result_bytes;
+}
+
+void integral_computation::acquire_flight(std::size_t bytes) {
+    std::unique_lock<std::mutex> lock(flight_mutex);
+    flight_cv.wait(lock, [this, bytes] {
+        if(max_flight_images && flight_images >= max_flight_images)
+            return false;
+        // the first matrix is taken regardless of its size
+        return !max_flight_bytes || flight_images == 0
+            || flight_bytes + bytes <= max_flight_bytes;
+    });
+    ++flight_images;
+    flight_bytes += bytes;
+}
+
+void integral_computation::release_flight(std::size_t bytes) {
+    {
+        std::lock_guard<std::mutex> lock(flight_mutex);
+        --flight_images;
+        flight_bytes -= bytes;
+    }
+    flight_cv.notify_all();
+}
+
+void integral_computation::begin_work() {
+    ++pending_work;
+}
+
+void integral_computation::end_work() {
+    if(--pending_work)
+        return;
+
+    {
+        // waiter checks the counter under the lock, so it can't miss the
+        // notification
+        std::lock_guard<std::mutex> lock(flight_mutex);
+    }
+    flight_cv.notify_all();
+}
+
+void integral_computation::set_accumulator(accumulator acc) {
+    this->acc = acc;
+}
+
+void integral_computation::set_outputs(unsigned outputs) {
+    this->outputs = outputs;
+}
+
+void integral_computation::set_result_allocator(result_allocator_fn_t fn) {
+    result_allocator_fn = fn;
+}
+
+void integral_computation::set_buffer_pool(buffer_pool* pool) {
+    this->pool = pool;
+}
+
 void integral_computation::set_on_complete(on_complete_fn_t fn) {
     on_complete_fn = fn;
 }
 
-void integral_computation::wait_for_complete() {
-    workers->join();
-    io.run();
+void integral_computation::set_on_failure(on_failure_fn_t fn) {
+    on_failure_fn = fn;
+}
+
+void integral_computation::set_logging(bool enabled) {
+    logging = enabled;
+}
+
+execution_stats integral_computation::get_stats() const {
+    return trace.get_stats();
+}
+
+execution_trace& integral_computation::get_trace() noexcept {
+    return trace;
 }
 
-void sp::integral_computation::on_complete(processing_context::ptr task) {
-    const auto filename = task->get_id();
-    const std::size_t channels = task->get_image().channels();
-    std::cout << "Task completed: " << task->get_id() << " ["
-              << task->get_channel() + 1 << "/" << channels << "]" << std::endl;
+void integral_computation::wait_for_complete() {
+    // matrix leaves flight after its handler, but the last work items of the
+    // matrix may still record their stages
+    std::unique_lock<std::mutex> lock(flight_mutex);
+    flight_cv.wait(
+        lock, [this] { return flight_images == 0 && pending_work == 0; });
+}
 
-    auto& tasks = completed_tasks[filename];
-    tasks.emplace_back(std::move(task));
-    if(tasks.size() < channels)
+void integral_computation::shutdown() {
+    if(stopped.exchange(true))
         return;
 
-    std::sort(
-        std::begin(tasks), std::end(tasks),
-        [](const auto& task1, const auto& task2) {
-            return task1->get_channel() < task2->get_channel();
-        });
+    wait_for_complete();
+    // writers are joined after workers, which post completed tasks to them
+    workers->join();
+    writers->join();
+}
+
+void integral_computation::on_complete(std::shared_ptr<image_job> image) {
+    auto& tasks = image->tasks;
+    const auto& front = tasks.front();
+    const auto id = front->get_id();
+    auto outputs = static_cast<unsigned>(output::sum);
+    if(!front->get_sqsum().empty())
+        outputs |= output::sqsum;
+    if(!front->get_tilted().empty())
+        outputs |= output::tilted;
+    const auto bytes = footprint(
+        front->get_image(), front->get_result().depth(), outputs);
+    const auto begin = execution_trace::clock::now();
+    if(image->promise) {
+        if(image->error)
+            image->promise->set_exception(image->error);
+        else
+            image->promise->set_value(std::move(tasks));
+    }
+    else {
+        const auto& fn = image->on_complete ? image->on_complete
+                                            : on_complete_fn;
+        try {
+            if(image->error && on_failure_fn)
+                on_failure_fn(tasks, image->error);
+            else if(!image->error && fn)
+                fn(tasks);
+        }
+        catch(const std::exception& exception) {
+            std::cerr << id << ": " << exception.what();
+        }
+    }
+    trace.record(stage::write, id, -1, begin, execution_trace::clock::now());
+    trace.on_completed();
 
-    if(on_complete_fn)
-        on_complete_fn(tasks);
-    completed_tasks.erase(filename);
+    // results are released before the next matrix is taken in flight, even
+    // though band jobs of the matrix may still hold the shared state
+    image->tasks.clear();
+    release_flight(bytes);
 }
 
 } // namespace sp
\ No newline at end of file
@@ -5,10 +5,17 @@
 ///
 
 #pragma once
-#include "boost/asio/io_context.hpp"
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <mutex>
 #include "boost/asio/thread_pool.hpp"
+#include "buffer_pool.hpp"
+#include "execution_trace.hpp"
 #include "opencv2/imgproc.hpp"
 #include "processing_context.hpp"
+#include "work_scheduler.hpp"
 
 namespace sp {
 
@@ -17,8 +24,32 @@ namespace sp {
 Serves matrix decomposition to several tasks, which will be computed
 asynchronously in separated thread(s). Thread pool may be
 extended to number of CPU cores.
+Large matrices are splitted to horizontal bands of rows, so even the single
+channel image is computed by all threads of the pool. Channels of the band
+are computed by the single pass over the matrix, unless there are more
+threads than bands; in that case each channel is computed by the separated
+task. Threads steal bands from each other, so the large matrix doesn't stay
+on the single thread while the others are idle. Matrices smaller than the
+band are coalesced to the batches computed by the single work item, while
+the threads are busy. Work of the latency priority matrices is taken before
+the bulk one.
 After computation collects tasks of the same input matrix to vector and call
-completion handler for that vector.
+completion handler for that vector. Each channel stores its task to its own
+slot of the vector and decrements the counter of pending channels, so the
+last computed channel hands the matrix to the separated writer threads
+without any lock. Completion handlers are invoked as soon as the matrix is
+computed, so computation of the next matrices overlaps with the output of the
+previous ones. Number of
+matrices in flight may be limited to keep memory consumption constant.
+Threads may be pinned to the CPUs of the NUMA nodes. In that case matrices
+are assigned to the nodes in turn: the work of the matrix is posted to the
+threads of its node, and its results are taken from the buffers of the node
+or are allocated anew, so their pages are placed by the first write of these
+threads. Idle threads steal the work of the remote nodes as well, so the
+single large matrix is still computed by all the threads.
+Executor is intended to be long-lived: thread pools are created once, and
+matrices may be enqueued again after wait_for_complete() returns, until
+shutdown() is called.
 
 Usage example:
 @code
@@ -32,6 +63,13 @@ Usage example:
     executor.enqueue_file(file_name, some_mat);
     executor.wait_for_complete();
 @endcode
+
+Streaming usage example:
+@code
+    integral_computation executor;
+    auto future = executor.submit("Lena.png", cv::imread("Lena.png"));
+    const auto tasks = future.get(); // throws if computation has failed
+@endcode
 */
 class integral_computation {
 public:
@@ -41,30 +79,151 @@ public:
     //! @brief Shorthand for completion handler signature
     using on_complete_fn_t = std::function<void(const task_set_t& tasks)>;
 
+    //! @brief Shorthand for failure handler signature
+    using on_failure_fn_t = std::function<void(
+        const task_set_t& tasks, std::exception_ptr error)>;
+
+    /** @brief Shorthand for result allocator signature.
+
+    Allocator receives matrix identification, matrix and depth of its
+    integral images and returns preallocated results for each channel, or
+    empty vector to allocate them by the executor.
+    */
+    using result_allocator_fn_t = std::function<std::vector<cv::Mat>(
+        const std::string& id, const cv::Mat& mat, int result_depth)>;
+
 private:
     //! @brief Shorthand for thread pool class.
     using thread_pool_t = boost::asio::thread_pool;
 
-    //! @brief Shorthand to grouping tasks of the same matrix according its id.
-    using file_tasks_t = std::map<std::string, task_set_t>;
-
 public:
     /** @brief Constructs computation executer
 
     Executor contains several threads and performs computation for each channel
     in different threads.
     @param thread_count Number of threads for computation.
+    @param writer_count Number of threads invoking completion handler.
+    @param pinned Whether threads are pinned to the CPUs of the NUMA nodes.
     @note In case if thread_count == 0 number of threads will be the same as
-    the CPU core numbers
+    the number of CPUs available to the process, see numa_topology.
+    @note In case if writer_count > 1 completion handler may be invoked
+    concurrently.
     */
-    integral_computation(unsigned int thread_count = 0);
+    integral_computation(
+        unsigned int thread_count = 0, unsigned int writer_count = 1,
+        bool pinned = false);
+
+    //! @brief Completes all the enqueued matrices and stops the threads.
+    ~integral_computation();
 
     /** @brief Enqueues matrix with its corresponding identification
 
+    Blocks while the limit of matrices in flight is reached. May be called
+    from several threads concurrently, but not from the completion handler.
+    @param id Matrix identification.
+    @param mat Matrix.
+    @param prio Priority of the matrix.
+    */
+    bool enqueue_file(
+        const std::string& id, cv::Mat& mat, priority prio = priority::bulk);
+
+    /** @brief Enqueues matrix and returns the future of its tasks.
+
+    Completion handler isn't invoked for the matrix. Matrix leaves flight
+    when the future becomes ready, so the results held by the caller aren't
+    limited. Blocks while the limit of matrices in flight is reached.
+    @param id Matrix identification.
+    @param mat Matrix.
+    @param prio Priority of the matrix.
+    @return Future of the tasks ordered by channel, which keeps exception of
+    the failed computation.
+    */
+    std::future<task_set_t> submit(
+        const std::string& id, const cv::Mat& mat,
+        priority prio = priority::bulk);
+
+    /** @brief Enqueues matrix with its own completion handler.
+
+    Handler is invoked by the writer threads instead of the handler set by
+    set_on_complete(), unless the computation fails, see set_on_failure().
+    Blocks while the limit of matrices in flight is reached.
     @param id Matrix identification.
     @param mat Matrix.
+    @param fn Completion handler of the matrix.
+    @param prio Priority of the matrix.
+    */
+    void submit(
+        const std::string& id, const cv::Mat& mat, on_complete_fn_t fn,
+        priority prio = priority::bulk);
+
+    /** @brief Enqueues update of the previously computed matrix.
+
+    Integral images are recomputed in-place only at and below-right of the
+    changed rectangles, unless that region covers the most part of the
+    matrix; in that case it is cheaper to compute the whole matrix by bands.
+    Only the sums are passed from the previous matrix, so the matrix is
+    computed entirely as well when squared or tilted integral images are
+    requested by set_outputs(). Blocks while the limit of matrices in flight
+    is reached.
+    @param id Matrix identification.
+    @param mat Changed matrix.
+    @param results Integral images of each channel of the matrix before the
+    change, e.g. results of the previous frame.
+    @param dirty Changed rectangles of the matrix.
+    @param prio Priority of the matrix.
+    */
+    bool enqueue_update(
+        const std::string& id, cv::Mat& mat,
+        const std::vector<cv::Mat>& results,
+        const std::vector<cv::Rect>& dirty, priority prio = priority::bulk);
+
+    /** @brief Limits matrices in flight.
+
+    Matrix is in flight since it is enqueued and until its completion handler
+    returns. Memory of the matrix is estimated as the size of its data plus
+    the size of its integral images. Matrix exceeding the memory limit alone
+    is processed anyway, but not simultaneously with others.
+    @param images Maximal number of matrices in flight, 0 for unlimited.
+    @param bytes Maximal memory of matrices in flight, 0 for unlimited.
+    */
+    void set_in_flight_limit(std::size_t images, std::size_t bytes = 0);
+
+    /** @brief Sets type of the integral image elements.
+
+    Affects matrices enqueued after the call. Matrices which may overflow
+    accumulator::s32 are rejected by std::out_of_range when enqueued.
+    @param acc Accumulator type, accumulator::f64 by default.
+    */
+    void set_accumulator(accumulator acc);
+
+    /** @brief Sets integral images computed for each channel.
+
+    Affects matrices enqueued after the call. Requested images are available
+    in the completion handler through the tasks. Matrices requesting tilted
+    integral image aren't splitted to bands.
+    @param outputs Combination of output values, output::sum by default.
+    */
+    void set_outputs(unsigned outputs);
+
+    /** @brief Sets allocator of the integral images.
+
+    Allocator is invoked by enqueue_file(), so results may be placed to the
+    memory owned by the caller, e.g. to the mapped output file, instead of
+    being copied there by the completion handler. Results must stay valid
+    until the completion handler of the matrix returns.
+    @param fn Result allocator.
+    */
+    void set_result_allocator(result_allocator_fn_t fn);
+
+    /** @brief Sets pool of the integral images allocated by the executor.
+
+    Integral images of the released tasks return to the pool, so the steady
+    flow of matrices doesn't allocate them. Affects matrices enqueued after
+    the call.
+    @param pool Pool, which outlives the results, the process wide one by
+    default, or nullptr for the default allocator.
     */
-    bool enqueue_file(const std::string& id, cv::Mat& mat);
+    void set_buffer_pool(buffer_pool* pool);
 
     /** @brief Sets completion handler.
     
@@ -73,22 +232,155 @@ public:
     */
     void set_on_complete(on_complete_fn_t fn);
 
+    /** @brief Sets failure handler.
+
+    Failure handler is invoked instead of the completion handler of the matrix,
+    whose computation has failed, so its partial results aren't taken for the
+    output. Failure is already reported to the standard error.
+    @param fn Failure handler, which receives tasks of the matrix and the first
+    exception of its computation.
+    */
+    void set_on_failure(on_failure_fn_t fn);
+
+    /** @brief Enables logging of each completed task to the standard output.
+
+    Logging is enabled by default. Output is serialized by the lock of the
+    stream, so it is worth to disable it for the large batches.
+    @param enabled Whether completed tasks are logged.
+    */
+    void set_logging(bool enabled);
+
+    /** @brief Retruns snapshot of the execution counters.
+
+    Counters include durations of the stages, depth of the queue of the
+    computation threads and busy time of each thread.
+    */
+    execution_stats get_stats() const;
+
+    /** @brief Retruns trace of the execution.
+
+    Trace may be used to enable keeping of the separated events and to record
+    stages performed outside of the executor, e.g. decoding.
+    */
+    execution_trace& get_trace() noexcept;
+
     /** @brief Waiting for completion of the matrix calculation.
 
     Blocks until all matrices are calculated and call completition handler for
-    each vector.
+    each vector. Threads are kept, so the executor may be used again. Must not
+    be called from the completion handler.
     */
     void wait_for_complete();
 
+    /** @brief Completes all the enqueued matrices and stops the threads.
+
+    Enqueueing after the shutdown throws std::runtime_error. Must not be
+    called concurrently with enqueueing.
+    */
+    void shutdown();
+
 private:
-    //! @brief Stores completed task to corresponded vector
-    void on_complete(processing_context::ptr task);
+    //! @brief Shared state of the tasks computed by several bands.
+    struct band_job;
+
+    //! @brief Shared state collecting computed channels of the matrix.
+    struct image_job;
+
+    //! @brief Small matrices computed by the single work item.
+    struct small_batch;
+
+    //! @brief Splits matrix rows to bands for the number of threads.
+    std::vector<cv::Range> split_rows(
+        const cv::Mat& mat, unsigned int threads) const;
+
+    //! @brief Returns node of the next matrix.
+    int next_node();
+
+    //! @brief Creates tasks of the matrix of the node, taking it in flight.
+    task_set_t create_tasks(
+        const std::string& id, const cv::Mat& mat,
+        std::vector<cv::Mat> results, int node);
+
+    //! @brief Computes the matrix and completes its shared state.
+    void enqueue_image(
+        std::shared_ptr<image_job> image, const std::string& id,
+        const cv::Mat& mat);
+
+    //! @brief Enqueues computation of the tasks of the whole matrix.
+    void enqueue_tasks(
+        std::shared_ptr<image_job> image, task_set_t tasks,
+        const cv::Mat& mat);
+
+    //! @brief Appends the small matrix to the open batch or opens the new one.
+    void enqueue_small(
+        std::shared_ptr<image_job> image, task_set_t tasks,
+        const cv::Mat& mat);
+
+    //! @brief Posts the stage of the matrix to the threads of the node.
+    template<typename Fn>
+    void post_work(
+        const std::string& id, int channel, stage kind, priority prio,
+        int node, Fn fn);
+
+    //! @brief Enqueues banded computation of the tasks.
+    void enqueue_bands(
+        std::shared_ptr<image_job> image, task_set_t tasks,
+        std::vector<cv::Range> bands);
+
+    /** @brief Stores computed task to the slot of its channel.
+
+    Posts the matrix to the writer threads if the task is the last pending
+    channel of the matrix.
+    */
+    void complete(
+        const std::shared_ptr<image_job>& image, processing_context::ptr task);
+
+    //! @brief Invokes completion or failure handler and releases matrix from
+    //! flight.
+    void on_complete(std::shared_ptr<image_job> image);
+
+    //! @brief Estimates memory of the matrix in flight.
+    static std::size_t footprint(
+        const cv::Mat& mat, int result_depth, unsigned outputs);
+
+    //! @brief Waits until the matrix may be taken in flight.
+    void acquire_flight(std::size_t bytes);
+
+    //! @brief Releases the matrix from flight.
+    void release_flight(std::size_t bytes);
+
+    //! @brief Counts the work item, which is done by the threads.
+    void begin_work();
+
+    //! @brief Uncounts the work item, notifying waiters of the last one.
+    void end_work();
 
 private:
-    boost::asio::io_context io;
-    std::unique_ptr<thread_pool_t> workers;
-    file_tasks_t completed_tasks;
+    unsigned int thread_count;
+    accumulator acc = accumulator::f64;
+    unsigned outputs = output::sum;
+    std::unique_ptr<work_scheduler> workers;
+    std::atomic<std::size_t> next_image{0};
+    std::unique_ptr<thread_pool_t> writers;
+    std::atomic<bool> stopped{false};
     on_complete_fn_t on_complete_fn;
+    on_failure_fn_t on_failure_fn;
+    result_allocator_fn_t result_allocator_fn;
+    buffer_pool* pool = &buffer_pool::instance();
+
+    std::mutex batch_mutex;
+    std::array<std::shared_ptr<small_batch>, priority_count> open_batches;
+
+    execution_trace trace;
+    std::atomic<bool> logging{true};
+
+    std::mutex flight_mutex;
+    std::condition_variable flight_cv;
+    std::size_t max_flight_images = 0;
+    std::size_t max_flight_bytes = 0;
+    std::size_t flight_images = 0;
+    std::size_t flight_bytes = 0;
+    std::atomic<std::size_t> pending_work{0};
 };
 
 } // namespace sp
\ No newline at end of file
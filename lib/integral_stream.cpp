@@ -0,0 +1,103 @@
+#include "integral_stream.hpp"
+
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include "row_integrator.hpp"
+
+namespace sp {
+namespace {
+
+//! @brief Computes rows of the strip for all the channels.
+template<typename T, typename A>
+void compute(
+    const cv::Mat& strip, std::size_t total, std::vector<cv::Mat>& bands,
+    std::vector<cv::Mat>& carry, std::vector<double>& errors, bool top) {
+    const auto channels = strip.channels();
+    std::vector<const A*> above(channels);
+    std::vector<A*> dst(channels);
+    // rounding errors of the compensated sums are carried with the last row
+    const row_integrator<T, A> integrate(total, strip.cols, channels, errors);
+    for(auto i = 0; i < strip.rows; ++i) {
+        // the first row of the strip continues the last row of the preceding
+        // strip
+        for(auto c = 0; c < channels; ++c) {
+            above[c] = i > 0 ? bands[c].ptr<A>(i - 1) : carry[c].ptr<A>();
+            dst[c] = bands[c].ptr<A>(i);
+        }
+        const auto first = top && i == 0;
+        integrate(
+            strip.ptr<T>(i), channels, first ? nullptr : above.data(),
+            dst.data());
+    }
+
+    const auto bytes = strip.cols * sizeof(A);
+    for(auto c = 0; c < channels; ++c)
+        std::memcpy(carry[c].ptr(), bands[c].ptr(strip.rows - 1), bytes);
+}
+
+} // namespace
+
+integral_stream::integral_stream(
+    const cv::Size& size, int type, accumulator acc)
+    : size(size)
+    , type(type)
+    , result_depth(processing_context::result_depth(
+          CV_MAT_DEPTH(type), size.area(), acc)) {
+    const auto channels = CV_MAT_CN(type);
+    buffers.resize(channels);
+    bands.resize(channels);
+    carry.resize(channels);
+    for(auto& row : carry)
+        row.create(1, size.width, result_depth);
+}
+
+const std::vector<cv::Mat>& integral_stream::push(const cv::Mat& strip) {
+    if(strip.type() != type || strip.cols != size.width
+       || rows + strip.rows > size.height) {
+        std::stringstream error;
+        error << "Unexpected strip: " << strip.rows << "x" << strip.cols
+              << " of type " << strip.type() << " at row " << rows << ";";
+        throw std::invalid_argument(error.str());
+    }
+
+    // buffers grow to the highest strip and are reused by the next ones
+    for(auto c = 0u; c < buffers.size(); ++c) {
+        if(buffers[c].rows < strip.rows)
+            buffers[c].create(strip.rows, size.width, result_depth);
+        bands[c] = buffers[c].rowRange(0, strip.rows);
+    }
+
+    if(strip.rows > 0) {
+        dispatch_depths(strip.depth(), result_depth, [&](auto src, auto acc) {
+            using T = type_of<decltype(src)>;
+            using A = type_of<decltype(acc)>;
+            compute<T, A>(
+                strip, size.area(), bands, carry, errors, rows == 0);
+        });
+    }
+    rows += strip.rows;
+    return bands;
+}
+
+const cv::Size& integral_stream::get_size() const noexcept {
+    return size;
+}
+
+int integral_stream::get_type() const noexcept {
+    return type;
+}
+
+int integral_stream::get_result_depth() const noexcept {
+    return result_depth;
+}
+
+int integral_stream::get_rows() const noexcept {
+    return rows;
+}
+
+bool integral_stream::is_complete() const noexcept {
+    return rows == size.height;
+}
+
+} // namespace sp
\ No newline at end of file
@@ -0,0 +1,81 @@
+///
+/// \file
+/// Defines the sp::integral_stream class, which computes integral images of
+/// the image pushed by strips of rows.
+///
+
+#pragma once
+#include <vector>
+#include "opencv2/core.hpp"
+#include "processing_context.hpp"
+
+namespace sp {
+
+/** @brief Computes integral images of the image, which doesn't fit memory.
+
+Image is pushed by horizontal strips of rows from top to bottom, and the
+integral images of each strip are returned as soon as it is computed, so
+they may be written to the output before the next strip is read. Only the
+last row of the integral images is carried between strips, so the memory is
+proportional to the width of the image and the height of the strip,
+regardless of the height of the image. Only sums are computed.
+
+Usage example:
+@code
+    integral_stream stream(size, CV_8UC3);
+    cv::Mat strip;
+    while(reader.read(strip, 256)) {
+        const auto& bands = stream.push(strip);
+        // write rows of bands of each channel
+    }
+@endcode
+*/
+class integral_stream {
+public:
+    /** @brief Constructs stream of the image.
+
+    @param size Size of the whole image.
+    @param type Type of the image, e.g. CV_8UC3.
+    @param acc Type of the result elements, chosen for the whole image.
+    @throw std::out_of_range In case of s32 accumulator, which may overflow.
+    */
+    integral_stream(
+        const cv::Size& size, int type, accumulator acc = accumulator::f64);
+
+    /** @brief Computes integral images of the next strip.
+
+    @param strip Next rows of the image.
+    @return Integral images of the strip rows for each channel, which are
+    valid until the next call.
+    @throw std::invalid_argument In case of the strip of the other type or
+    width, or beyond the bottom of the image.
+    */
+    const std::vector<cv::Mat>& push(const cv::Mat& strip);
+
+    //! @brief Retruns size of the whole image.
+    const cv::Size& get_size() const noexcept;
+
+    //! @brief Retruns type of the image.
+    int get_type() const noexcept;
+
+    //! @brief Retruns depth of the integral images, CV_32S or CV_64F.
+    int get_result_depth() const noexcept;
+
+    //! @brief Retruns number of the computed rows.
+    int get_rows() const noexcept;
+
+    //! @brief Returns whether all the rows of the image are computed.
+    bool is_complete() const noexcept;
+
+private:
+    cv::Size size;
+    int type;
+    int result_depth;
+    int rows = 0;
+    std::vector<cv::Mat> buffers;
+    std::vector<cv::Mat> bands;
+    std::vector<cv::Mat> carry;
+    std::vector<double> errors;
+};
+
+} // namespace sp
\ No newline at end of file
@@ -0,0 +1,87 @@
+#include "integral_view.hpp"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include "integral_kernels.hpp"
+
+namespace sp {
+namespace {
+
+//! @brief Number of rectangles summed by the single parallel task.
+constexpr std::size_t stripe_rects = 1 << 14;
+
+static_assert(
+    sizeof(cv::Rect) == 4 * sizeof(int),
+    "rectangles are passed to kernels as quadruples of int");
+
+} // namespace
+
+integral_view::integral_view(const cv::Mat& integral) : integral(integral) {
+    const auto type = integral.type();
+    if(type != CV_32SC1 && type != CV_64FC1) {
+        std::stringstream error;
+        error << "Unsupported integral image type: " << type << ";";
+        throw std::invalid_argument(error.str());
+    }
+}
+
+const cv::Mat& integral_view::get_integral() const noexcept {
+    return integral;
+}
+
+double integral_view::sum(const cv::Rect& rect) const {
+    validate(rect);
+    double result = 0;
+    sum(&rect, 1, &result);
+    return result;
+}
+
+double integral_view::mean(const cv::Rect& rect) const {
+    return sum(rect) / rect.area();
+}
+
+std::vector<double> integral_view::sum(
+    const std::vector<cv::Rect>& rects) const {
+    // rectangles are validated before the parallel loop, which can't
+    // propagate exceptions
+    for(const auto& rect : rects)
+        validate(rect);
+
+    std::vector<double> result(rects.size());
+    const auto stripes = (rects.size() + stripe_rects - 1) / stripe_rects;
+    cv::parallel_for_(
+        cv::Range(0, static_cast<int>(stripes)), [&](const cv::Range& range) {
+            const auto begin = range.start * stripe_rects;
+            const auto end =
+                std::min(rects.size(), range.end * stripe_rects);
+            sum(rects.data() + begin, end - begin, result.data() + begin);
+        });
+
+    return result;
+}
+
+void integral_view::validate(const cv::Rect& rect) const {
+    if(rect.x >= 0 && rect.y >= 0 && rect.width >= 0 && rect.height >= 0
+       && rect.x <= integral.cols - rect.width
+       && rect.y <= integral.rows - rect.height)
+        return;
+
+    std::stringstream error;
+    error << "Rectangle is out of the integral image: [" << rect.x << ", "
+          << rect.y << ", " << rect.width << "x" << rect.height << "];";
+    throw std::out_of_range(error.str());
+}
+
+void integral_view::sum(
+    const cv::Rect* rects, std::size_t count, double* dst) const {
+    const auto step = static_cast<std::ptrdiff_t>(integral.step1());
+    const auto coords = &rects->x;
+    if(integral.depth() == CV_32S)
+        kernel::sum_rects(
+            integral.ptr<std::int32_t>(), step, coords, count, dst);
+    else
+        kernel::sum_rects(integral.ptr<double>(), step, coords, count, dst);
+}
+
+} // namespace sp
\ No newline at end of file
@@ -0,0 +1,79 @@
+///
+/// \file
+/// Defines the sp::integral_view class, which answers region-sum queries.
+///
+
+#pragma once
+#include <vector>
+#include "opencv2/core.hpp"
+
+namespace sp {
+
+/** @brief Region-sum queries over the computed integral image.
+
+Integral image follows the inclusive convention of the project: element
+(i, j) contains the sum of the channel over rows [0:i] and columns [0:j], so
+the sum of the rectangle is combined from its corners shifted by one up and
+left, and corners outside of the image are zero. View doesn't copy the
+integral image, so it may refer either to the computed result or to the
+channel of the mapped binary file.
+
+Usage example:
+@code
+    const integral_view view(task->get_result());
+    const auto sum = view.sum(cv::Rect(10, 20, 24, 24));
+
+    const integral_file file("Lena.integral");
+    const integral_view mapped(file.get_channel(0));
+    const auto sums = mapped.sum(haar_rects);
+@endcode
+*/
+class integral_view {
+public:
+    /** @brief Constructs view of the integral image.
+
+    @param integral Single channel integral image of CV_32S or CV_64F depth.
+    @throw std::invalid_argument In case of the unsupported matrix type.
+    */
+    explicit integral_view(const cv::Mat& integral);
+
+    //! @brief Retruns viewed integral image.
+    const cv::Mat& get_integral() const noexcept;
+
+    /** @brief Retruns sum of the channel over the rectangle.
+
+    @param rect Rectangle lying inside the image.
+    @throw std::out_of_range In case of the rectangle outside of the image.
+    */
+    double sum(const cv::Rect& rect) const;
+
+    /** @brief Retruns mean of the channel over the rectangle.
+
+    Mean of the empty rectangle is NaN.
+    @param rect Rectangle lying inside the image.
+    @throw std::out_of_range In case of the rectangle outside of the image.
+    */
+    double mean(const cv::Rect& rect) const;
+
+    /** @brief Retruns sums of the channel over the rectangles.
+
+    Intended for the large batches, e.g. of Haar features: rectangles are
+    summed by the vector kernel and the batch is splitted to stripes
+    processed in parallel.
+    @param rects Rectangles lying inside the image.
+    @throw std::out_of_range In case of the rectangle outside of the image.
+    */
+    std::vector<double> sum(const std::vector<cv::Rect>& rects) const;
+
+private:
+    //! @brief Throws if the rectangle isn't inside the image.
+    void validate(const cv::Rect& rect) const;
+
+    //! @brief Computes sums of the validated rectangles.
+    void sum(const cv::Rect* rects, std::size_t count, double* dst) const;
+
+private:
+    cv::Mat integral;
+};
+
+} // namespace sp
\ No newline at end of file
@@ -0,0 +1,170 @@
+#include "numa_topology.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include "boost/filesystem.hpp"
+#include "boost/thread/thread.hpp"
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace fs = boost::filesystem;
+
+namespace sp {
+namespace {
+
+//! @brief Returns CPUs the process may run on.
+std::vector<int> allowed_cpus() {
+    std::vector<int> cpus;
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for(auto cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            if(CPU_ISSET(cpu, &set))
+                cpus.push_back(cpu);
+    }
+#endif
+    if(cpus.empty()) {
+        const auto count =
+            std::max(boost::thread::hardware_concurrency(), 1u);
+        for(auto cpu = 0u; cpu < count; ++cpu)
+            cpus.push_back(static_cast<int>(cpu));
+    }
+    return cpus;
+}
+
+//! @brief Reads nodes of the system from sysfs, limited to the CPUs.
+std::vector<numa_topology::node> read_nodes(const std::vector<int>& allowed) {
+    std::vector<numa_topology::node> nodes;
+    const fs::path root("/sys/devices/system/node");
+    boost::system::error_code error;
+    if(!fs::is_directory(root, error))
+        return nodes;
+
+    for(const auto& item : fs::directory_iterator(root, error)) {
+        const auto name = item.path().filename().string();
+        if(name.compare(0, 4, "node") != 0
+           || name.find_first_not_of("0123456789", 4) != std::string::npos
+           || name.size() == 4)
+            continue;
+
+        std::ifstream input((item.path() / "cpulist").string());
+        std::string list;
+        if(!std::getline(input, list))
+            continue;
+
+        numa_topology::node node{std::stoi(name.substr(4)), {}};
+        try {
+            for(const auto cpu : numa_topology::parse_cpu_list(list))
+                if(std::binary_search(allowed.begin(), allowed.end(), cpu))
+                    node.cpus.push_back(cpu);
+        }
+        catch(const std::invalid_argument&) {
+            continue;
+        }
+        if(!node.cpus.empty())
+            nodes.push_back(std::move(node));
+    }
+
+    std::sort(nodes.begin(), nodes.end(), [](const auto& a, const auto& b) {
+        return a.id < b.id;
+    });
+    return nodes;
+}
+
+} // namespace
+
+numa_topology::numa_topology(std::vector<node> nodes)
+    : nodes(std::move(nodes)) {
+    const auto empty = std::any_of(
+        this->nodes.begin(), this->nodes.end(),
+        [](const node& item) { return item.cpus.empty(); });
+    if(this->nodes.empty() || empty) {
+        std::stringstream error;
+        error << "Unsupported topology of " << this->nodes.size()
+              << " nodes;";
+        throw std::invalid_argument(error.str());
+    }
+}
+
+numa_topology numa_topology::detect() {
+    const auto allowed = allowed_cpus();
+    auto nodes = read_nodes(allowed);
+    if(nodes.empty())
+        nodes.push_back({0, allowed});
+    return numa_topology(std::move(nodes));
+}
+
+std::vector<int> numa_topology::parse_cpu_list(const std::string& list) {
+    auto malformed = [&list] {
+        std::stringstream error;
+        error << "Malformed CPU list: " << list << ";";
+        return std::invalid_argument(error.str());
+    };
+    auto parse_cpu = [&malformed](const std::string& text) {
+        if(text.empty() || text.size() > 6
+           || text.find_first_not_of("0123456789") != std::string::npos)
+            throw malformed();
+        return std::stoi(text);
+    };
+
+    std::vector<int> cpus;
+    const auto end = list.find_last_not_of(" \n");
+    std::stringstream input(list.substr(0, end + 1));
+    std::string range;
+    while(std::getline(input, range, ',')) {
+        const auto dash = range.find('-');
+        const auto first = parse_cpu(range.substr(0, dash));
+        const auto last = dash == std::string::npos
+            ? first
+            : parse_cpu(range.substr(dash + 1));
+        if(last < first)
+            throw malformed();
+
+        for(auto cpu = first; cpu <= last; ++cpu)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+bool numa_topology::pin_current_thread(int cpu) {
+#if defined(__linux__)
+    if(cpu < 0 || cpu >= CPU_SETSIZE)
+        return false;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+const std::vector<numa_topology::node>&
+numa_topology::get_nodes() const noexcept {
+    return nodes;
+}
+
+unsigned int numa_topology::cpu_count() const noexcept {
+    std::size_t count = 0;
+    for(const auto& item : nodes)
+        count += item.cpus.size();
+    return static_cast<unsigned int>(count);
+}
+
+std::size_t numa_topology::thread_node(std::size_t thread) const noexcept {
+    return thread % nodes.size();
+}
+
+int numa_topology::thread_cpu(std::size_t thread) const noexcept {
+    const auto& cpus = nodes[thread_node(thread)].cpus;
+    return cpus[thread / nodes.size() % cpus.size()];
+}
+
+} // namespace sp
\ No newline at end of file
@@ -0,0 +1,87 @@
+///
+/// \file
+/// Defines the sp::numa_topology class, which describes NUMA nodes and CPUs
+/// available to the process.
+///
+
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace sp {
+
+/** @brief NUMA nodes and their CPUs available to the process.
+
+On Linux nodes are read from sysfs and their CPUs are limited to the affinity
+mask of the process, e.g. set by taskset or the container, so the number of
+CPUs is the number of threads which may actually run in parallel. On other
+systems, or if the nodes are unknown, all the CPUs belong to the single
+node.
+
+Threads of the pool are spread over the nodes in turn, so any number of
+threads loads the memory controllers of all the nodes evenly, and over the
+CPUs of the node.
+
+Usage example:
+@code
+    const auto topology = numa_topology::detect();
+    std::thread thread([&] {
+        numa_topology::pin_current_thread(topology.thread_cpu(0));
+        // memory first written here is placed on the node of the thread
+    });
+@endcode
+*/
+class numa_topology {
+public:
+    //! @brief NUMA node.
+    struct node {
+        //! @brief Identifier of the node in the system.
+        int id;
+        //! @brief CPUs of the node available to the process.
+        std::vector<int> cpus;
+    };
+
+public:
+    /** @brief Constructs topology of the nodes.
+
+    @param nodes Nodes, each having at least one CPU.
+    @throw std::invalid_argument In case of no nodes or the node without
+    CPUs.
+    */
+    explicit numa_topology(std::vector<node> nodes);
+
+    //! @brief Returns topology of the system available to the process.
+    static numa_topology detect();
+
+    /** @brief Parses list of CPUs of the sysfs format, e.g. "0-3,8,10-11".
+
+    @param list CPU list.
+    @throw std::invalid_argument In case of the malformed list.
+    */
+    static std::vector<int> parse_cpu_list(const std::string& list);
+
+    /** @brief Binds the calling thread to the CPU.
+
+    @param cpu CPU number.
+    @return False if the binding isn't supported or has failed.
+    */
+    static bool pin_current_thread(int cpu);
+
+    //! @brief Retruns nodes of the topology.
+    const std::vector<node>& get_nodes() const noexcept;
+
+    //! @brief Retruns total number of the CPUs.
+    unsigned int cpu_count() const noexcept;
+
+    //! @brief Returns index of the node of the thread of the pool.
+    std::size_t thread_node(std::size_t thread) const noexcept;
+
+    //! @brief Returns CPU of the thread of the pool.
+    int thread_cpu(std::size_t thread) const noexcept;
+
+private:
+    std::vector<node> nodes;
+};
+
+} // namespace sp
\ No newline at end of file
@@ -0,0 +1,89 @@
+#include "padded_layout.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+namespace sp {
+namespace padded {
+namespace {
+
+template<typename T>
+void interleave_rows(const std::vector<cv::Mat>& channels, cv::Mat& dst) {
+    const auto cn = static_cast<int>(channels.size());
+    for(auto i = 0; i < dst.rows; ++i) {
+        const auto row = dst.ptr<T>(i);
+        for(auto c = 0; c < cn; ++c) {
+            const auto src = channels[c].ptr<T>(i);
+            for(auto j = 0; j < dst.cols; ++j)
+                row[j * cn + c] = src[j];
+        }
+    }
+}
+
+} // namespace
+
+cv::Mat create(
+    const cv::Size& size, int type, cv::MatAllocator* allocator) {
+    // Row of the storage is the multiple of both the alignment and the
+    // element, and has the room to shift the first element to the aligned
+    // address, so all the rows of the padded view are aligned.
+    const auto elem = CV_ELEM_SIZE(type);
+    auto line = alignment;
+    while(line % elem)
+        line += alignment;
+    const auto line_cols = static_cast<int>(line / elem);
+    const auto cols = size.width + 1;
+    const auto storage_cols =
+        (cols + line_cols - 1) / line_cols * line_cols + line_cols;
+
+    cv::Mat storage;
+    storage.allocator = allocator;
+    storage.create(size.height + 1, storage_cols, type);
+    auto offset = 0;
+    const auto address = reinterpret_cast<std::uintptr_t>(storage.data);
+    while(offset < line_cols && (address + offset * elem) % alignment)
+        ++offset;
+    if(offset == line_cols)
+        offset = 0;
+
+    cv::Mat result(storage, cv::Rect(offset, 0, cols, size.height + 1));
+    std::memset(result.ptr(0), 0, cols * elem);
+    for(auto i = 1; i < result.rows; ++i)
+        std::memset(result.ptr(i), 0, elem);
+    return result;
+}
+
+cv::Mat inner(const cv::Mat& padded) {
+    return padded(cv::Rect(1, 1, padded.cols - 1, padded.rows - 1));
+}
+
+cv::Mat interleave(
+    const std::vector<cv::Mat>& channels, cv::MatAllocator* allocator) {
+    auto valid = !channels.empty();
+    for(const auto& channel : channels)
+        valid = valid && channel.size() == channels.front().size()
+            && channel.type() == channels.front().type()
+            && (channel.type() == CV_32SC1 || channel.type() == CV_64FC1);
+    if(!valid) {
+        std::stringstream error;
+        error << "Unsupported integral images of " << channels.size()
+              << " channels;";
+        throw std::invalid_argument(error.str());
+    }
+
+    const auto cn = static_cast<int>(channels.size());
+    const auto depth = channels.front().depth();
+    auto result =
+        create(channels.front().size(), CV_MAKETYPE(depth, cn), allocator);
+    auto dst = inner(result);
+    if(depth == CV_32S)
+        interleave_rows<std::int32_t>(channels, dst);
+    else
+        interleave_rows<double>(channels, dst);
+    return result;
+}
+
+} // namespace padded
+} // namespace sp
\ No newline at end of file
@@ -0,0 +1,91 @@
+///
+/// \file
+/// Defines functions of the padded layout of integral images, which answers
+/// region-sum queries without boundary checks.
+///
+
+#pragma once
+#include <cstddef>
+#include <vector>
+#include "opencv2/core.hpp"
+
+namespace sp {
+
+/** @brief Zero-bordered layout of the integral images.
+
+Padded integral image of the H x W matrix is (H + 1) x (W + 1): its first
+row and column are zeros and element (i + 1, j + 1) contains the inclusive
+sum over rows [0:i] and columns [0:j]. So the sum of any rectangle is
+combined from four elements without checking whether its corners lie on the
+image boundary, which keeps loops over many rectangles branch-free.
+
+Rows of the padded images start at the 64-byte boundary, so rows are aligned
+for the vector loads regardless of the width. The H x W inner view of the
+padded image follows the usual convention, so it may be passed anywhere the
+integral image is expected, e.g. to text_writer.
+
+Channels are either planar, in the separate matrices, or interleaved, in the
+single multi-channel matrix.
+
+Usage example:
+@code
+    auto context = processing_context(
+        "Lena", LenaMat, 0, accumulator::f64, output::sum | output::padded);
+    context.execute();
+    const auto& table = context.get_padded();
+    for(const auto& rect : haar_rects)
+        sums.push_back(padded::sum<double>(table, rect));
+@endcode
+*/
+namespace padded {
+
+//! @brief Alignment of the rows of the padded matrices.
+constexpr std::size_t alignment = 64;
+
+/** @brief Allocates padded matrix with zero first row and column.
+
+Other elements are uninitialized.
+@param size Size of the image.
+@param type Type of the elements, possibly multi-channel.
+@param allocator Allocator of the matrix or nullptr for the default one.
+@return Matrix of (size.height + 1) x (size.width + 1) elements.
+*/
+cv::Mat create(
+    const cv::Size& size, int type, cv::MatAllocator* allocator = nullptr);
+
+//! @brief Returns H x W view of the padded matrix without its border.
+cv::Mat inner(const cv::Mat& padded);
+
+/** @brief Interleaves integral images of the channels to the padded matrix.
+
+@param channels Single channel integral images of the same size and type,
+e.g. inner views of the padded images.
+@param allocator Allocator of the matrix or nullptr for the default one.
+@return Padded multi-channel matrix.
+@throw std::invalid_argument In case of the images of different size or
+type.
+*/
+cv::Mat interleave(
+    const std::vector<cv::Mat>& channels,
+    cv::MatAllocator* allocator = nullptr);
+
+/** @brief Returns sum of the channel over the rectangle.
+
+Rectangle isn't checked, so it must lie inside the image.
+@param padded Padded integral image of T elements.
+@param rect Rectangle in coordinates of the image.
+@param channel Channel of the interleaved image.
+*/
+template<typename T>
+double sum(const cv::Mat& padded, const cv::Rect& rect, int channel = 0) {
+    const auto cn = padded.channels();
+    const auto top = padded.ptr<T>(rect.y) + channel;
+    const auto bottom = padded.ptr<T>(rect.y + rect.height) + channel;
+    const auto left = rect.x * cn;
+    const auto right = (rect.x + rect.width) * cn;
+    return static_cast<double>(bottom[right]) - bottom[left] - top[right]
+        + top[left];
+}
+
+} // namespace padded
+} // namespace sp
\ No newline at end of file
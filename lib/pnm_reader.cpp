@@ -0,0 +1,142 @@
+#include "pnm_reader.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+namespace sp {
+namespace {
+
+[[noreturn]] void malformed_image(
+    const std::string& path, const std::string& reason) {
+    std::stringstream error;
+    error << "Malformed image: " << path << ", " << reason << ";";
+    throw std::runtime_error(error.str());
+}
+
+//! @brief Reads the next number of the header, skipping comments.
+int read_number(std::istream& input, const std::string& path) {
+    while(true) {
+        const auto next = input.peek();
+        if(next == '#')
+            input.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        else if(std::isspace(next))
+            input.get();
+        else
+            break;
+    }
+
+    int value = 0;
+    if(!(input >> value) || value <= 0)
+        malformed_image(path, "invalid header");
+    return value;
+}
+
+/** @brief Converts row of the file to the row of the strip.
+
+Samples of the file are stored most significant byte first and channels as
+RGB. Row may be converted in-place if the strip keeps the type of the file.
+*/
+template<typename T>
+void convert_row(
+    const std::uint8_t* src, int cols, int channels, int sample_bytes,
+    T* dst, int dst_channels) {
+    // high byte is kept if 16-bit samples are narrowed
+    const auto shift = sample_bytes > static_cast<int>(sizeof(T)) ? 8 : 0;
+    for(auto j = 0; j < cols; ++j) {
+        T pixel[3];
+        for(auto c = 0; c < channels; ++c) {
+            const auto sample = src + (j * channels + c) * sample_bytes;
+            const auto value =
+                sample_bytes == 2 ? sample[0] << 8 | sample[1] : sample[0];
+            pixel[c] = static_cast<T>(value >> shift);
+        }
+        // gray sample is replicated to all the channels
+        for(auto c = 0; c < dst_channels; ++c)
+            dst[j * dst_channels + c] =
+                pixel[channels == 1 ? 0 : channels - 1 - c];
+    }
+}
+
+} // namespace
+
+pnm_reader::pnm_reader(const std::string& path, int flags)
+    : input(path, std::ios::binary), path(path) {
+    if(flags != cv::IMREAD_COLOR && flags != cv::IMREAD_UNCHANGED) {
+        std::stringstream error;
+        error << "Unsupported decode flags: " << flags << ";";
+        throw std::invalid_argument(error.str());
+    }
+    if(!input)
+        malformed_image(path, "unable to open");
+
+    char magic[2] = {};
+    input.read(magic, sizeof(magic));
+    if(!input || magic[0] != 'P' || (magic[1] != '5' && magic[1] != '6'))
+        malformed_image(path, "not a binary PGM or PPM");
+
+    size.width = read_number(input, path);
+    size.height = read_number(input, path);
+    const auto max_value = read_number(input, path);
+    if(max_value > 65535)
+        malformed_image(path, "invalid maximal value");
+    // single whitespace separates the header from the pixels
+    input.get();
+
+    const auto depth = max_value < 256 ? CV_8U : CV_16U;
+    file_type = CV_MAKETYPE(depth, magic[1] == '5' ? 1 : 3);
+    type = flags == cv::IMREAD_COLOR ? CV_8UC3 : file_type;
+}
+
+bool pnm_reader::is_pnm(const std::string& path) {
+    std::ifstream input(path, std::ios::binary);
+    char magic[2] = {};
+    input.read(magic, sizeof(magic));
+    return input && magic[0] == 'P' && (magic[1] == '5' || magic[1] == '6');
+}
+
+const cv::Size& pnm_reader::get_size() const noexcept {
+    return size;
+}
+
+int pnm_reader::get_type() const noexcept {
+    return type;
+}
+
+bool pnm_reader::read(cv::Mat& strip, int rows) {
+    rows = std::min(rows, size.height - rows_read);
+    if(rows <= 0)
+        return false;
+
+    // samples are converted in-place if the strip keeps their type
+    strip.create(rows, size.width, type);
+    auto& samples = file_type == type ? strip : buffer;
+    samples.create(rows, size.width, file_type);
+    const auto row_bytes = size.width * samples.elemSize();
+    for(auto i = 0; i < rows; ++i)
+        input.read(reinterpret_cast<char*>(samples.ptr(i)), row_bytes);
+    if(!input)
+        malformed_image(path, "truncated pixels");
+    rows_read += rows;
+
+    const auto channels = CV_MAT_CN(file_type);
+    const auto sample_bytes = static_cast<int>(CV_ELEM_SIZE1(file_type));
+    for(auto i = 0; i < rows; ++i) {
+        const auto src = samples.ptr<std::uint8_t>(i);
+        if(CV_MAT_DEPTH(type) == CV_16U)
+            convert_row(
+                src, size.width, channels, sample_bytes,
+                strip.ptr<std::uint16_t>(i), strip.channels());
+        else
+            convert_row(
+                src, size.width, channels, sample_bytes,
+                strip.ptr<std::uint8_t>(i), strip.channels());
+    }
+
+    return true;
+}
+
+} // namespace sp
\ No newline at end of file
@@ -0,0 +1,79 @@
+///
+/// \file
+/// Defines the sp::pnm_reader class, which reads binary PGM and PPM images
+/// by strips of rows.
+///
+
+#pragma once
+#include <fstream>
+#include <string>
+#include "opencv2/core.hpp"
+#include "opencv2/imgcodecs.hpp"
+
+namespace sp {
+
+/** @brief Reads binary PGM (P5) and PPM (P6) image by strips of rows.
+
+Pixels of the binary netpbm image are stored row by row right after the
+header, so the image may be read by strips without loading it whole. Strips
+are the rows of the image decoded by cv::imread with the same flags, so the
+streamed image doesn't differ from the decoded one. By cv::IMREAD_COLOR
+strips are 8-bit BGR: gray samples are replicated, and samples above 8 bits
+keep their high byte, as the decoder of OpenCV does. By cv::IMREAD_UNCHANGED
+strips keep channels and depth of the file, samples above 8 bits are
+converted to the byte order of the host.
+
+Usage example:
+@code
+    pnm_reader reader("scan.ppm");
+    cv::Mat strip;
+    while(reader.read(strip, 256))
+        process(strip);
+@endcode
+*/
+class pnm_reader {
+public:
+    /** @brief Opens the image and reads its header.
+
+    @param path Image file.
+    @param flags Either cv::IMREAD_COLOR or cv::IMREAD_UNCHANGED.
+    @throw std::runtime_error In case of the missing or malformed file.
+    @throw std::invalid_argument In case of the unsupported flags.
+    */
+    explicit pnm_reader(
+        const std::string& path, int flags = cv::IMREAD_COLOR);
+
+    /** @brief Returns whether the file looks like the binary PGM or PPM.
+
+    Only the signature of the file is checked.
+    */
+    static bool is_pnm(const std::string& path);
+
+    //! @brief Retruns size of the image.
+    const cv::Size& get_size() const noexcept;
+
+    //! @brief Retruns type of the strips of CV_8U or CV_16U depth.
+    int get_type() const noexcept;
+
+    /** @brief Reads the next strip of rows.
+
+    @param strip Output matrix, reallocated if its size or type differs.
+    @param rows Maximal number of rows in the strip.
+    @return False if all the rows are read already.
+    @throw std::runtime_error In case of the truncated file.
+    */
+    bool read(cv::Mat& strip, int rows);
+
+private:
+    std::ifstream input;
+    std::string path;
+    cv::Size size;
+    //! @brief Type of the samples stored in the file.
+    int file_type = 0;
+    int type = 0;
+    //! @brief Samples of the file, which are converted to the strip.
+    cv::Mat buffer;
+    int rows_read = 0;
+};
+
+} // namespace sp
\ No newline at end of file
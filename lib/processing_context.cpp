@@ -1,32 +1,276 @@
 #include "processing_context.hpp"
 
+#include <algorithm>
+#include <limits>
 #include <sstream>
+#include <stdexcept>
+#include "integral_kernels.hpp"
+#include "padded_layout.hpp"
+#include "row_integrator.hpp"
 
 namespace sp {
 namespace {
 
-template<typename T>
-void compute(const cv::Mat& src, cv::Mat& dst, int channel) {
-    std::vector<double> last_row(src.cols, 0.0);
+//! @brief Invokes functor with the tag of accumulator depth.
+template<typename Fn>
+void dispatch_accumulator(int depth, Fn&& fn) {
+    switch(depth) {
+    case CV_32S:
+        return fn(tag<std::int32_t>{});
+    case CV_64F:
+        return fn(tag<double>{});
+    default:
+        unsupported_depth(depth);
+    }
+}
+
+//! @brief Returns the maximal absolute value of the depth element.
+double max_abs_value(int depth) {
+    switch(depth) {
+    case CV_8U:
+        return std::numeric_limits<std::uint8_t>::max();
+    case CV_8S:
+        return -static_cast<double>(std::numeric_limits<std::int8_t>::min());
+    case CV_16U:
+        return std::numeric_limits<std::uint16_t>::max();
+    case CV_16S:
+        return -static_cast<double>(std::numeric_limits<std::int16_t>::min());
+    case CV_32S:
+        return -static_cast<double>(std::numeric_limits<std::int32_t>::min());
+    default:
+        return std::numeric_limits<double>::infinity();
+    }
+}
+
+//! @brief Computes rows of the requested squared and tilted images.
+template<typename T, typename A>
+class extra_rows {
+public:
+    extra_rows(
+        const cv::Mat& src, int channel, const cv::Mat& sum,
+        const cv::Mat& sqsum, const cv::Mat& tilted)
+        : src(src), channel(channel), sum(sum), sqsum(sqsum), tilted(tilted) {
+        if(!tilted.empty()) {
+            right.resize(src.cols + 1);
+            left.resize(src.cols);
+        }
+    }
+
+    //! @brief Computes the row, whose sums are already computed.
+    void operator()(int i, const cv::Range& rows) {
+        if(!sqsum.empty()) {
+            const auto above =
+                i > rows.start ? sqsum.ptr<double>(i - 1) : nullptr;
+            kernel::integrate_sq_row(
+                src.ptr<T>(i) + channel, src.cols, src.channels(), above,
+                sqsum.ptr<double>(i));
+        }
+
+        if(!tilted.empty()) {
+            assert(rows.start == 0);
+            tilted_row(i);
+        }
+    }
+
+private:
+    // Tilted sum is the sum of row prefixes P(r, c) over the rows above:
+    // T(i, j) = sum(P(r, j + i - r) - P(r, j - i + r - 1)). Both terms are
+    // accumulated along the diagonals, so the row is computed from the
+    // previous one: right(i, j) = P(i, j) + right(i - 1, j + 1) and
+    // left(i, j) = P(i, j - 1) + left(i - 1, j - 1). Prefixes beyond the
+    // right edge are the whole rows, so right(i - 1, cols) is the last sum
+    // of the previous row.
+    void tilted_row(int i) {
+        const auto cols = src.cols;
+        const auto row = sum.ptr<A>(i);
+        const auto above = i > 0 ? sum.ptr<A>(i - 1) : nullptr;
+        auto prefix = [row, above](int j) {
+            return above ? row[j] - above[j] : row[j];
+        };
+
+        for(auto j = 0; j < cols; ++j)
+            right[j] = prefix(j) + right[j + 1];
+        right[cols] = row[cols - 1];
+        for(auto j = cols - 1; j > 0; --j)
+            left[j] = prefix(j - 1) + left[j - 1];
 
+        const auto dst = tilted.ptr<A>(i);
+        for(auto j = 0; j < cols; ++j)
+            dst[j] = right[j] - left[j];
+    }
+
+private:
+    cv::Mat src;
+    int channel;
+    cv::Mat sum;
+    cv::Mat sqsum;
+    cv::Mat tilted;
+    std::vector<A> right;
+    std::vector<A> left;
+};
+
+template<typename T, typename A>
+void compute(
+    const cv::Mat& src, cv::Mat& dst, int channel, const cv::Range& rows,
+    extra_rows<T, A>& extra) {
     const auto channels = src.channels();
-    for(auto i = 0; i < src.rows; ++i) {
-        double row_sum = 0.0;
-        const auto src_row = src.ptr<T>(i);
-        const auto dst_row = dst.ptr<double>(i);
-        for(auto j = 0; j < src.cols; ++j) {
-            const auto col = j * channels + channel;
-            const auto value = src_row[col];
-            row_sum += value + last_row[j];
-
-            last_row[j] = value + last_row[j];
-            dst_row[j] = row_sum;
+    std::vector<double> errors;
+    const row_integrator<T, A> integrate(src.total(), src.cols, 1, errors);
+    for(auto i = rows.start; i < rows.end; ++i) {
+        const auto src_row = src.ptr<T>(i) + channel;
+        const auto above = i > rows.start ? dst.ptr<A>(i - 1) : nullptr;
+        integrate(src_row, channels, above, dst.ptr<A>(i), 0);
+        extra(i, rows);
+    }
+}
+
+template<typename T, typename A>
+void compute(
+    const cv::Mat& src, std::vector<cv::Mat>& dst, const cv::Range& rows,
+    std::vector<extra_rows<T, A>>& extras) {
+    const auto channels = src.channels();
+    std::vector<const A*> above(channels);
+    std::vector<A*> dst_rows(channels);
+    std::vector<double> errors;
+    const row_integrator<T, A> integrate(
+        src.total(), src.cols, channels, errors);
+    for(auto i = rows.start; i < rows.end; ++i) {
+        for(auto c = 0; c < channels; ++c) {
+            if(i > rows.start)
+                above[c] = dst[c].ptr<A>(i - 1);
+            dst_rows[c] = dst[c].ptr<A>(i);
         }
+
+        integrate(
+            src.ptr<T>(i), channels, i > rows.start ? above.data() : nullptr,
+            dst_rows.data());
+        for(auto& extra : extras)
+            extra(i, rows);
+    }
+}
+
+/** @brief Returns first changed column of each row.
+
+Rows without changes contain the number of columns.
+*/
+std::vector<int> dirty_columns(
+    const cv::Size& size, const std::vector<cv::Rect>& dirty) {
+    std::vector<int> columns(size.height, size.width);
+    for(const auto& rect : dirty) {
+        const auto clipped = rect & cv::Rect(0, 0, size.width, size.height);
+        if(clipped.area() > 0)
+            columns[clipped.y] = std::min(columns[clipped.y], clipped.x);
+    }
+
+    // changes spread to all the rows below
+    for(auto i = 1; i < size.height; ++i)
+        columns[i] = std::min(columns[i], columns[i - 1]);
+    return columns;
+}
+
+//! @brief Adds unchanged part of the row to the recomputed one.
+template<typename A>
+void add_prefix(A* dst, const A* above, int begin, int cols) {
+    const auto prefix = above ? dst[begin - 1] - above[begin - 1]
+                              : dst[begin - 1];
+    for(auto j = begin; j < cols; ++j)
+        dst[j] += prefix;
+}
+
+template<typename T, typename A>
+void recompute(
+    const cv::Mat& src, cv::Mat& dst, cv::Mat& sqsum, int channel,
+    const std::vector<int>& columns) {
+    const auto channels = src.channels();
+    for(auto i = 0; i < src.rows; ++i) {
+        const auto begin = columns[i];
+        if(begin == src.cols)
+            continue;
+
+        // The changed part of the row is integrated from zero, then the sum
+        // of its unchanged part is added.
+        const auto src_row = src.ptr<T>(i) + channel + begin * channels;
+        const auto cols = src.cols - begin;
+        const auto above = i > 0 ? dst.ptr<A>(i - 1) : nullptr;
+        const auto dst_row = dst.ptr<A>(i);
+        kernel::integrate_row(
+            src_row, cols, channels, above ? above + begin : nullptr,
+            dst_row + begin);
+        if(begin > 0)
+            add_prefix(dst_row, above, begin, src.cols);
+
+        if(sqsum.empty())
+            continue;
+
+        const auto sq_above = i > 0 ? sqsum.ptr<double>(i - 1) : nullptr;
+        const auto sq_row = sqsum.ptr<double>(i);
+        kernel::integrate_sq_row(
+            src_row, cols, channels, sq_above ? sq_above + begin : nullptr,
+            sq_row + begin);
+        if(begin > 0)
+            add_prefix(sq_row, sq_above, begin, src.cols);
+    }
+}
+
+template<typename A>
+void fix_last_rows(cv::Mat& result, const std::vector<cv::Range>& bands) {
+    for(std::size_t k = 1; k < bands.size(); ++k) {
+        assert(bands[k - 1].end == bands[k].start);
+        const auto carry = result.ptr<A>(bands[k - 1].end - 1);
+        const auto last_row = result.ptr<A>(bands[k].end - 1);
+        for(auto j = 0; j < result.cols; ++j)
+            last_row[j] += carry[j];
+    }
+}
+
+template<typename A>
+void add_carry(cv::Mat& result, const cv::Range& rows) {
+    // last row of the band is already fixed by propagate()
+    const auto carry = result.ptr<A>(rows.start - 1);
+    for(auto i = rows.start; i < rows.end - 1; ++i) {
+        const auto dst_row = result.ptr<A>(i);
+        for(auto j = 0; j < result.cols; ++j)
+            dst_row[j] += carry[j];
     }
 }
 
 } // namespace
 
+processing_context::processing_context(
+    const std::string& id, const cv::Mat& mat, int channel, accumulator acc,
+    unsigned outputs, cv::MatAllocator* allocator)
+    : id(id), image(mat), channel(channel) {
+    const auto depth = result_depth(mat, acc);
+    if(outputs & output::padded) {
+        padded_sum = padded::create(mat.size(), depth, allocator);
+        result = padded::inner(padded_sum);
+    }
+    else {
+        result.allocator = allocator;
+        result.create(mat.size(), depth);
+    }
+    create_outputs(outputs, allocator);
+}
+
+processing_context::processing_context(
+    const std::string& id, const cv::Mat& mat, int channel, cv::Mat result,
+    unsigned outputs, cv::MatAllocator* allocator)
+    : id(id), image(mat), channel(channel), result(result) {
+    // integer result of the wider elements may overflow
+    const auto type = result.type();
+    const auto narrow =
+        max_abs_value(mat.depth()) <= std::numeric_limits<std::int32_t>::max();
+    if(result.size() != mat.size() || (type != CV_32SC1 && type != CV_64FC1)
+       || (type == CV_32SC1 && !narrow)) {
+        std::stringstream error;
+        error << "Unsupported result matrix: " << result.rows << "x"
+              << result.cols << " of type " << type << ";";
+        throw std::invalid_argument(error.str());
+    }
+
+    create_outputs(outputs, allocator);
+}
+
 const std::string& processing_context::get_id() const noexcept {
     return id;
 }
@@ -39,26 +283,145 @@ const cv::Mat& processing_context::get_result() const noexcept {
     return result;
 }
 
+const cv::Mat& processing_context::get_sqsum() const noexcept {
+    return sqsum;
+}
+
+const cv::Mat& processing_context::get_tilted() const noexcept {
+    return tilted;
+}
+
+const cv::Mat& processing_context::get_padded() const noexcept {
+    return padded_sum;
+}
+
+const cv::Mat& processing_context::get_padded_sqsum() const noexcept {
+    return padded_sqsum;
+}
+
 const cv::Mat& processing_context::get_image() const noexcept {
     return image;
 }
 
 void processing_context::execute() {
+    execute(cv::Range(0, image.rows));
+}
+
+void processing_context::execute(const cv::Range& rows) {
     assert(!id.empty());
+    assert(rows.start >= 0 && rows.end <= image.rows);
 
-    switch(image.depth()) {
-    case CV_8U:
-        return compute<std::uint8_t>(image, result, channel);
-    case CV_16U:
-        return compute<std::uint16_t>(image, result, channel);
-    case CV_16S:
-        return compute<std::int16_t>(image, result, channel);
-    default: {
-        std::stringstream error;
-        error << "Unsupported image depth: " << image.depth() << ";";
-        throw std::runtime_error(error.str());
+    dispatch_depths(image.depth(), result.depth(), [&](auto src, auto acc) {
+        using T = type_of<decltype(src)>;
+        using A = type_of<decltype(acc)>;
+        extra_rows<T, A> extra(image, channel, result, sqsum, tilted);
+        compute<T, A>(image, result, channel, rows, extra);
+    });
+}
+
+void processing_context::execute(
+    const std::vector<ptr>& channels, const cv::Range& rows) {
+    assert(!channels.empty());
+    const auto& image = channels.front()->image;
+    assert(channels.size() == static_cast<std::size_t>(image.channels()));
+    assert(rows.start >= 0 && rows.end <= image.rows);
+
+    // cv::Mat headers share the data, so results are filled in-place
+    std::vector<cv::Mat> results;
+    results.reserve(channels.size());
+    for(const auto& context : channels)
+        results.push_back(context->result);
+
+    const auto depth = results.front().depth();
+    dispatch_depths(image.depth(), depth, [&](auto src, auto acc) {
+        using T = type_of<decltype(src)>;
+        using A = type_of<decltype(acc)>;
+        std::vector<extra_rows<T, A>> extras;
+        for(const auto& context : channels)
+            extras.emplace_back(
+                image, context->channel, context->result, context->sqsum,
+                context->tilted);
+        compute<T, A>(image, results, rows, extras);
+    });
+}
+
+void processing_context::propagate(const std::vector<cv::Range>& bands) {
+    assert(tilted.empty() || bands.size() == 1);
+    dispatch_accumulator(result.depth(), [&](auto acc) {
+        fix_last_rows<type_of<decltype(acc)>>(result, bands);
+    });
+    if(!sqsum.empty())
+        fix_last_rows<double>(sqsum, bands);
+}
+
+void processing_context::apply_carry(const cv::Range& rows) {
+    if(rows.start == 0)
+        return;
+
+    dispatch_accumulator(result.depth(), [&](auto acc) {
+        add_carry<type_of<decltype(acc)>>(result, rows);
+    });
+    if(!sqsum.empty())
+        add_carry<double>(sqsum, rows);
+}
+
+void processing_context::update(const std::vector<cv::Rect>& dirty) {
+    if(!tilted.empty()) {
+        execute();
+        return;
     }
+
+    const auto columns = dirty_columns(image.size(), dirty);
+    dispatch_depths(image.depth(), result.depth(), [&](auto src, auto acc) {
+        using T = type_of<decltype(src)>;
+        using A = type_of<decltype(acc)>;
+        recompute<T, A>(image, result, sqsum, channel, columns);
+    });
+}
+
+std::size_t processing_context::update_area(
+    const cv::Size& size, const std::vector<cv::Rect>& dirty) {
+    std::size_t area = 0;
+    for(const auto column : dirty_columns(size, dirty))
+        area += size.width - column;
+    return area;
+}
+
+void processing_context::create_outputs(
+    unsigned outputs, cv::MatAllocator* allocator) {
+    sqsum.allocator = allocator;
+    tilted.allocator = allocator;
+    if((outputs & output::sqsum) && (outputs & output::padded)) {
+        padded_sqsum = padded::create(image.size(), CV_64F, allocator);
+        sqsum = padded::inner(padded_sqsum);
+    }
+    else if(outputs & output::sqsum)
+        sqsum.create(image.size(), CV_64F);
+    if(outputs & output::tilted)
+        tilted.create(image.size(), result.depth());
+}
+
+int processing_context::result_depth(const cv::Mat& mat, accumulator acc) {
+    return result_depth(mat.depth(), mat.total(), acc);
+}
+
+int processing_context::result_depth(
+    int depth, std::size_t total, accumulator acc) {
+    if(acc == accumulator::f64)
+        return CV_64F;
+
+    // Sum of any part of the matrix is bounded by the maximal absolute value
+    // of its elements multiplied by the area.
+    const auto bound = max_abs_value(depth) * total;
+    if(bound <= std::numeric_limits<std::int32_t>::max())
+        return CV_32S;
+    if(acc == accumulator::s32) {
+        std::stringstream error;
+        error << "Sums may overflow 32-bit accumulator: " << total
+              << " elements of depth " << depth << ";";
+        throw std::out_of_range(error.str());
     }
+    return CV_64F;
 }
 
 } // namespace sp
\ No newline at end of file
@@ -6,10 +6,36 @@
 #pragma once
 #include <memory>
 #include <string>
+#include <vector>
 #include "opencv2/imgproc.hpp"
 
 namespace sp {
 
+//! @brief Type of the integral image elements.
+enum class accumulator {
+    //! @brief The narrowest type, which keeps sums of the matrix exact.
+    automatic,
+    //! @brief 32-bit integer, matrices whose sums may overflow it are
+    //! rejected instead of being promoted to double.
+    s32,
+    //! @brief Double, regardless of the matrix.
+    f64
+};
+
+//! @brief Integral images, which may be requested for the channel.
+namespace output {
+enum : unsigned {
+    //! @brief Sums of the elements, always computed.
+    sum = 1 << 0,
+    //! @brief Sums of the squared elements of CV_64F depth.
+    sqsum = 1 << 1,
+    //! @brief Sums of the elements rotated by 45 degrees.
+    tilted = 1 << 2,
+    //! @brief Sums and squared sums are placed inside the padded matrices.
+    padded = 1 << 3
+};
+} // namespace output
+
 /** @brief Incapsulates separated channel data for integral computation.
 
 It is worth mentioning that, manually splitting matrix to several channels
@@ -17,12 +43,49 @@ isn't requred. Instead that channel number for computation can be specified.
 Class ensures thread safety for the case of computation on the same input
 matrix in different threads.
 
+Computation of the single channel may be splitted to several horizontal
+bands of rows, which could be processed in parallel. In that case computation
+is performed in two passes: at first each band is computed independently as
+if it were the top of the image, then last rows of the bands are fixed up in
+order and each band adds the carry row of the preceding band.
+
 Usage example:
 @code
     auto first_channel = processing_context("Lena", LenaMat, 1);
     first_channel.execute();
     const auto& result = first_channel.get_result();
 @endcode
+
+Banded usage example:
+@code
+    auto channel = processing_context("Lena", LenaMat, 0);
+    const std::vector<cv::Range> bands = {{0, 256}, {256, 512}};
+    for(const auto& rows : bands) // may be done in parallel
+        channel.execute(rows);
+    channel.propagate(bands);
+    for(const auto& rows : bands) // may be done in parallel
+        channel.apply_carry(rows);
+@endcode
+
+Contexts of all the channels of the same matrix may be computed together by
+the single pass over the interleaved pixels, see the static execute().
+
+Squared and tilted integral images are computed by the same pass over the
+matrix, row by row after the row of sums. Element (i, j) of the tilted image
+contains the sum over the triangle with the bottom vertex at (i, j): elements
+(r, c) with r <= i and |c - j| <= i - r. Tilted image depends on the whole
+rows above, so it can't be computed by bands.
+
+Sums and squared sums may be computed directly into the zero-bordered
+(H + 1) x (W + 1) matrices with aligned rows, see padded_layout.hpp. Results
+are then the inner views of the padded matrices, so they are used as usual,
+while the padded ones answer region-sum queries without branches.
+Tilted integral image isn't padded.
+
+Matrices of any OpenCV depth are supported. Sums of the integer matrices are
+exact, while floating-point ones are rounded; rows of the large CV_64F
+matrices are summed with compensation of rounding errors, which is restarted
+by each band.
 */
 class processing_context {
 public:
@@ -36,12 +99,69 @@ public:
     @param id Identification for matrix.
     @param mat Input matrix.
     @param channel Channel of image matrix to compute.
+    @param acc Type of the result elements.
+    @param outputs Requested integral images, combination of output values.
+    @param allocator Allocator of the integral images, e.g. sp::buffer_pool,
+    or nullptr for the default one.
+    @throw std::out_of_range In case of s32 accumulator, which may overflow.
     */
     processing_context(
-        const std::string& id, const cv::Mat& mat, int channel = 0)
-        : id(id), image(mat), channel(channel) {
-        result.create(mat.size(), CV_64F);
-    }
+        const std::string& id, const cv::Mat& mat, int channel = 0,
+        accumulator acc = accumulator::f64, unsigned outputs = output::sum,
+        cv::MatAllocator* allocator = nullptr);
+
+    /** @brief Constructs context computing into the preallocated result.
+
+    Result isn't copied, so the integral image may be computed directly into
+    the memory owned by the caller, e.g. into the mapped output file.
+    @param id Identification for matrix.
+    @param mat Input matrix.
+    @param channel Channel of image matrix to compute.
+    @param result Single channel matrix of CV_32S or CV_64F depth and the same
+    size as the input matrix, e.g. the inner view of the padded matrix;
+    CV_32S depth is allowed only for the input matrices of 8-bit and 16-bit
+    depths.
+    @param outputs Requested integral images, combination of output values;
+    padded one applies only to the squared integral image.
+    @param allocator Allocator of the squared and tilted integral images or
+    nullptr for the default one.
+    @throw std::invalid_argument In case of the unsupported result matrix.
+    */
+    processing_context(
+        const std::string& id, const cv::Mat& mat, int channel,
+        cv::Mat result, unsigned outputs = output::sum,
+        cv::MatAllocator* allocator = nullptr);
+
+    /** @brief Returns depth of the result for the matrix and accumulator.
+
+    Integer accumulator is used only if the sum of absolute values of the
+    whole matrix can't overflow it, which is the case of 8-bit matrices up to
+    8M pixels and 16-bit ones up to 32K pixels. Otherwise automatic one is
+    promoted to double, while s32 one is rejected.
+    @param mat Input matrix.
+    @param acc Requested accumulator.
+    @return CV_32S or CV_64F.
+    @throw std::out_of_range In case of s32 accumulator, which may overflow.
+    */
+    static int result_depth(const cv::Mat& mat, accumulator acc);
+
+    /** @brief Returns depth of the result for the matrix, which isn't loaded.
+
+    @param depth Depth of the matrix.
+    @param total Number of the matrix elements per channel.
+    @param acc Requested accumulator.
+    @return CV_32S or CV_64F.
+    @throw std::out_of_range In case of s32 accumulator, which may overflow.
+    */
+    static int result_depth(int depth, std::size_t total, accumulator acc);
+
+    /** @brief Returns number of elements recomputed by update().
+
+    @param size Size of the matrix.
+    @param dirty Changed rectangles of the matrix.
+    */
+    static std::size_t update_area(
+        const cv::Size& size, const std::vector<cv::Rect>& dirty);
 
 public:
     //! @brief Retruns identification of matrix.
@@ -50,20 +170,94 @@ public:
     //! @brief Retruns processed channel number.
     int get_channel() const noexcept;
 
-    //! @brief Retruns computed matrix.
+    //! @brief Retruns computed matrix of CV_32S or CV_64F depth.
     const cv::Mat& get_result() const noexcept;
 
+    //! @brief Retruns squared integral image or empty matrix if not requested.
+    const cv::Mat& get_sqsum() const noexcept;
+
+    //! @brief Retruns tilted integral image or empty matrix if not requested.
+    const cv::Mat& get_tilted() const noexcept;
+
+    //! @brief Retruns padded sums or empty matrix if not requested.
+    const cv::Mat& get_padded() const noexcept;
+
+    //! @brief Retruns padded squared sums or empty matrix if not requested.
+    const cv::Mat& get_padded_sqsum() const noexcept;
+
     //! @brief Retruns original matrix.
     const cv::Mat& get_image() const noexcept;
 
     //! @brief Computes integral image
     void execute();
 
+    /** @brief Computes band-local integral image for the range of rows.
+
+    First pass of the banded computation. Rows of the band are accumulated
+    starting from zero, regardless of the rows above the band.
+    @param rows Range of rows of the band.
+    */
+    void execute(const cv::Range& rows);
+
+    /** @brief Computes band-local integral images for all the channels.
+
+    Each interleaved pixel of the band is read once, instead of once per
+    channel.
+    @param channels Contexts of each channel of the same matrix, ordered by
+    channel number.
+    @param rows Range of rows of the band.
+    */
+    static void execute(
+        const std::vector<ptr>& channels, const cv::Range& rows);
+
+    /** @brief Fixes up last rows of the bands.
+
+    Sequential step between passes of the banded computation. Last row of each
+    band receives the (already fixed) last row of the preceding band, so after
+    that step last rows of all bands contain final values.
+    @param bands Ordered and adjacent bands, covering the whole matrix.
+    @note Tilted integral image requires the single band.
+    */
+    void propagate(const std::vector<cv::Range>& bands);
+
+    /** @brief Adds carry of the preceding band to the band rows.
+
+    Second pass of the banded computation. Doesn't touch the last row of the
+    band, which was fixed by propagate(), so may be called for different bands
+    in parallel.
+    @param rows Range of rows of the band.
+    */
+    void apply_carry(const cv::Range& rows);
+
+    /** @brief Recomputes integral images of the partially changed matrix.
+
+    Results must contain integral images of the matrix before the change, so
+    that is intended for the preallocated results. Element (i, j) depends on
+    the elements above and to the left of it, so only the elements at and
+    below-right of the dirty rectangles are recomputed: row i is recomputed
+    starting from the leftmost column of rectangles starting at or above
+    it, using the unchanged part of the row. Therefore changes near the
+    bottom-right corner cost proportionally to their area. Squared integral
+    image must also be computed before the change by the same context, since
+    the new contexts allocate it uninitialized. Tilted integral image spreads
+    changes to both sides, so it is recomputed entirely.
+    @param dirty Changed rectangles of the matrix.
+    */
+    void update(const std::vector<cv::Rect>& dirty);
+
+private:
+    //! @brief Allocates requested squared and tilted integral images.
+    void create_outputs(unsigned outputs, cv::MatAllocator* allocator);
+
 private:
     std::string id;
     cv::Mat image;
     int channel;
     cv::Mat result;
+    cv::Mat sqsum;
+    cv::Mat tilted;
+    cv::Mat padded_sum;
+    cv::Mat padded_sqsum;
 };
 
 } // namespace sp
\ No newline at end of file
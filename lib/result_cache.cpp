@@ -0,0 +1,244 @@
+#include "result_cache.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+#include <vector>
+#include "boost/filesystem.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace sp {
+namespace {
+
+constexpr std::uint64_t prime1 = 11400714785074694791ull;
+constexpr std::uint64_t prime2 = 14029467366897019727ull;
+constexpr std::uint64_t prime3 = 1609587929392839161ull;
+constexpr std::uint64_t prime4 = 9650029242287828579ull;
+constexpr std::uint64_t prime5 = 2870177450012600261ull;
+
+const char* const extension = ".integral";
+
+std::uint64_t rotl(std::uint64_t x, int bits) {
+    return (x << bits) | (x >> (64 - bits));
+}
+
+template<typename T>
+std::uint64_t read(const unsigned char* src) {
+    T value;
+    std::memcpy(&value, src, sizeof(value));
+    return value;
+}
+
+std::uint64_t mix(std::uint64_t acc, std::uint64_t input) {
+    return rotl(acc + input * prime2, 31) * prime1;
+}
+
+std::uint64_t merge(std::uint64_t acc, std::uint64_t lane) {
+    return (acc ^ mix(0, lane)) * prime1 + prime4;
+}
+
+//! @brief Parses key of the cached file name or returns false.
+bool parse_key(const fs::path& path, std::uint64_t& key) {
+    const auto stem = path.stem().string();
+    if(path.extension() != extension || stem.size() != 16
+       || stem.find_first_not_of("0123456789abcdef") != std::string::npos)
+        return false;
+
+    std::stringstream input(stem);
+    input >> std::hex >> key;
+    return !input.fail();
+}
+
+//! @brief Replaces the file by the hard link or the copy of the source.
+bool place(const fs::path& source, const fs::path& path) {
+    // new file is renamed over the existing one, which may be the link of
+    // the other cached file and mustn't be modified
+    const auto temp = path.parent_path() / fs::unique_path(
+        path.filename().string() + ".%%%%%%%%.tmp");
+    boost::system::error_code error;
+    fs::create_hard_link(source, temp, error);
+    if(error) {
+        error.clear();
+        fs::copy_file(source, temp, error);
+    }
+    if(!error)
+        fs::rename(temp, path, error);
+    if(error) {
+        fs::remove(temp, error);
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+result_cache::result_cache(
+    const std::string& directory, std::uintmax_t max_bytes)
+    : directory(directory), max_bytes(max_bytes) {
+    fs::create_directories(directory);
+
+    struct found {
+        std::time_t time;
+        entry cached;
+    };
+    std::vector<found> files;
+    for(const auto& item : fs::directory_iterator(directory)) {
+        key_t key;
+        const auto& path = item.path();
+        if(!fs::is_regular_file(item.status()) || !parse_key(path, key))
+            continue;
+        files.push_back(
+            {fs::last_write_time(path), {key, fs::file_size(path)}});
+    }
+
+    std::sort(files.begin(), files.end(), [](const auto& a, const auto& b) {
+        return a.time < b.time;
+    });
+    for(const auto& file : files) {
+        entries.push_back(file.cached);
+        index[file.cached.key] = std::prev(entries.end());
+        bytes += file.cached.bytes;
+    }
+    evict();
+}
+
+result_cache::key_t result_cache::hash(
+    const void* data, std::size_t bytes, key_t seed) {
+    auto src = static_cast<const unsigned char*>(data);
+    const auto end = src + bytes;
+    std::uint64_t h;
+    if(bytes >= 32) {
+        std::uint64_t lanes[4] = {
+            seed + prime1 + prime2, seed + prime2, seed, seed - prime1};
+        for(; src + 32 <= end; src += 32)
+            for(auto k = 0; k < 4; ++k)
+                lanes[k] = mix(lanes[k], read<std::uint64_t>(src + 8 * k));
+
+        h = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12)
+            + rotl(lanes[3], 18);
+        for(const auto lane : lanes)
+            h = merge(h, lane);
+    }
+    else
+        h = seed + prime5;
+
+    h += bytes;
+    for(; src + 8 <= end; src += 8) {
+        h ^= mix(0, read<std::uint64_t>(src));
+        h = rotl(h, 27) * prime1 + prime4;
+    }
+    if(src + 4 <= end) {
+        h ^= read<std::uint32_t>(src) * prime1;
+        h = rotl(h, 23) * prime2 + prime3;
+        src += 4;
+    }
+    for(; src < end; ++src)
+        h = rotl(h ^ (*src * prime5), 11) * prime1;
+
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+result_cache::key_t result_cache::make_key(
+    const cv::Mat& mat, const std::string& options) {
+    const std::int32_t shape[] = {
+        mat.depth(), mat.rows, mat.cols, mat.channels()};
+    auto key = hash(shape, sizeof(shape));
+    key = hash(options.data(), options.size(), key);
+    const auto row_bytes = mat.cols * mat.elemSize();
+    for(auto i = 0; i < mat.rows; ++i)
+        key = hash(mat.ptr(i), row_bytes, key);
+    return key;
+}
+
+bool result_cache::fetch(key_t key, const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto it = index.find(key);
+    if(it == index.end() || !place(entry_path(key), path)) {
+        // entry whose file is lost is stored anew by the next store()
+        if(it != index.end())
+            erase(it->second);
+        ++misses;
+        return false;
+    }
+
+    ++hits;
+    touch(it->second);
+    return true;
+}
+
+void result_cache::store(key_t key, const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto it = index.find(key);
+    if(it != index.end()) {
+        touch(it->second);
+        return;
+    }
+
+    boost::system::error_code error;
+    const auto size = fs::file_size(path, error);
+    if(error || !place(path, entry_path(key)))
+        return;
+
+    entries.push_back({key, size});
+    index[key] = std::prev(entries.end());
+    bytes += size;
+    touch(index[key]);
+    evict();
+}
+
+std::uintmax_t result_cache::get_size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return bytes;
+}
+
+std::size_t result_cache::get_count() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}
+
+std::size_t result_cache::get_hits() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return hits;
+}
+
+std::size_t result_cache::get_misses() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return misses;
+}
+
+std::string result_cache::entry_path(key_t key) const {
+    std::stringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0') << key
+         << extension;
+    return (fs::path(directory) / name.str()).string();
+}
+
+void result_cache::touch(entries_t::iterator it) {
+    entries.splice(entries.end(), entries, it);
+    boost::system::error_code error;
+    fs::last_write_time(entry_path(it->key), std::time(nullptr), error);
+}
+
+void result_cache::erase(entries_t::iterator it) {
+    boost::system::error_code error;
+    fs::remove(entry_path(it->key), error);
+    bytes -= it->bytes;
+    index.erase(it->key);
+    entries.erase(it);
+}
+
+void result_cache::evict() {
+    while(bytes > max_bytes && !entries.empty())
+        erase(entries.begin());
+}
+
+} // namespace sp
\ No newline at end of file
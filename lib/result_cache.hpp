@@ -0,0 +1,141 @@
+///
+/// \file
+/// Defines the sp::result_cache class, which keeps output files of the
+/// computed images by the hash of their pixels.
+///
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "opencv2/core.hpp"
+
+namespace sp {
+
+/** @brief On-disk cache of the output files keyed by the content of images.
+
+Key is the 64-bit hash of the decoded pixels together with the depth, size,
+number of channels and the options affecting the output, so the same image
+enqueued again, even under the other name, is found before it is computed.
+Cached output is hard linked to the requested path, or copied if the link
+is impossible, e.g. across file systems. Linked outputs share the data with
+the cache, so they must be replaced instead of being rewritten in-place, as
+integral_file and text_writer do.
+
+Cache is bounded by the total size of its files. Least recently used files
+are evicted first; recency is kept in the modification time of the files,
+so it survives between the runs.
+
+Usage example:
+@code
+    result_cache cache("/tmp/integral-cache", 1 << 30);
+    const auto key = result_cache::make_key(image, "binary f64");
+    if(!cache.fetch(key, "Lena.integral")) {
+        // compute and write Lena.integral
+        cache.store(key, "Lena.integral");
+    }
+@endcode
+*/
+class result_cache {
+public:
+    using key_t = std::uint64_t;
+
+public:
+    /** @brief Opens cache in the directory, creating it if needed.
+
+    @param directory Directory of the cached files, owned by the cache.
+    @param max_bytes Maximal total size of the cached files.
+    @throw boost::filesystem::filesystem_error In case of the inaccessible
+    directory.
+    */
+    result_cache(const std::string& directory, std::uintmax_t max_bytes);
+
+    /** @brief Computes 64-bit hash of the bytes.
+
+    The hash is XXH64, which processes four independent lanes of 8 bytes, so
+    it runs at the memory bandwidth. It isn't cryptographic.
+    @param data Hashed bytes.
+    @param bytes Number of the bytes.
+    @param seed Initial value, e.g. the hash of the preceding bytes.
+    */
+    static key_t hash(const void* data, std::size_t bytes, key_t seed = 0);
+
+    /** @brief Returns key of the image and options of its output.
+
+    Rows are hashed one by one, so the key of the submatrix doesn't depend
+    on the matrix it refers to.
+    @param mat Image.
+    @param options Any options affecting the output, e.g. its format.
+    */
+    static key_t make_key(const cv::Mat& mat, const std::string& options);
+
+    /** @brief Places cached output of the key to the path.
+
+    Existing file at the path is replaced.
+    @param key Key of the image.
+    @param path Output file.
+    @return False if the key isn't cached or its file is lost, in that case
+    the entry is forgotten, so the output may be stored again.
+    */
+    bool fetch(key_t key, const std::string& path);
+
+    /** @brief Caches the output file of the key.
+
+    Least recently used files are evicted if the cache exceeds its size.
+    Failure to cache the file isn't reported, since the output is written
+    anyway.
+    @param key Key of the image.
+    @param path Written output file.
+    */
+    void store(key_t key, const std::string& path);
+
+    //! @brief Retruns total size of the cached files.
+    std::uintmax_t get_size() const;
+
+    //! @brief Retruns number of the cached files.
+    std::size_t get_count() const;
+
+    //! @brief Retruns number of the successful fetches.
+    std::size_t get_hits() const;
+
+    //! @brief Retruns number of the failed fetches.
+    std::size_t get_misses() const;
+
+private:
+    struct entry {
+        key_t key;
+        std::uintmax_t bytes;
+    };
+
+    using entries_t = std::list<entry>;
+
+private:
+    //! @brief Returns path of the cached file of the key.
+    std::string entry_path(key_t key) const;
+
+    //! @brief Marks the entry as the most recently used.
+    void touch(entries_t::iterator it);
+
+    //! @brief Removes file of the entry and forgets the entry.
+    void erase(entries_t::iterator it);
+
+    //! @brief Removes least recently used entries beyond the size.
+    void evict();
+
+private:
+    std::string directory;
+    std::uintmax_t max_bytes;
+
+    mutable std::mutex mutex;
+    // least recently used entries are at the front
+    entries_t entries;
+    std::unordered_map<key_t, entries_t::iterator> index;
+    std::uintmax_t bytes = 0;
+    std::size_t hits = 0;
+    std::size_t misses = 0;
+};
+
+} // namespace sp
\ No newline at end of file
@@ -0,0 +1,197 @@
+///
+/// \file
+/// Defines the sp::row_integrator class template, which integrates rows of
+/// the image by kernels suitable for its depth, and dispatching of the image
+/// and accumulator depths to the element types.
+///
+
+#pragma once
+#include <cstdint>
+#include <sstream>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+#include "integral_kernels.hpp"
+#include "opencv2/core.hpp"
+
+namespace sp {
+
+//! @brief Carries type of the matrix element.
+template<typename T>
+struct tag {
+    using type = T;
+};
+
+template<typename T>
+using type_of = typename T::type;
+
+[[noreturn]] inline void unsupported_depth(int depth) {
+    std::stringstream error;
+    error << "Unsupported image depth: " << depth << ";";
+    throw std::runtime_error(error.str());
+}
+
+/** @brief Returns whether the elements are integrated into the accumulator.
+
+Integer accumulator is allowed only for the elements narrower than it, since
+any wider sum may overflow it.
+*/
+template<typename T, typename A>
+constexpr bool is_summable() {
+    return std::is_same<A, double>::value || sizeof(T) < sizeof(A);
+}
+
+namespace detail {
+
+template<typename T, typename A, typename Fn>
+std::enable_if_t<is_summable<T, A>()> invoke(int, Fn& fn) {
+    fn(tag<T>{}, tag<A>{});
+}
+
+template<typename T, typename A, typename Fn>
+std::enable_if_t<!is_summable<T, A>()> invoke(int depth, Fn&) {
+    unsupported_depth(depth);
+}
+
+template<typename T, typename Fn>
+void dispatch_accumulator(int depth, int result_depth, Fn& fn) {
+    switch(result_depth) {
+    case CV_32S:
+        return invoke<T, std::int32_t>(depth, fn);
+    case CV_64F:
+        return invoke<T, double>(depth, fn);
+    default:
+        unsupported_depth(result_depth);
+    }
+}
+
+} // namespace detail
+
+/** @brief Invokes functor with the tags of the element and accumulator types.
+
+@param depth Depth of the image.
+@param result_depth Depth of the integral image, CV_32S or CV_64F.
+@param fn Functor, which accepts tags of the element and accumulator types.
+@throw std::runtime_error In case of the unsupported depths.
+*/
+template<typename Fn>
+void dispatch_depths(int depth, int result_depth, Fn&& fn) {
+    switch(depth) {
+    case CV_8U:
+        return detail::dispatch_accumulator<std::uint8_t>(
+            depth, result_depth, fn);
+    case CV_8S:
+        return detail::dispatch_accumulator<std::int8_t>(
+            depth, result_depth, fn);
+    case CV_16U:
+        return detail::dispatch_accumulator<std::uint16_t>(
+            depth, result_depth, fn);
+    case CV_16S:
+        return detail::dispatch_accumulator<std::int16_t>(
+            depth, result_depth, fn);
+    case CV_32S:
+        return detail::dispatch_accumulator<std::int32_t>(
+            depth, result_depth, fn);
+    case CV_32F:
+        return detail::dispatch_accumulator<float>(depth, result_depth, fn);
+    case CV_64F:
+        return detail::dispatch_accumulator<double>(depth, result_depth, fn);
+    default:
+        unsupported_depth(depth);
+    }
+}
+
+/** @brief Integrates rows of the image from top to bottom.
+
+Rows of the integer images are integrated by the vectorized kernels exactly.
+Rounding errors of the double sums grow with the number of summed elements,
+so rows of the large double images are integrated with compensated
+summation, whose errors are kept between the rows. Float elements have 29
+bits less than their double sums, so the errors of the sums don't reach the
+precision of the elements and float images aren't compensated.
+
+Usage example:
+@code
+    std::vector<double> errors;
+    row_integrator<double, double> integrate(image.total(), cols, 1, errors);
+    for(auto i = 0; i < rows; ++i)
+        integrate(src.ptr<double>(i), 1, i > 0 ? above : nullptr, dst, 0);
+@endcode
+*/
+template<
+    typename T, typename A,
+    bool compensated = std::is_same<T, double>::value>
+class row_integrator {
+public:
+    /** @brief Constructs integrator of the image rows.
+
+    @param total Number of pixels of the whole image.
+    @param cols Number of pixels in the row.
+    @param planes Number of the integrated channels.
+    @param errors Rounding errors of the last integrated rows, kept by the
+    caller while the rows of the same image are integrated.
+    */
+    row_integrator(std::size_t, int cols, int, std::vector<double>&)
+        : cols(cols) {}
+
+    //! @brief Integrates the row of one channel.
+    void operator()(
+        const T* src, int channels, const A* above, A* dst, int) const {
+        kernel::integrate_row(src, cols, channels, above, dst);
+    }
+
+    //! @brief Integrates the row of all the interleaved channels.
+    void operator()(
+        const T* src, int channels, const A* const* above,
+        A* const* dst) const {
+        kernel::integrate_rows(src, cols, channels, above, dst);
+    }
+
+private:
+    int cols;
+};
+
+template<typename T>
+class row_integrator<T, double, true> {
+public:
+    //! @brief Images at least of this number of pixels are compensated.
+    static constexpr std::size_t min_compensated_pixels = 1 << 16;
+
+    row_integrator(
+        std::size_t total, int cols, int planes, std::vector<double>& errors)
+        : cols(cols), compensated(total >= min_compensated_pixels) {
+        if(!compensated)
+            return;
+
+        errors.resize(static_cast<std::size_t>(cols) * planes);
+        for(auto c = 0; c < planes; ++c)
+            error_rows.push_back(errors.data() + c * cols);
+    }
+
+    void operator()(
+        const T* src, int channels, const double* above, double* dst,
+        int plane) const {
+        if(compensated)
+            kernel::integrate_row_compensated(
+                src, cols, channels, above, error_rows[plane], dst);
+        else
+            kernel::integrate_row(src, cols, channels, above, dst);
+    }
+
+    void operator()(
+        const T* src, int channels, const double* const* above,
+        double* const* dst) const {
+        if(compensated)
+            kernel::integrate_rows_compensated(
+                src, cols, channels, above, error_rows.data(), dst);
+        else
+            kernel::integrate_rows(src, cols, channels, above, dst);
+    }
+
+private:
+    int cols;
+    bool compensated;
+    std::vector<double*> error_rows;
+};
+
+} // namespace sp
\ No newline at end of file
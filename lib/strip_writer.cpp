@@ -0,0 +1,93 @@
+#include "strip_writer.hpp"
+
+#include <cstdio>
+#include <stdexcept>
+#include "boost/filesystem.hpp"
+#include "integral_file.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace sp {
+
+strip_writer::strip_writer(
+    const std::string& path, const integral_stream& stream, bool binary)
+    : path(path), size(stream.get_size()), binary(binary) {
+    const auto channels = CV_MAT_CN(stream.get_type());
+    // existing file may be the hard link of the cached output
+    std::remove(path.c_str());
+    outputs.emplace_back(path, std::ios::binary | std::ios::trunc);
+    if(binary) {
+        const auto head = integral_file::make_header(
+            size, channels, CV_MAT_DEPTH(stream.get_type()),
+            stream.get_result_depth());
+        outputs.back().write(
+            reinterpret_cast<const char*>(&head), sizeof(head));
+    }
+    else {
+        for(auto i = 1; i < channels; ++i)
+            outputs.emplace_back(
+                temp_path(i), std::ios::binary | std::ios::trunc);
+    }
+
+    for(const auto& output : outputs)
+        if(!output)
+            failed();
+}
+
+strip_writer::~strip_writer() {
+    boost::system::error_code error;
+    for(auto i = 1u; i < outputs.size(); ++i) {
+        outputs[i].close();
+        fs::remove(temp_path(i), error);
+    }
+}
+
+void strip_writer::write(const std::vector<cv::Mat>& bands, int row) {
+    for(auto i = 0u; i < bands.size(); ++i) {
+        if(!binary) {
+            writer.write(outputs[i], {bands[i]});
+            continue;
+        }
+
+        const auto& band = bands[i];
+        const auto row_bytes = band.cols * band.elemSize();
+        const auto offset = sizeof(integral_file::header)
+            + (static_cast<std::size_t>(size.height) * i + row) * row_bytes;
+        auto& output = outputs.front();
+        output.seekp(static_cast<std::streamoff>(offset));
+        for(auto r = 0; r < band.rows; ++r)
+            output.write(
+                reinterpret_cast<const char*>(band.ptr(r)), row_bytes);
+    }
+}
+
+void strip_writer::close() {
+    auto& output = outputs.front();
+    for(auto i = 1u; i < outputs.size(); ++i) {
+        outputs[i].close();
+        if(!outputs[i])
+            failed();
+
+        std::ifstream input(temp_path(i), std::ios::binary);
+        if(!input)
+            failed();
+        output << "\n" << input.rdbuf();
+        if(!output)
+            failed();
+        input.close();
+        fs::remove(temp_path(i));
+    }
+    output.close();
+    if(!output)
+        failed();
+}
+
+std::string strip_writer::temp_path(int channel) const {
+    return path + "." + std::to_string(channel) + ".tmp";
+}
+
+void strip_writer::failed() const {
+    throw std::runtime_error("Unable to write: " + path + ";");
+}
+
+} // namespace sp
\ No newline at end of file
@@ -0,0 +1,78 @@
+///
+/// \file
+/// Defines the sp::strip_writer class, which writes integral images of the
+/// streamed image strip by strip.
+///
+
+#pragma once
+#include <fstream>
+#include <string>
+#include <vector>
+#include "integral_stream.hpp"
+#include "opencv2/core.hpp"
+#include "text_writer.hpp"
+
+namespace sp {
+
+/** @brief Writes strips of the integral images to the output file.
+
+Binary channels are planar, so each strip is written to its offset in the
+file. Text channels follow each other, so the first one is written to the
+output, and the rest of them to the temporary files appended to the output
+at the end. Temporary files are removed by the destructor as well, so they
+aren't left behind by the failed image.
+
+Usage example:
+@code
+    integral_stream stream(size, CV_8UC3);
+    strip_writer writer("Lena.integral", stream, false);
+    while(reader.read(strip, 256))
+        writer.write(stream.push(strip), stream.get_rows() - strip.rows);
+    writer.close();
+@endcode
+*/
+class strip_writer {
+public:
+    /** @brief Creates output file of the stream.
+
+    @param path Output file, which is replaced.
+    @param stream Stream of the integral images.
+    @param binary Whether to write the binary format instead of the text one.
+    @throw std::runtime_error In case of the failure.
+    */
+    strip_writer(
+        const std::string& path, const integral_stream& stream, bool binary);
+
+    //! @brief Removes temporary files of the text channels.
+    ~strip_writer();
+
+    strip_writer(const strip_writer&) = delete;
+    strip_writer& operator=(const strip_writer&) = delete;
+
+    /** @brief Writes integral images of the strip.
+
+    @param bands Integral images of the strip for each channel.
+    @param row First row of the strip.
+    */
+    void write(const std::vector<cv::Mat>& bands, int row);
+
+    /** @brief Appends text channels to the output and closes it.
+
+    @throw std::runtime_error In case of the failure of any channel.
+    */
+    void close();
+
+private:
+    std::string temp_path(int channel) const;
+
+    [[noreturn]] void failed() const;
+
+private:
+    std::string path;
+    cv::Size size;
+    bool binary;
+    std::vector<std::ofstream> outputs;
+    text_writer writer;
+};
+
+} // namespace sp
\ No newline at end of file
@@ -0,0 +1,155 @@
+#include "summed_volume.hpp"
+
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include "integral_view.hpp"
+
+namespace sp {
+namespace {
+
+//! @brief Adds the integral image of the frame to the previous plane.
+template<typename T>
+void accumulate(const cv::Mat& integral, const cv::Mat* above, cv::Mat& dst) {
+    for(auto i = 0; i < dst.rows; ++i) {
+        const auto src = integral.ptr<T>(i);
+        const auto row = dst.ptr<double>(i);
+        if(!above) {
+            for(auto j = 0; j < dst.cols; ++j)
+                row[j] = src[j];
+            continue;
+        }
+
+        const auto previous = above->ptr<double>(i);
+        for(auto j = 0; j < dst.cols; ++j)
+            row[j] = previous[j] + src[j];
+    }
+}
+
+} // namespace
+
+summed_volume::summed_volume(const cv::Size& size, int channels, int window)
+    : size(size), channels(channels), window(window) {
+    if(window <= 0 || channels <= 0) {
+        std::stringstream error;
+        error << "Unsupported volume: " << channels << " channels of "
+              << window << " frames;";
+        throw std::invalid_argument(error.str());
+    }
+
+    planes.resize(window + 1);
+    for(auto& slot : planes) {
+        slot.resize(channels);
+        for(auto& plane : slot)
+            plane.create(size, CV_64F);
+    }
+}
+
+void summed_volume::push(const cv::Mat& frame) {
+    if(frame.size() != size || frame.channels() != channels) {
+        std::stringstream error;
+        error << "Unexpected frame: " << frame.rows << "x" << frame.cols
+              << " of type " << frame.type() << ";";
+        throw std::invalid_argument(error.str());
+    }
+
+    // integral images are computed directly into the planes of the slot
+    auto& dst = slot(frames);
+    std::vector<processing_context::ptr> tasks;
+    for(auto c = 0; c < channels; ++c)
+        tasks.push_back(
+            std::make_unique<processing_context>("frame", frame, c, dst[c]));
+    processing_context::execute(tasks, cv::Range(0, size.height));
+
+    if(frames > 0) {
+        const auto& above = slot(frames - 1);
+        for(auto c = 0; c < channels; ++c)
+            accumulate<double>(dst[c], &above[c], dst[c]);
+    }
+    ++frames;
+}
+
+void summed_volume::push(const std::vector<cv::Mat>& integrals) {
+    auto valid = integrals.size() == static_cast<std::size_t>(channels);
+    for(const auto& integral : integrals)
+        valid = valid && integral.size() == size
+            && (integral.type() == CV_32SC1 || integral.type() == CV_64FC1);
+    if(!valid) {
+        std::stringstream error;
+        error << "Unexpected integral images of " << integrals.size()
+              << " channels;";
+        throw std::invalid_argument(error.str());
+    }
+
+    auto& dst = slot(frames);
+    const auto above = frames > 0 ? &slot(frames - 1) : nullptr;
+    for(auto c = 0; c < channels; ++c) {
+        const auto previous = above ? &(*above)[c] : nullptr;
+        if(integrals[c].depth() == CV_32S)
+            accumulate<std::int32_t>(integrals[c], previous, dst[c]);
+        else
+            accumulate<double>(integrals[c], previous, dst[c]);
+    }
+    ++frames;
+}
+
+void summed_volume::push(const std::vector<processing_context::ptr>& tasks) {
+    std::vector<cv::Mat> integrals;
+    integrals.reserve(tasks.size());
+    for(const auto& task : tasks)
+        integrals.push_back(task->get_result());
+    push(integrals);
+}
+
+double summed_volume::sum(
+    const cv::Rect& rect, int first, int last, int channel) const {
+    if(first > last || last - first >= window || channel < 0
+       || channel >= channels) {
+        std::stringstream error;
+        error << "Cube is out of the window: frames " << first << ".." << last
+              << " of channel " << channel << ";";
+        throw std::out_of_range(error.str());
+    }
+
+    const auto total = integral_view(get_plane(last, channel)).sum(rect);
+    if(first == 0)
+        return total;
+    return total - integral_view(get_plane(first - 1, channel)).sum(rect);
+}
+
+const cv::Mat& summed_volume::get_plane(int frame, int channel) const {
+    validate(frame);
+    if(channel < 0 || channel >= channels) {
+        std::stringstream error;
+        error << "Channel is out of range: " << channel << ";";
+        throw std::out_of_range(error.str());
+    }
+    return planes[frame % planes.size()][channel];
+}
+
+const cv::Size& summed_volume::get_size() const noexcept {
+    return size;
+}
+
+int summed_volume::get_window() const noexcept {
+    return window;
+}
+
+int summed_volume::get_frames() const noexcept {
+    return frames;
+}
+
+std::vector<cv::Mat>& summed_volume::slot(int frame) {
+    return planes[frame % planes.size()];
+}
+
+void summed_volume::validate(int frame) const {
+    const auto oldest = frames - static_cast<int>(planes.size());
+    if(frame < 0 || frame < oldest || frame >= frames) {
+        std::stringstream error;
+        error << "Frame is out of the window: " << frame << ";";
+        throw std::out_of_range(error.str());
+    }
+}
+
+} // namespace sp
\ No newline at end of file
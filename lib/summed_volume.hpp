@@ -0,0 +1,123 @@
+///
+/// \file
+/// Defines the sp::summed_volume class, which keeps 3D integral images of
+/// the last frames of the video.
+///
+
+#pragma once
+#include <vector>
+#include "opencv2/core.hpp"
+#include "processing_context.hpp"
+
+namespace sp {
+
+/** @brief Summed-volume table over the sliding window of video frames.
+
+Plane of the frame t contains the sums over (x, y, t) boxes from the first
+frame: V(t) = V(t - 1) + I(t), where I(t) is the integral image of the frame.
+Sum of the cube over frames [first, last] is the difference of two planes,
+so it costs two rectangle sums regardless of its duration. Only the planes
+of the last frames of the window are kept in the ring buffer, so the memory
+is bounded by the window length instead of the length of the video.
+
+Frames are pushed in order. Integral images of the frames may be computed
+by the caller, e.g. by sp::integral_computation, whose futures are taken in
+order of the frames, or by the volume itself.
+
+Usage example:
+@code
+    summed_volume volume(size, 3, 16);
+    while(capture.read(frame)) {
+        volume.push(frame);
+        const auto last = volume.get_frames() - 1;
+        const auto motion = volume.sum(box, last - 7, last, 0);
+    }
+@endcode
+@note Planes are of CV_64F depth. Sums of integer frames stay exact while
+they are below 2^53, e.g. for about 3.5 million 4K 8-bit frames.
+*/
+class summed_volume {
+public:
+    /** @brief Constructs empty volume.
+
+    @param size Size of the frames.
+    @param channels Number of channels of the frames.
+    @param window Maximal number of frames of the cube.
+    @throw std::invalid_argument In case of the non-positive window.
+    */
+    summed_volume(const cv::Size& size, int channels, int window);
+
+    /** @brief Appends the frame, computing its integral images.
+
+    Channels are computed by the single pass over the frame directly into
+    the plane, which is then accumulated in-place.
+    @param frame Next frame of any supported depth.
+    @throw std::invalid_argument In case of the frame of the other size or
+    number of channels.
+    */
+    void push(const cv::Mat& frame);
+
+    /** @brief Appends the frame by its integral images.
+
+    @param integrals Integral images of each channel of the frame, of CV_32S
+    or CV_64F depth.
+    @throw std::invalid_argument In case of the integral images of the other
+    size, number or type.
+    */
+    void push(const std::vector<cv::Mat>& integrals);
+
+    /** @brief Appends the frame by its computed tasks.
+
+    @param tasks Tasks of each channel of the frame, e.g. passed to the
+    completion handler of sp::integral_computation.
+    @throw std::invalid_argument In case of the results of the other size,
+    number or type.
+    */
+    void push(const std::vector<processing_context::ptr>& tasks);
+
+    /** @brief Returns sum of the channel over the cube.
+
+    @param rect Rectangle lying inside the frames.
+    @param first Index of the first frame of the cube.
+    @param last Index of the last frame of the cube.
+    @param channel Channel of the frames.
+    @throw std::out_of_range In case of the rectangle outside of the frames or
+    frames outside of the window.
+    */
+    double sum(const cv::Rect& rect, int first, int last, int channel) const;
+
+    /** @brief Retruns plane of the frame.
+
+    @param frame Index of the frame inside the window.
+    @param channel Channel of the frames.
+    @throw std::out_of_range In case of the frame outside of the window.
+    */
+    const cv::Mat& get_plane(int frame, int channel) const;
+
+    //! @brief Retruns size of the frames.
+    const cv::Size& get_size() const noexcept;
+
+    //! @brief Retruns maximal number of frames of the cube.
+    int get_window() const noexcept;
+
+    //! @brief Retruns number of the pushed frames.
+    int get_frames() const noexcept;
+
+private:
+    //! @brief Returns planes of the frame slot.
+    std::vector<cv::Mat>& slot(int frame);
+
+    //! @brief Throws if the frame isn't kept.
+    void validate(int frame) const;
+
+private:
+    cv::Size size;
+    int channels;
+    int window;
+    int frames = 0;
+    // window + 1 slots: the plane before the first frame of the longest cube
+    // is kept as well
+    std::vector<std::vector<cv::Mat>> planes;
+};
+
+} // namespace sp
\ No newline at end of file
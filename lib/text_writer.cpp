@@ -0,0 +1,216 @@
+#include "text_writer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace sp {
+namespace {
+
+//! @brief "%.1f" of the largest double has 309 digits before the point.
+constexpr std::size_t max_value_chars = 320;
+
+//! @brief Whole values below that bound are formatted as integers.
+constexpr double max_integer = 9.2e18;
+
+//! @brief Returns table of two-digit decimal numbers "000102...99".
+const std::array<char, 200>& digit_pairs() {
+    static const auto pairs = [] {
+        std::array<char, 200> result;
+        for(auto i = 0; i < 100; ++i) {
+            result[2 * i] = static_cast<char>('0' + i / 10);
+            result[2 * i + 1] = static_cast<char>('0' + i % 10);
+        }
+        return result;
+    }();
+    return pairs;
+}
+
+//! @brief Formats value backwards, returns pointer to the first digit.
+char* format_unsigned(char* end, std::uint64_t value) {
+    const auto& pairs = digit_pairs();
+    while(value >= 100) {
+        const auto index = static_cast<std::size_t>(value % 100) * 2;
+        value /= 100;
+        *--end = pairs[index + 1];
+        *--end = pairs[index];
+    }
+
+    if(value >= 10) {
+        const auto index = static_cast<std::size_t>(value) * 2;
+        *--end = pairs[index + 1];
+        *--end = pairs[index];
+    }
+    else {
+        *--end = static_cast<char>('0' + value);
+    }
+
+    return end;
+}
+
+} // namespace
+
+text_writer::text_writer(std::size_t buffer_size)
+    : buffer(std::max(buffer_size, 2 * max_value_chars)) {
+}
+
+void text_writer::set_full_precision(bool full) noexcept {
+    full_precision = full;
+}
+
+void text_writer::write(
+    const std::string& path, const std::vector<cv::Mat>& channels) {
+    // existing file may be the hard link of the cached output
+    std::remove(path.c_str());
+    std::ofstream output(path);
+    if(!output) {
+        std::stringstream error;
+        error << "Unable to open for writing: " << path << ";";
+        throw std::runtime_error(error.str());
+    }
+
+    write(output, channels);
+}
+
+void text_writer::write(
+    std::ostream& output, const std::vector<cv::Mat>& channels) {
+    stream = &output;
+    async = nullptr;
+    data = buffer.data();
+    capacity = buffer.size();
+    size = 0;
+    write_channels(channels);
+    flush(true);
+    output.flush();
+}
+
+void text_writer::write(
+    async_writer& output, const std::string& path,
+    const std::vector<cv::Mat>& channels, async_writer::on_close_t on_close) {
+    stream = nullptr;
+    async = &output;
+    file = output.open(path);
+    data = output.acquire();
+    capacity = output.get_buffer_size();
+    size = 0;
+    try {
+        write_channels(channels);
+    }
+    catch(...) {
+        // buffer returns to the pool, and the file is left incomplete
+        size = 0;
+        flush(true);
+        output.close(file);
+        file.reset();
+        throw;
+    }
+
+    flush(true);
+    output.close(file, std::move(on_close));
+    file.reset();
+}
+
+void text_writer::write_channels(const std::vector<cv::Mat>& channels) {
+    std::size_t channel_count = 0;
+    for(const auto& channel : channels)
+        channel_count += channel.channels();
+
+    for(const auto& channel : channels) {
+        for(auto c = 0; c < channel.channels(); ++c) {
+            switch(channel.depth()) {
+            case CV_32S:
+                write_rows<std::int32_t>(channel, c);
+                break;
+            case CV_64F:
+                write_rows<double>(channel, c);
+                break;
+            default: {
+                std::stringstream error;
+                error << "Unsupported result depth: " << channel.depth()
+                      << ";";
+                throw std::runtime_error(error.str());
+            }
+            }
+
+            if(--channel_count)
+                data[size++] = '\n';
+        }
+    }
+}
+
+template<typename T>
+void text_writer::write_rows(const cv::Mat& channel, int index) {
+    const auto cn = channel.channels();
+    for(auto i = 0; i < channel.rows; ++i) {
+        const auto row = channel.ptr<T>(i) + index;
+        for(auto j = 0; j < channel.cols; ++j) {
+            if(capacity - size <= max_value_chars)
+                flush();
+
+            append(static_cast<double>(row[j * cn]));
+            data[size++] = j != channel.cols - 1 ? ' ' : '\n';
+        }
+    }
+}
+
+void text_writer::append(double value) {
+    // Integral images of integer matrices contain whole values only, which
+    // are formatted much faster than by the general floating point routine.
+    // Negative zero isn't whole here to keep its sign.
+    const auto whole = value == std::trunc(value)
+        && std::fabs(value) < max_integer
+        && !(value == 0.0 && std::signbit(value));
+    if(!whole) {
+        const auto rest = capacity - size;
+        const auto written = std::snprintf(
+            data + size, rest, full_precision ? "%.17g" : "%.1f", value);
+        size += std::min(static_cast<std::size_t>(written), rest - 1);
+        return;
+    }
+
+    char digits[24];
+    const auto end = digits + sizeof(digits);
+    const auto magnitude = static_cast<std::uint64_t>(std::fabs(value));
+    auto begin = format_unsigned(end, magnitude);
+    if(value < 0)
+        *--begin = '-';
+
+    const auto length = static_cast<std::size_t>(end - begin);
+    std::memcpy(data + size, begin, length);
+    size += length;
+    data[size++] = '.';
+    data[size++] = '0';
+}
+
+void text_writer::flush(bool last) {
+    if(!async) {
+        stream->write(data, size);
+        size = 0;
+        return;
+    }
+
+    // Direct writes are submitted by whole blocks, so the partial block is
+    // kept aside while the buffer is submitted, since its tail is padded.
+    std::array<char, async_writer::block_size> tail;
+    const auto granularity = async->get_write_granularity();
+    const auto length = last ? size : size / granularity * granularity;
+    const auto rest = size - length;
+    std::memcpy(tail.data(), data + length, rest);
+    async->submit(file, data, length);
+    if(last) {
+        data = nullptr;
+        size = 0;
+        return;
+    }
+
+    data = async->acquire();
+    std::memcpy(data, tail.data(), rest);
+    size = rest;
+}
+
+} // namespace sp
\ No newline at end of file
@@ -0,0 +1,117 @@
+///
+/// \file
+/// Defines the sp::text_writer class, which serializes integral images to
+/// the text format.
+///
+
+#pragma once
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "async_writer.hpp"
+#include "opencv2/core.hpp"
+
+namespace sp {
+
+/** @brief Serializes integral images to the text .integral format.
+
+Each channel is written as rows of values with one digit after the decimal
+point, separated by spaces; channels are separated by the empty line. The
+output is the same as of `std::ostream` with `std::fixed` and
+`std::setprecision(1)`, but whole values are formatted as integers and rows
+are collected in the reusable buffer, which is written by large blocks.
+Values which aren't whole may be written with full precision instead, as
+"%.17g" does, so they are parsed back exactly.
+
+Integral images may be the inner views of the padded ones, see
+padded_layout.hpp. Multi-channel matrices, e.g. interleaved integral images,
+are written channel by channel.
+
+Files may be written by sp::async_writer as well. Then rows are formatted
+directly into the buffers of the async writer, which are written while the
+next ones are formatted, and the file is closed in the background.
+
+Writer isn't thread safe, so each thread should use its own instance.
+
+Usage example:
+@code
+    text_writer writer;
+    std::vector<cv::Mat> channels = {first_channel, second_channel};
+    writer.write("Lena.integral", channels);
+@endcode
+*/
+class text_writer {
+public:
+    /** @brief Constructs writer.
+
+    @param buffer_size Size of the buffer, which is written by one call.
+    */
+    explicit text_writer(std::size_t buffer_size = 1 << 20);
+
+    /** @brief Sets whether values which aren't whole keep full precision.
+
+    Otherwise they are rounded to one digit after the point, which is enough
+    for integral images of the integer matrices only.
+    */
+    void set_full_precision(bool full) noexcept;
+
+    /** @brief Writes channels to the file.
+
+    @param path Output file, which is replaced.
+    @param channels Integral images of CV_32S or CV_64F depth.
+    */
+    void write(const std::string& path, const std::vector<cv::Mat>& channels);
+
+    /** @brief Writes channels to the stream.
+
+    @param output Output stream.
+    @param channels Integral images of CV_32S or CV_64F depth.
+    */
+    void write(std::ostream& output, const std::vector<cv::Mat>& channels);
+
+    /** @brief Writes channels to the file by the async writer.
+
+    Returns once the last buffer is submitted, so the file is complete only
+    when the handler is called.
+    @param output Async writer.
+    @param path Output file, which is replaced.
+    @param channels Integral images of CV_32S or CV_64F depth.
+    @param on_close Handler of the written file.
+    */
+    void write(
+        async_writer& output, const std::string& path,
+        const std::vector<cv::Mat>& channels,
+        async_writer::on_close_t on_close = async_writer::on_close_t());
+
+private:
+    //! @brief Formats all the channels, flushing the buffer when it is full.
+    void write_channels(const std::vector<cv::Mat>& channels);
+
+    //! @brief Formats rows of the channel of the matrix to the buffer.
+    template<typename T>
+    void write_rows(const cv::Mat& channel, int index);
+
+    //! @brief Appends value formatted with the selected precision.
+    void append(double value);
+
+    /** @brief Writes buffer content to the output.
+
+    Content of the async buffer is submitted up to the write granularity,
+    and its remainder is moved to the next buffer, unless it is the last one.
+    */
+    void flush(bool last = false);
+
+private:
+    std::vector<char> buffer;
+    bool full_precision = false;
+    //! @brief Buffer being formatted, either own or of the async writer.
+    char* data = nullptr;
+    std::size_t capacity = 0;
+    std::size_t size = 0;
+    std::ostream* stream = nullptr;
+    async_writer* async = nullptr;
+    async_writer::file_t file;
+};
+
+} // namespace sp
\ No newline at end of file
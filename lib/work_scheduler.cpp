@@ -0,0 +1,148 @@
+#include "work_scheduler.hpp"
+
+#include <algorithm>
+
+namespace sp {
+namespace {
+
+//! @brief Scheduler of the current thread, if it belongs to any.
+thread_local const work_scheduler* current_scheduler = nullptr;
+
+//! @brief Index of the current thread in its scheduler.
+thread_local std::size_t current_index = 0;
+
+} // namespace
+
+work_scheduler::work_scheduler(
+    unsigned int thread_count, const numa_topology* topology) {
+    thread_count = std::max(thread_count, 1u);
+    // threads are spread over the nodes in turn, so the nodes beyond the
+    // number of threads have none
+    const auto node_count = topology
+        ? std::min<std::size_t>(topology->get_nodes().size(), thread_count)
+        : 1;
+    for(std::size_t k = 0; k < node_count; ++k)
+        nodes.emplace_back(std::make_unique<node_workers>());
+    for(auto i = 0u; i < thread_count; ++i) {
+        workers.emplace_back(std::make_unique<worker>());
+        if(topology) {
+            workers.back()->node = topology->thread_node(i);
+            workers.back()->cpu = topology->thread_cpu(i);
+        }
+        nodes[workers.back()->node]->indices.push_back(i);
+    }
+
+    // own queue is the first one, then the queues of the same node in turn
+    for(std::size_t i = 0; i < thread_count; ++i) {
+        auto& victims = workers[i]->victims;
+        for(std::size_t k = 0; k < thread_count; ++k)
+            victims.push_back((i + k) % thread_count);
+        std::stable_partition(
+            victims.begin(), victims.end(), [this, i](std::size_t index) {
+                return workers[index]->node == workers[i]->node;
+            });
+    }
+
+    for(auto i = 0u; i < thread_count; ++i)
+        threads.emplace_back([this, i] { run(i); });
+}
+
+work_scheduler::~work_scheduler() {
+    join();
+}
+
+void work_scheduler::join() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stopping = true;
+    }
+    sleep_cv.notify_all();
+    for(auto& thread : threads)
+        if(thread.joinable())
+            thread.join();
+}
+
+std::size_t work_scheduler::node_count() const noexcept {
+    return nodes.size();
+}
+
+void work_scheduler::push(item_ptr work, priority prio, int node) {
+    // item of the other node goes to its threads in turn, even if it is
+    // posted by the thread of the pool
+    const auto own = current_scheduler == this
+        && (node == any_node
+            || workers[current_index]->node == static_cast<std::size_t>(node));
+    std::size_t index;
+    if(own)
+        index = current_index;
+    else if(node == any_node)
+        index = next.fetch_add(1, std::memory_order_relaxed) % workers.size();
+    else {
+        auto& target = *nodes.at(node);
+        const auto turn = target.next.fetch_add(1, std::memory_order_relaxed);
+        index = target.indices[turn % target.indices.size()];
+    }
+
+    // counter is changed under the lock, so the thread going to sleep can't
+    // miss the item, and before the push, so it can't go below zero
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        ++queued;
+    }
+
+    auto& target = *workers[index];
+    {
+        std::lock_guard<std::mutex> lock(target.mutex);
+        target.queues[static_cast<std::size_t>(prio)].emplace_back(
+            std::move(work));
+    }
+    sleep_cv.notify_one();
+}
+
+work_scheduler::item_ptr work_scheduler::take(std::size_t index) {
+    const auto& victims = workers[index]->victims;
+    for(std::size_t prio = 0; prio < priority_count; ++prio) {
+        for(std::size_t k = 0; k < victims.size(); ++k) {
+            // own queue is the first one
+            auto& victim = *workers[victims[k]];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            auto& queue = victim.queues[prio];
+            if(queue.empty())
+                continue;
+
+            item_ptr work;
+            if(k == 0) {
+                work = std::move(queue.front());
+                queue.pop_front();
+            }
+            else {
+                work = std::move(queue.back());
+                queue.pop_back();
+            }
+            --queued;
+            return work;
+        }
+    }
+
+    return nullptr;
+}
+
+void work_scheduler::run(std::size_t index) {
+    current_scheduler = this;
+    current_index = index;
+    if(workers[index]->cpu >= 0)
+        numa_topology::pin_current_thread(workers[index]->cpu);
+    while(true) {
+        if(auto work = take(index)) {
+            work->run();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        sleep_cv.wait(lock, [this] { return queued > 0 || stopping; });
+        if(stopping && queued == 0)
+            return;
+    }
+}
+
+} // namespace sp
\ No newline at end of file
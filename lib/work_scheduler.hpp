@@ -0,0 +1,156 @@
+///
+/// \file
+/// Defines the sp::work_scheduler class, which runs work items by the pool of
+/// threads stealing work from each other.
+///
+
+#pragma once
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "numa_topology.hpp"
+
+namespace sp {
+
+//! @brief Priority of the matrix processing.
+enum class priority {
+    //! @brief Matrix awaited by the caller, e.g. the thumbnail of the request.
+    latency,
+    //! @brief Matrix of the batch, computed when no latency work is queued.
+    bulk
+};
+
+//! @brief Number of the priority levels.
+constexpr std::size_t priority_count = 2;
+
+/** @brief Thread pool with the work stealing queues.
+
+Each thread has its own queue for each priority. Work items posted by the
+thread of the pool are pushed to its own queue, others are distributed to the
+queues in turn. Thread takes the oldest item of its own queue, and when it is
+empty, steals the newest item of the other queues, so the work of the single
+large matrix spreads over the idle threads while the others keep their own
+matrices. Any latency item is taken before the bulk ones, but the running
+item isn't preempted.
+
+Threads may be pinned to the CPUs of the NUMA topology. Items may be posted
+to the node, so they are distributed to the queues of its threads only,
+e.g. to keep the work of the matrix near its memory. Threads steal from the
+threads of their own node first, and from the remote nodes only when the
+node is out of work.
+
+Usage example:
+@code
+    work_scheduler scheduler(4);
+    scheduler.post([] { std::cout << "done"; }, priority::latency);
+    scheduler.join();
+@endcode
+*/
+class work_scheduler {
+public:
+    //! @brief Node of the items, which may run on any node.
+    static constexpr int any_node = -1;
+
+public:
+    /** @brief Constructs scheduler and starts its threads.
+
+    @param thread_count Number of threads, at least one.
+    @param topology Topology the threads are pinned to, or nullptr to let
+    them float over a single node.
+    */
+    explicit work_scheduler(
+        unsigned int thread_count, const numa_topology* topology = nullptr);
+
+    //! @brief Completes the queued work and stops the threads.
+    ~work_scheduler();
+
+    work_scheduler(const work_scheduler&) = delete;
+    work_scheduler& operator=(const work_scheduler&) = delete;
+
+    /** @brief Queues the work item.
+
+    @param fn Callable without arguments, which may be move-only.
+    @param prio Priority of the item.
+    @param node Index of the node of the topology, whose threads take the
+    item first, or any_node.
+    */
+    template<typename Fn>
+    void post(Fn fn, priority prio, int node = any_node) {
+        push(std::make_unique<item<Fn>>(std::move(fn)), prio, node);
+    }
+
+    //! @brief Retruns number of the nodes, one if the threads aren't pinned.
+    std::size_t node_count() const noexcept;
+
+    /** @brief Completes the queued work and stops the threads.
+
+    Work posted by the running items is completed as well. Posting after the
+    call isn't allowed.
+    */
+    void join();
+
+private:
+    //! @brief Type erased work item.
+    struct work_item {
+        virtual ~work_item() = default;
+        virtual void run() = 0;
+    };
+
+    template<typename Fn>
+    struct item : work_item {
+        explicit item(Fn fn) : fn(std::move(fn)) {
+        }
+
+        void run() override {
+            fn();
+        }
+
+        Fn fn;
+    };
+
+    using item_ptr = std::unique_ptr<work_item>;
+
+    //! @brief Queues of the thread.
+    struct worker {
+        std::mutex mutex;
+        std::array<std::deque<item_ptr>, priority_count> queues;
+        std::size_t node = 0;
+        int cpu = -1;
+        //! @brief Threads to take from, own and same node ones first.
+        std::vector<std::size_t> victims;
+    };
+
+    //! @brief Threads of the node and the turn of the next pushed item.
+    struct node_workers {
+        std::vector<std::size_t> indices;
+        std::atomic<std::size_t> next{0};
+    };
+
+    //! @brief Pushes item to the queue of the current or the next thread.
+    void push(item_ptr work, priority prio, int node);
+
+    //! @brief Takes the item of the highest priority for the thread.
+    item_ptr take(std::size_t index);
+
+    //! @brief Loop of the thread.
+    void run(std::size_t index);
+
+private:
+    std::vector<std::unique_ptr<worker>> workers;
+    std::vector<std::unique_ptr<node_workers>> nodes;
+    std::vector<std::thread> threads;
+    std::atomic<std::size_t> next{0};
+    std::atomic<std::size_t> queued{0};
+
+    std::mutex sleep_mutex;
+    std::condition_variable sleep_cv;
+    bool stopping = false;
+};
+
+} // namespace sp
\ No newline at end of file
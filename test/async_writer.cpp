@@ -0,0 +1,135 @@
+#include "common.hpp"
+
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <thread>
+#include "async_writer.hpp"
+#include "boost/filesystem.hpp"
+#include "text_writer.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace sp {
+namespace test {
+namespace {
+
+std::string read_file(const fs::path& path) {
+    std::ifstream input(path.string(), std::ios::binary);
+    return std::string(
+        std::istreambuf_iterator<char>(input),
+        std::istreambuf_iterator<char>());
+}
+
+//! @brief Parameter is whether writes are synchronous.
+class async_writer_test : public ::testing::TestWithParam<bool> {
+protected:
+    void SetUp() override {
+        directory = fs::temp_directory_path() / fs::unique_path();
+        fs::create_directories(directory);
+    }
+
+    void TearDown() override {
+        fs::remove_all(directory);
+    }
+
+    fs::path directory;
+};
+
+TEST_P(async_writer_test, files_are_written) {
+    async_writer writer(64 << 10, 3, false, GetParam());
+    EXPECT_TRUE(!GetParam() || !writer.is_async());
+
+    // files are written by several threads sharing too few buffers
+    std::atomic<int> closed(0);
+    std::vector<std::string> expect(8);
+    std::vector<std::thread> threads;
+    for(auto t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t] {
+            for(auto i = t; i < 8; i += 4) {
+                const auto path = (directory / std::to_string(i)).string();
+                const auto file = writer.open(path);
+                const auto size = writer.get_buffer_size();
+                for(std::size_t offset = 0; offset < (i + 1) * size / 3;) {
+                    const auto buffer = writer.acquire();
+                    const auto length =
+                        std::min<std::size_t>(size, (i + 1) * 20011);
+                    for(std::size_t j = 0; j < length; ++j) {
+                        const auto letter = (offset + j) % 26;
+                        buffer[j] = static_cast<char>('a' + letter);
+                    }
+                    expect[i].append(buffer, length);
+                    writer.submit(file, buffer, length);
+                    offset += length;
+                }
+                writer.close(file, [&closed](std::exception_ptr error) {
+                    EXPECT_FALSE(error);
+                    ++closed;
+                });
+            }
+        });
+    }
+    for(auto& thread : threads)
+        thread.join();
+    writer.drain();
+
+    EXPECT_EQ(8, closed);
+    for(auto i = 0; i < 8; ++i)
+        ASSERT_EQ(expect[i], read_file(directory / std::to_string(i))) << i;
+}
+
+TEST_P(async_writer_test, text_is_equal) {
+    std::vector<cv::Mat> channels(3);
+    for(auto& channel : channels) {
+        channel.create(200, 300, CV_64FC1);
+        cv::randu(channel, cv::Scalar::all(-1e6), cv::Scalar::all(1e6));
+    }
+    channels[1].convertTo(channels[1], CV_32S);
+    std::stringstream expect;
+    text_writer().write(expect, channels);
+
+    // direct writes submit whole blocks and carry the rest to the next buffer
+    for(const auto direct : {false, true}) {
+        async_writer writer(64 << 10, 2, direct, GetParam());
+        const auto path = directory / "text.integral";
+        auto closed = false;
+        text_writer().write(
+            writer, path.string(), channels, [&](std::exception_ptr error) {
+                EXPECT_FALSE(error);
+                closed = true;
+            });
+        writer.drain();
+        EXPECT_TRUE(closed);
+        ASSERT_EQ(expect.str(), read_file(path)) << direct;
+    }
+}
+
+INSTANTIATE_TEST_CASE_P(
+    modes, async_writer_test, ::testing::Values(false, true));
+
+TEST(async_writer, foreign_buffer_is_rejected) {
+    EXPECT_THROW(async_writer(1 << 20, 0), std::invalid_argument);
+
+    const auto path = fs::temp_directory_path() / fs::unique_path();
+    async_writer writer;
+    EXPECT_EQ(1u << 20, writer.get_buffer_size());
+    const auto file = writer.open(path.string());
+    char buffer[16];
+    EXPECT_THROW(writer.submit(file, buffer, 16), std::invalid_argument);
+    const auto own = writer.acquire();
+    EXPECT_THROW(
+        writer.submit(file, own, writer.get_buffer_size() + 1),
+        std::invalid_argument);
+    std::memcpy(own, "text", 4);
+    writer.submit(file, own, 4);
+    writer.close(file);
+    writer.drain();
+    EXPECT_EQ("text", read_file(path));
+    fs::remove(path);
+}
+
+} // namespace
+} // namespace test
+} // namespace sp
\ No newline at end of file
@@ -0,0 +1,120 @@
+#include "common.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include "box_filter.hpp"
+#include "integral_kernels.hpp"
+#include "processing_context.hpp"
+#include "text_writer.hpp"
+
+namespace sp {
+namespace test {
+namespace {
+
+//! @brief Returns sum, squared sum and area of the clipped window.
+std::array<double, 3> window_stats(
+    const cv::Mat& image, int i, int j, int size) {
+    const auto top = std::max(i - size / 2, 0);
+    const auto bottom = std::min(i - size / 2 + size, image.rows);
+    const auto left = std::max(j - size / 2, 0);
+    const auto right = std::min(j - size / 2 + size, image.cols);
+    double sum = 0;
+    double sqsum = 0;
+    for(auto y = top; y < bottom; ++y)
+        for(auto x = left; x < right; ++x) {
+            const double value = image.at<std::uint8_t>(y, x);
+            sum += value;
+            sqsum += value * value;
+        }
+    return {sum, sqsum, static_cast<double>((bottom - top) * (right - left))};
+}
+
+class box_filter_test : public ::testing::TestWithParam<accumulator> {
+protected:
+    void SetUp() override {
+        image.create(37, 45, CV_8UC1);
+        cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(255));
+        context = std::make_unique<processing_context>(
+            "box", image, 0, GetParam(), output::sum | output::sqsum);
+        context->execute();
+    }
+
+    cv::Mat image;
+    std::unique_ptr<processing_context> context;
+};
+
+TEST_P(box_filter_test, means_and_variances_are_equal) {
+    const auto initial = kernel::current();
+    for(auto level : {kernel::isa::scalar, kernel::isa::avx2}) {
+        kernel::select(level);
+        for(auto size : {1, 4, 7, 40, 64}) {
+            const box_filter filter(size);
+            const auto sums = filter.sum(context->get_result());
+            cv::Mat mean, variance;
+            filter.mean_variance(
+                context->get_result(), context->get_sqsum(), mean, variance);
+            for(auto i = 0; i < image.rows; ++i)
+                for(auto j = 0; j < image.cols; ++j) {
+                    const auto stats = window_stats(image, i, j, size);
+                    const auto expect_mean = stats[0] / stats[2];
+                    const auto expect_variance =
+                        stats[1] / stats[2] - expect_mean * expect_mean;
+                    ASSERT_EQ(stats[0], sums.at<double>(i, j))
+                        << size << ":" << i << ":" << j;
+                    ASSERT_NEAR(expect_mean, mean.at<double>(i, j), 1e-9)
+                        << size << ":" << i << ":" << j;
+                    ASSERT_NEAR(
+                        std::max(expect_variance, 0.0),
+                        variance.at<double>(i, j), 1e-6)
+                        << size << ":" << i << ":" << j;
+                }
+        }
+    }
+    kernel::select(initial);
+}
+
+TEST_P(box_filter_test, text_output_is_exact) {
+    const box_filter filter(5);
+    cv::Mat mean, variance;
+    filter.mean_variance(
+        context->get_result(), context->get_sqsum(), mean, variance);
+    std::stringstream output;
+    text_writer writer;
+    writer.set_full_precision(true);
+    writer.write(output, {mean, variance});
+
+    // values are parsed back as they are, unlike the rounded ones
+    for(const auto& plane : {mean, variance})
+        for(auto i = 0; i < plane.rows; ++i)
+            for(auto j = 0; j < plane.cols; ++j) {
+                double value = 0;
+                ASSERT_TRUE(output >> value);
+                ASSERT_EQ(plane.at<double>(i, j), value) << i << ":" << j;
+            }
+    double extra = 0;
+    EXPECT_FALSE(output >> extra);
+}
+
+INSTANTIATE_TEST_CASE_P(
+    accumulators, box_filter_test,
+    ::testing::Values(accumulator::s32, accumulator::f64));
+
+TEST(box_filter, unsupported_inputs_are_rejected) {
+    EXPECT_THROW(box_filter(0), std::invalid_argument);
+    const box_filter filter(3);
+    EXPECT_EQ(3, filter.get_size());
+    EXPECT_THROW(filter.sum(cv::Mat(4, 4, CV_32FC1)), std::invalid_argument);
+
+    cv::Mat mean, variance;
+    EXPECT_THROW(
+        filter.mean_variance(
+            cv::Mat(4, 4, CV_32SC1), cv::Mat(4, 5, CV_64FC1), mean, variance),
+        std::invalid_argument);
+}
+
+} // namespace
+} // namespace test
+} // namespace sp
\ No newline at end of file
@@ -0,0 +1,97 @@
+#include "common.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include "buffer_pool.hpp"
+#include "integral_processing.hpp"
+#include "opencv2/imgproc.hpp"
+
+namespace sp {
+namespace test {
+namespace {
+
+TEST(buffer_pool, size_class_is_bounded) {
+    for(std::size_t bytes = 1; bytes < (1 << 24); bytes = bytes * 3 / 2 + 1) {
+        const auto size = buffer_pool::size_class(bytes);
+        EXPECT_LE(bytes, size);
+        EXPECT_EQ(0u, size % 64);
+        EXPECT_LE(size, std::max<std::size_t>(64, bytes + bytes / 8 + 64));
+    }
+}
+
+TEST(buffer_pool, buffers_are_recycled) {
+    buffer_pool pool;
+    cv::Mat first;
+    first.allocator = &pool;
+    first.create(100, 300, CV_64F);
+    const auto data = first.data;
+    EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(data) % 64);
+    first.release();
+    EXPECT_EQ(buffer_pool::size_class(100 * 300 * 8), pool.cached_bytes());
+
+    // matrix of the same class takes the released buffer
+    cv::Mat second;
+    second.allocator = &pool;
+    second.create(300, 100, CV_64F);
+    EXPECT_EQ(data, second.data);
+    EXPECT_EQ(1u, pool.system_allocations());
+    EXPECT_EQ(0u, pool.cached_bytes());
+
+    cv::Mat uncached;
+    buffer_pool limited(0);
+    uncached.allocator = &limited;
+    uncached.create(10, 10, CV_32S);
+    uncached.release();
+    EXPECT_EQ(0u, limited.cached_bytes());
+}
+
+TEST(buffer_pool, buffers_stay_on_node) {
+    buffer_pool pool;
+    cv::Mat first;
+    first.allocator = &pool;
+    {
+        buffer_pool::node_scope scope(1);
+        first.create(100, 300, CV_64F);
+    }
+    const auto data = first.data;
+    first.release();
+
+    // buffer of the other node isn't handed out
+    cv::Mat other;
+    other.allocator = &pool;
+    other.create(100, 300, CV_64F);
+    EXPECT_NE(data, other.data);
+    EXPECT_EQ(2u, pool.system_allocations());
+
+    cv::Mat same;
+    same.allocator = &pool;
+    buffer_pool::node_scope scope(1);
+    same.create(300, 100, CV_64F);
+    EXPECT_EQ(data, same.data);
+}
+
+TEST(buffer_pool, executor_reuses_results) {
+    buffer_pool pool;
+    integral_computation executor;
+    executor.set_logging(false);
+    executor.set_buffer_pool(&pool);
+    executor.set_outputs(output::sum | output::sqsum);
+    executor.set_in_flight_limit(1);
+
+    cv::Mat mat(200, 300, CV_8UC3);
+    cv::randu(mat, cv::Scalar::all(0), cv::Scalar::all(255));
+    executor.enqueue_file("first", mat);
+    executor.wait_for_complete();
+    const auto allocations = pool.system_allocations();
+    EXPECT_EQ(6u, allocations);
+
+    // results of the completed matrices are released before the next one
+    for(auto i = 0; i < 8; ++i)
+        executor.enqueue_file(std::to_string(i), mat);
+    executor.wait_for_complete();
+    EXPECT_EQ(allocations, pool.system_allocations());
+}
+
+} // namespace
+} // namespace test
+} // namespace sp
\ No newline at end of file
@@ -0,0 +1,45 @@
+#include "common.hpp"
+
+#include <fstream>
+#include "boost/filesystem.hpp"
+#include "image_decoder.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace sp {
+namespace test {
+namespace {
+
+TEST(image_decoder, image_is_equal) {
+    cv::Mat mat(7, 5, CV_8UC3);
+    cv::randu(mat, cv::Scalar::all(0), cv::Scalar::all(255));
+    const auto path = fs::temp_directory_path() / fs::unique_path("%%%%.ppm");
+    {
+        std::ofstream output(path.string(), std::ios::binary);
+        output << "P6\n" << mat.cols << " " << mat.rows << "\n255\n";
+        output.write(
+            reinterpret_cast<const char*>(mat.data),
+            mat.total() * mat.elemSize());
+    }
+
+    const auto decoded = decode_image(path.string());
+    const auto expect = cv::imread(path.string());
+    fs::remove(path);
+    ASSERT_EQ(expect.size(), decoded.size());
+    ASSERT_EQ(expect.type(), decoded.type());
+    cv::Mat cmp;
+    cv::bitwise_xor(decoded, expect, cmp);
+    EXPECT_EQ(cv::countNonZero(cmp), 0);
+}
+
+TEST(image_decoder, missing_image_is_empty) {
+    const auto path = fs::temp_directory_path() / fs::unique_path();
+    EXPECT_TRUE(decode_image(path.string()).empty());
+    std::ofstream(path.string());
+    EXPECT_TRUE(decode_image(path.string()).empty());
+    fs::remove(path);
+}
+
+} // namespace
+} // namespace test
+} // namespace sp
\ No newline at end of file
@@ -0,0 +1,372 @@
+#include "common.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include "integral_processing.hpp"
+#include "opencv2/imgproc.hpp"
+
+namespace sp {
+namespace test {
+namespace {
+
+cv::Mat make_mat(int rows, int cols, int type) {
+    cv::Mat mat(rows, cols, type);
+    cv::randu(mat, cv::Scalar::all(0), cv::Scalar::all(100));
+    return mat;
+}
+
+TEST(integral_computation, in_flight_is_limited) {
+    constexpr auto limit = 2;
+    constexpr auto count = 16;
+    integral_computation executor(0, 2);
+    executor.set_in_flight_limit(limit);
+
+    // matrix leaves flight after the handler returns, so the number of
+    // enqueued but not completed matrices can't exceed the limit
+    std::atomic<int> completed{0};
+    executor.set_on_complete([&](const auto&) { ++completed; });
+    for(auto i = 0; i < count; ++i) {
+        auto mat = make_mat(64, 64, CV_8UC3);
+        executor.enqueue_file(std::to_string(i), mat);
+        EXPECT_LE(i + 1 - completed, limit);
+    }
+    executor.wait_for_complete();
+
+    EXPECT_EQ(count, completed);
+}
+
+TEST(integral_computation, channels_are_collected) {
+    constexpr auto count = 8;
+    integral_computation executor(0, 2);
+    executor.set_logging(false);
+
+    // channels of the small matrices are completed by the batches, but the
+    // handler receives them ordered
+    std::atomic<int> completed{0};
+    std::atomic<int> misplaced{0};
+    executor.set_on_complete([&](const auto& tasks) {
+        for(auto i = 0u; i < tasks.size(); ++i)
+            if(!tasks[i] || tasks[i]->get_channel() != static_cast<int>(i))
+                ++misplaced;
+        if(tasks.size() == 4)
+            ++completed;
+    });
+    for(auto i = 0; i < count; ++i) {
+        auto mat = make_mat(16, 16, CV_8UC4);
+        executor.enqueue_file(std::to_string(i), mat);
+    }
+    executor.wait_for_complete();
+
+    EXPECT_EQ(count, completed);
+    EXPECT_EQ(0, misplaced);
+}
+
+TEST(integral_computation, executor_is_reusable) {
+    constexpr auto count = 4;
+    integral_computation executor(0, 2);
+    executor.set_logging(false);
+
+    std::atomic<int> completed{0};
+    executor.set_on_complete([&](const auto&) { ++completed; });
+    for(auto round = 1; round <= 2; ++round) {
+        for(auto i = 0; i < count; ++i) {
+            auto mat = make_mat(64, 64, CV_8UC3);
+            executor.enqueue_file(std::to_string(i), mat);
+        }
+        executor.wait_for_complete();
+        EXPECT_EQ(round * count, completed);
+    }
+
+    // own handler of the matrix replaces the common one
+    std::atomic<int> continued{0};
+    executor.submit(
+        "continued", make_mat(64, 64, CV_8UC3),
+        [&](const auto&) { ++continued; });
+    executor.wait_for_complete();
+    EXPECT_EQ(2 * count, completed);
+    EXPECT_EQ(1, continued);
+
+    executor.shutdown();
+    auto mat = make_mat(8, 8, CV_8UC1);
+    EXPECT_THROW(executor.enqueue_file("stopped", mat), std::runtime_error);
+}
+
+TEST(integral_computation, failed_matrix_isnt_completed) {
+    integral_computation executor(0, 2);
+    executor.set_logging(false);
+
+    // elements of the user type fail the computation after the enqueue
+    std::atomic<int> completed{0};
+    std::atomic<int> failed{0};
+    executor.set_on_complete([&](const auto&) { ++completed; });
+    executor.set_on_failure([&](const auto& tasks, std::exception_ptr error) {
+        if(error && tasks.size() == 2 && tasks.front()->get_id() == "user")
+            ++failed;
+    });
+    cv::Mat user(64, 64, CV_MAKETYPE(CV_USRTYPE1, 2));
+    executor.enqueue_file("user", user);
+    auto mat = make_mat(64, 64, CV_8UC3);
+    executor.enqueue_file("supported", mat);
+    executor.wait_for_complete();
+
+    EXPECT_EQ(1, completed);
+    EXPECT_EQ(1, failed);
+}
+
+TEST(integral_computation, submit_is_equal) {
+    constexpr auto producers = 4;
+    constexpr auto count = 8;
+    integral_computation executor(0, 2);
+    executor.set_logging(false);
+    executor.set_in_flight_limit(producers);
+
+    std::atomic<int> mismatched{0};
+    auto produce = [&](int producer) {
+        for(auto i = 0; i < count; ++i) {
+            const auto mat = make_mat(40 + producer, 300, CV_8UC3);
+            auto future = executor.submit(std::to_string(i), mat);
+            const auto tasks = future.get();
+            for(const auto& task : tasks) {
+                processing_context expect("expect", mat, task->get_channel());
+                expect.execute();
+                cv::Mat cmp;
+                cv::bitwise_xor(task->get_result(), expect.get_result(), cmp);
+                if(cv::countNonZero(cmp) != 0)
+                    ++mismatched;
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for(auto i = 0; i < producers; ++i)
+        threads.emplace_back(produce, i);
+    for(auto& thread : threads)
+        thread.join();
+
+    EXPECT_EQ(0, mismatched);
+}
+
+TEST(integral_computation, pinned_is_equal) {
+    integral_computation executor(4, 1, true);
+    executor.set_logging(false);
+
+    // large matrices are banded, small ones are batched
+    std::vector<std::future<integral_computation::task_set_t>> futures;
+    std::vector<cv::Mat> mats;
+    for(auto i = 0; i < 6; ++i) {
+        mats.push_back(i % 2 ? make_mat(16, 16, CV_8UC3)
+                             : make_mat(600, 500, CV_8UC3));
+        futures.push_back(executor.submit(std::to_string(i), mats.back()));
+    }
+
+    for(std::size_t i = 0; i < futures.size(); ++i) {
+        for(const auto& task : futures[i].get()) {
+            processing_context expect("expect", mats[i], task->get_channel());
+            expect.execute();
+            cv::Mat cmp;
+            cv::bitwise_xor(task->get_result(), expect.get_result(), cmp);
+            EXPECT_EQ(cv::countNonZero(cmp), 0) << i;
+        }
+    }
+}
+
+//! @brief Fills rectangles of the matrix with new random values.
+void change(cv::Mat& mat, const std::vector<cv::Rect>& dirty) {
+    for(const auto& rect : dirty) {
+        auto roi = mat(rect);
+        cv::randu(roi, cv::Scalar::all(0), cv::Scalar::all(100));
+    }
+}
+
+void expect_equal(const cv::Mat& result, const cv::Mat& expect) {
+    cv::Mat cmp;
+    cv::bitwise_xor(result, expect, cmp);
+    EXPECT_EQ(cv::countNonZero(cmp), 0);
+}
+
+TEST(integral_computation, update_is_equal) {
+    const std::vector<std::vector<cv::Rect>> dirty_sets = {
+        {{40, 30, 10, 5}},
+        {{60, 50, 30, 20}},
+        {{0, 0, 1, 1}},
+        {{70, 10, 5, 5}, {20, 40, 8, 3}, {85, 65, 5, 5}},
+        {{89, 0, 1, 70}},
+        {},
+    };
+    const accumulator accumulators[] = {accumulator::f64, accumulator::s32};
+    for(const auto acc : accumulators) {
+        for(const auto& dirty : dirty_sets) {
+            auto mat = make_mat(70, 90, CV_8UC3);
+            for(auto i = 0; i < mat.channels(); ++i) {
+                processing_context task("update", mat, i, acc, output::sqsum);
+                task.execute();
+
+                change(mat, dirty);
+                task.update(dirty);
+
+                processing_context expect("expect", mat, i, acc, output::sqsum);
+                expect.execute();
+                expect_equal(task.get_result(), expect.get_result());
+                expect_equal(task.get_sqsum(), expect.get_sqsum());
+            }
+        }
+    }
+}
+
+TEST(integral_computation, update_area_is_staircase) {
+    const cv::Size size(90, 70);
+    EXPECT_EQ(0u, processing_context::update_area(size, {}));
+    EXPECT_EQ(
+        30u * 20u, processing_context::update_area(size, {{60, 50, 30, 20}}));
+    EXPECT_EQ(
+        20u * 20u + 50u * 40u,
+        processing_context::update_area(
+            size, {{70, 0, 5, 5}, {50, 20, 1, 1}, {0, 200, 5, 5}}));
+}
+
+TEST(integral_computation, update_is_enqueued) {
+    // small update is recomputed in-place, large one from scratch
+    const std::vector<std::vector<cv::Rect>> dirty_sets = {
+        {{100, 200, 20, 20}}, {{0, 10, 5, 5}}};
+    for(const auto& dirty : dirty_sets) {
+        auto mat = make_mat(256, 512, CV_8UC3);
+        integral_computation executor;
+        std::vector<cv::Mat> results;
+        executor.set_on_complete([&](const auto& tasks) {
+            for(const auto& task : tasks)
+                results.push_back(task->get_result());
+        });
+        executor.enqueue_file("frame", mat);
+        executor.wait_for_complete();
+
+        integral_computation updater;
+        change(mat, dirty);
+        updater.enqueue_update("frame", mat, results, dirty);
+        updater.wait_for_complete();
+
+        for(auto i = 0; i < mat.channels(); ++i) {
+            processing_context expect("expect", mat, i);
+            expect.execute();
+            expect_equal(results[i], expect.get_result());
+        }
+    }
+}
+
+TEST(integral_computation, update_with_sqsum_is_equal) {
+    auto mat = make_mat(256, 512, CV_8UC3);
+    integral_computation executor;
+    executor.set_outputs(output::sum | output::sqsum);
+    std::vector<cv::Mat> results;
+    std::vector<cv::Mat> sqsums;
+    executor.set_on_complete([&](const auto& tasks) {
+        results.clear();
+        sqsums.clear();
+        for(const auto& task : tasks) {
+            results.push_back(task->get_result());
+            sqsums.push_back(task->get_sqsum());
+        }
+    });
+    executor.enqueue_file("frame", mat);
+    executor.wait_for_complete();
+
+    const std::vector<cv::Rect> dirty = {{100, 200, 20, 20}};
+    change(mat, dirty);
+    executor.enqueue_update("frame", mat, results, dirty);
+    executor.wait_for_complete();
+
+    std::vector<cv::Mat> channels(mat.channels());
+    cv::split(mat, channels);
+    const auto inner = cv::Rect(1, 1, mat.cols, mat.rows);
+    for(auto i = 0; i < mat.channels(); ++i) {
+        cv::Mat sum, sqsum;
+        cv::integral(channels[i], sum, sqsum, CV_64F, CV_64F);
+        expect_equal(results[i], sum(inner));
+        expect_equal(sqsums[i], sqsum(inner));
+    }
+}
+
+TEST(integral_computation, stats_are_collected) {
+    constexpr auto count = 4;
+    integral_computation executor;
+    executor.set_logging(false);
+    executor.get_trace().set_keep_events(true);
+    for(auto i = 0; i < count; ++i) {
+        auto mat = make_mat(64, 64, CV_8UC3);
+        executor.enqueue_file(std::to_string(i), mat);
+    }
+    executor.wait_for_complete();
+
+    const auto stats = executor.get_stats();
+    const auto& stages = stats.stages;
+    EXPECT_EQ(count, stats.images_enqueued);
+    EXPECT_EQ(count, stats.images_completed);
+    EXPECT_EQ(0u, stats.queue_depth);
+    EXPECT_LE(1u, stats.max_queue_depth);
+    // small matrices may be coalesced to the single batch
+    EXPECT_LE(1u, stages[static_cast<int>(stage::compute)].count);
+    EXPECT_EQ(
+        stages[static_cast<int>(stage::compute)].count
+            + stages[static_cast<int>(stage::carry)].count,
+        stages[static_cast<int>(stage::queue)].count);
+    EXPECT_EQ(3 * count, stages[static_cast<int>(stage::merge)].count);
+    EXPECT_EQ(count, stages[static_cast<int>(stage::write)].count);
+    EXPECT_FALSE(stats.thread_busy_ns.empty());
+
+    const auto events = executor.get_trace().get_events();
+    for(const auto& event : events)
+        EXPECT_LE(event.begin, event.end);
+    std::stringstream trace;
+    executor.get_trace().write_chrome_trace(trace);
+    EXPECT_EQ(0u, trace.str().find("{\"traceEvents\":["));
+    EXPECT_NE(std::string::npos, trace.str().find("\"name\":\"compute\""));
+}
+
+TEST(integral_computation, trace_counts_threads) {
+    constexpr auto count = 1000;
+    execution_trace trace;
+    execution_trace other;
+    std::vector<std::thread> threads;
+    for(auto t = 0; t < 4; ++t)
+        threads.emplace_back([&] {
+            for(auto i = 0; i < count; ++i) {
+                const auto begin = execution_trace::clock::now();
+                trace.record(
+                    stage::compute, "id", 0, begin,
+                    begin + std::chrono::nanoseconds(i));
+                // the thread alternates between the traces
+                if(i % 100 == 0)
+                    other.record(stage::carry, "id", 0, begin, begin);
+            }
+        });
+    for(auto& thread : threads)
+        thread.join();
+
+    const auto stats = trace.get_stats();
+    const auto& compute = stats.stages[static_cast<int>(stage::compute)];
+    EXPECT_EQ(4u * count, compute.count);
+    EXPECT_EQ(4 * count * (count - 1) / 2, compute.total_ns);
+    EXPECT_EQ(count - 1, compute.max_ns);
+    EXPECT_EQ(0u, stats.stages[static_cast<int>(stage::carry)].count);
+    EXPECT_EQ(4u, stats.thread_busy_ns.size());
+    for(const auto& thread : stats.thread_busy_ns)
+        EXPECT_EQ(count * (count - 1) / 2, thread.second);
+    EXPECT_EQ(
+        4u * count / 100,
+        other.get_stats().stages[static_cast<int>(stage::carry)].count);
+
+    // events are kept only if requested
+    EXPECT_TRUE(trace.get_events().empty());
+    trace.set_keep_events(true);
+    const auto begin = execution_trace::clock::now();
+    trace.record(stage::write, "id", -1, begin, begin);
+    const auto events = trace.get_events();
+    ASSERT_EQ(1u, events.size());
+    EXPECT_EQ(4u, events[0].thread);
+}
+
+} // namespace
+} // namespace test
+} // namespace sp
\ No newline at end of file
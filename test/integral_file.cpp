@@ -0,0 +1,77 @@
+#include "common.hpp"
+
+#include "boost/filesystem.hpp"
+#include "integral_file.hpp"
+#include "integral_processing.hpp"
+#include "opencv2/imgproc.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace sp {
+namespace test {
+namespace {
+
+class integral_file_test : public ::testing::Test {
+protected:
+    void SetUp() override {
+        path = fs::temp_directory_path() / fs::unique_path();
+    }
+
+    void TearDown() override {
+        fs::remove(path);
+    }
+
+    fs::path path;
+};
+
+TEST_F(integral_file_test, results_are_mapped) {
+    cv::Mat mat(300, 200, CV_16UC3);
+    cv::randu(mat, cv::Scalar::all(0), cv::Scalar::all(65535));
+
+    // results are computed directly into the mapped file
+    std::unique_ptr<integral_file> output;
+    integral_computation executor;
+    executor.set_result_allocator(
+        [&](const auto&, const auto& image, auto depth) {
+            output = std::make_unique<integral_file>(
+                path.string(), image.size(), image.channels(), image.depth(),
+                depth);
+            return output->get_channels();
+        });
+    executor.enqueue_file("mapped", mat);
+    executor.wait_for_complete();
+    output->close();
+
+    const integral_file input(path.string());
+    const auto& header = input.get_header();
+    EXPECT_EQ(CV_16U, header.depth);
+    EXPECT_EQ(mat.rows, header.rows);
+    EXPECT_EQ(mat.cols, header.cols);
+    EXPECT_EQ(mat.channels(), header.channels);
+    EXPECT_EQ(CV_64F, header.result_depth);
+
+    std::vector<cv::Mat> channels(mat.channels());
+    cv::split(mat, channels);
+    for(auto i = 0; i < mat.channels(); ++i) {
+        cv::Mat expect;
+        cv::integral(channels[i], expect, CV_64F);
+        expect = expect(cv::Range(1, mat.rows + 1), cv::Range(1, mat.cols + 1));
+
+        cv::Mat cmp;
+        cv::bitwise_xor(input.get_channel(i), expect, cmp);
+        ASSERT_EQ(cv::countNonZero(cmp), 0) << i;
+    }
+}
+
+TEST_F(integral_file_test, malformed_file_is_rejected) {
+    {
+        integral_file output(path.string(), {4, 4}, 1, CV_8U, CV_32S);
+        output.close();
+    }
+    fs::resize_file(path, sizeof(integral_file::header) + 1);
+    EXPECT_THROW(integral_file{path.string()}, std::runtime_error);
+}
+
+} // namespace
+} // namespace test
+} // namespace sp
\ No newline at end of file
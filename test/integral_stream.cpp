@@ -0,0 +1,224 @@
+#include "common.hpp"
+
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include "boost/filesystem.hpp"
+#include "image_decoder.hpp"
+#include "integral_stream.hpp"
+#include "opencv2/imgproc.hpp"
+#include "pnm_reader.hpp"
+#include "strip_writer.hpp"
+#include "text_writer.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace sp {
+namespace test {
+namespace {
+
+void expect_equal(const cv::Mat& result, const cv::Mat& expect) {
+    cv::Mat cmp;
+    cv::bitwise_xor(result, expect, cmp);
+    EXPECT_EQ(cv::countNonZero(cmp), 0);
+}
+
+TEST(integral_stream, strips_are_equal) {
+    const int types[] = {CV_8UC3, CV_16UC1, CV_16SC2, CV_32FC1};
+    const int strip_rows[] = {1, 7, 64, 100};
+    const accumulator accumulators[] = {
+        accumulator::f64, accumulator::automatic};
+    for(const auto type : types) {
+        cv::Mat mat(100, 70, type);
+        cv::randu(mat, cv::Scalar::all(0), cv::Scalar::all(1000));
+        for(const auto rows : strip_rows) {
+            for(const auto acc : accumulators) {
+                integral_stream stream(mat.size(), mat.type(), acc);
+                std::vector<cv::Mat> results(mat.channels());
+                for(auto& result : results)
+                    result.create(mat.size(), stream.get_result_depth());
+                while(!stream.is_complete()) {
+                    const auto row = stream.get_rows();
+                    const auto end = std::min(row + rows, mat.rows);
+                    const auto& bands = stream.push(mat.rowRange(row, end));
+                    for(auto i = 0; i < mat.channels(); ++i) {
+                        auto dst = results[i].rowRange(row, end);
+                        bands[i].copyTo(dst);
+                    }
+                }
+
+                for(auto i = 0; i < mat.channels(); ++i) {
+                    processing_context expect("expect", mat, i, acc);
+                    expect.execute();
+                    expect_equal(results[i], expect.get_result());
+                }
+            }
+        }
+    }
+}
+
+TEST(integral_stream, outside_strip_is_rejected) {
+    integral_stream stream(cv::Size(10, 4), CV_8UC1);
+    EXPECT_THROW(stream.push(cv::Mat(2, 10, CV_8UC3)), std::invalid_argument);
+    EXPECT_THROW(stream.push(cv::Mat(2, 9, CV_8UC1)), std::invalid_argument);
+    EXPECT_THROW(stream.push(cv::Mat(5, 10, CV_8UC1)), std::invalid_argument);
+    stream.push(cv::Mat(4, 10, CV_8UC1, cv::Scalar::all(1)));
+    EXPECT_TRUE(stream.is_complete());
+}
+
+std::string read_file(const fs::path& path) {
+    std::ifstream input(path.string(), std::ios::binary);
+    return std::string(
+        std::istreambuf_iterator<char>(input),
+        std::istreambuf_iterator<char>());
+}
+
+//! @brief Writes the matrix as binary PGM or PPM, RGB samples MSB first.
+void write_pnm(const fs::path& path, const cv::Mat& mat) {
+    const auto wide = mat.depth() == CV_16U;
+    const auto channels = mat.channels();
+    std::ofstream output(path.string(), std::ios::binary);
+    output << (channels == 1 ? "P5" : "P6") << "\n# scan\n" << mat.cols << " "
+           << mat.rows << "\n" << (wide ? 65535 : 255) << "\n";
+    for(auto i = 0; i < mat.rows; ++i) {
+        for(auto j = 0; j < mat.cols; ++j) {
+            for(auto c = channels - 1; c >= 0; --c) {
+                const auto k = j * channels + c;
+                if(!wide) {
+                    output.put(static_cast<char>(mat.ptr<std::uint8_t>(i)[k]));
+                    continue;
+                }
+                const auto value = mat.ptr<std::uint16_t>(i)[k];
+                output.put(static_cast<char>(value >> 8));
+                output.put(static_cast<char>(value & 0xff));
+            }
+        }
+    }
+}
+
+//! @brief Writes the matrix by strips of the rows.
+void write_strips(
+    const cv::Mat& mat, integral_stream& stream, strip_writer& writer) {
+    while(!stream.is_complete()) {
+        const auto row = stream.get_rows();
+        const auto end = std::min(row + 7, mat.rows);
+        writer.write(stream.push(mat.rowRange(row, end)), row);
+    }
+}
+
+TEST(integral_stream, text_strips_are_written) {
+    cv::Mat mat(30, 20, CV_8UC3);
+    cv::randu(mat, cv::Scalar::all(0), cv::Scalar::all(255));
+    const auto path = fs::temp_directory_path() / fs::unique_path();
+    integral_stream stream(mat.size(), mat.type());
+    {
+        strip_writer writer(path.string(), stream, false);
+        write_strips(mat, stream, writer);
+        writer.close();
+    }
+
+    std::vector<cv::Mat> channels(mat.channels());
+    cv::split(mat, channels);
+    std::vector<cv::Mat> results;
+    for(const auto& channel : channels) {
+        cv::Mat sum;
+        cv::integral(channel, sum, CV_64F);
+        results.push_back(sum(cv::Rect(1, 1, mat.cols, mat.rows)));
+    }
+    std::stringstream expect;
+    text_writer().write(expect, results);
+    EXPECT_EQ(expect.str(), read_file(path));
+    EXPECT_FALSE(fs::exists(path.string() + ".1.tmp"));
+    EXPECT_FALSE(fs::exists(path.string() + ".2.tmp"));
+    fs::remove(path);
+}
+
+TEST(integral_stream, failed_strips_are_cleaned) {
+    cv::Mat mat(30, 20, CV_8UC2, cv::Scalar::all(3));
+    const auto path = fs::temp_directory_path() / fs::unique_path();
+    const auto temp = path.string() + ".1.tmp";
+    {
+        // image failed before the end leaves no temporary files
+        integral_stream stream(mat.size(), mat.type());
+        strip_writer writer(path.string(), stream, false);
+        writer.write(stream.push(mat.rowRange(0, 10)), 0);
+        EXPECT_TRUE(fs::exists(temp));
+    }
+    EXPECT_FALSE(fs::exists(temp));
+
+    {
+        // lost temporary file fails the output instead of truncating it
+        integral_stream stream(mat.size(), mat.type());
+        strip_writer writer(path.string(), stream, false);
+        write_strips(mat, stream, writer);
+        fs::remove(temp);
+        EXPECT_THROW(writer.close(), std::runtime_error);
+    }
+    const integral_stream other(mat.size(), mat.type());
+    const auto missing = (path / "missing").string();
+    EXPECT_THROW(strip_writer(missing, other, true), std::runtime_error);
+    fs::remove(path);
+}
+
+TEST(integral_stream, pnm_strips_are_read) {
+    // 16-bit RGB samples are stored most significant byte first
+    cv::Mat mat(9, 5, CV_16UC3);
+    cv::randu(mat, cv::Scalar::all(0), cv::Scalar::all(65535));
+    const auto path = fs::temp_directory_path() / fs::unique_path();
+    write_pnm(path, mat);
+
+    ASSERT_TRUE(pnm_reader::is_pnm(path.string()));
+    EXPECT_THROW(
+        pnm_reader(path.string(), cv::IMREAD_GRAYSCALE), std::invalid_argument);
+    pnm_reader reader(path.string(), cv::IMREAD_UNCHANGED);
+    EXPECT_EQ(mat.size(), reader.get_size());
+    EXPECT_EQ(mat.type(), reader.get_type());
+    cv::Mat strip;
+    auto row = 0;
+    while(reader.read(strip, 4)) {
+        expect_equal(strip, mat.rowRange(row, row + strip.rows));
+        row += strip.rows;
+    }
+    EXPECT_EQ(mat.rows, row);
+    fs::remove(path);
+}
+
+TEST(integral_stream, streamed_pnm_is_decoded_equally) {
+    const int types[] = {CV_8UC1, CV_16UC3};
+    for(const auto type : types) {
+        cv::Mat mat(30, 20, type);
+        const auto high = CV_MAT_DEPTH(type) == CV_8U ? 256 : 65536;
+        cv::randu(mat, cv::Scalar::all(0), cv::Scalar::all(high));
+        const auto path = fs::temp_directory_path() / fs::unique_path();
+        const auto output = path.string() + ".integral";
+        write_pnm(path, mat);
+
+        // streamed output is the same as of the whole decoded image
+        const auto image = decode_image(path.string());
+        ASSERT_EQ(CV_8UC3, image.type());
+        std::vector<cv::Mat> results;
+        for(auto i = 0; i < image.channels(); ++i) {
+            processing_context task("decoded", image, i);
+            task.execute();
+            results.push_back(task.get_result().clone());
+        }
+        std::stringstream expect;
+        text_writer().write(expect, results);
+
+        pnm_reader reader(path.string());
+        ASSERT_EQ(image.type(), reader.get_type());
+        integral_stream stream(reader.get_size(), reader.get_type());
+        strip_writer writer(output, stream, false);
+        cv::Mat strip;
+        while(reader.read(strip, 7))
+            writer.write(stream.push(strip), stream.get_rows() - strip.rows);
+        writer.close();
+        EXPECT_EQ(expect.str(), read_file(output)) << type;
+        fs::remove(path);
+        fs::remove(output);
+    }
+}
+
+} // namespace
+} // namespace test
+} // namespace sp
\ No newline at end of file
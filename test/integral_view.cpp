@@ -0,0 +1,97 @@
+#include "common.hpp"
+
+#include <random>
+#include "integral_kernels.hpp"
+#include "integral_view.hpp"
+#include "opencv2/imgproc.hpp"
+#include "processing_context.hpp"
+
+namespace sp {
+namespace test {
+namespace {
+
+class integral_view_test
+    : public ::testing::Test
+    , public ::testing::WithParamInterface<accumulator> {
+protected:
+    void SetUp() override {
+        image.create(97, 131, CV_8UC1);
+        cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(255));
+        cv::integral(image, expect, CV_64F);
+
+        processing_context context("view", image, 0, GetParam());
+        context.execute();
+        result = context.get_result();
+    }
+
+    //! @brief Sum of the rectangle by the exclusive OpenCV integral image.
+    double expect_sum(const cv::Rect& rect) const {
+        const auto x = rect.x, y = rect.y;
+        const auto r = rect.x + rect.width, b = rect.y + rect.height;
+        return expect.at<double>(b, r) - expect.at<double>(y, r)
+            - expect.at<double>(b, x) + expect.at<double>(y, x);
+    }
+
+    std::vector<cv::Rect> random_rects(std::size_t count) const {
+        std::mt19937 engine(42);
+        std::vector<cv::Rect> rects(count);
+        for(auto& rect : rects) {
+            const auto x = engine() % (image.cols + 1);
+            const auto y = engine() % (image.rows + 1);
+            rect.x = static_cast<int>(x);
+            rect.y = static_cast<int>(y);
+            rect.width = static_cast<int>(engine() % (image.cols - x + 1));
+            rect.height = static_cast<int>(engine() % (image.rows - y + 1));
+        }
+        return rects;
+    }
+
+    cv::Mat image;
+    cv::Mat expect;
+    cv::Mat result;
+};
+
+TEST_P(integral_view_test, sum_is_equal) {
+    const integral_view view(result);
+    const cv::Rect rects[] = {
+        {0, 0, image.cols, image.rows}, {0, 0, 1, 1}, {5, 0, 3, 7},
+        {0, 9, 4, 2}, {image.cols - 1, image.rows - 1, 1, 1}, {7, 7, 0, 3},
+    };
+    for(const auto& rect : rects)
+        ASSERT_EQ(expect_sum(rect), view.sum(rect)) << rect;
+
+    const cv::Rect square(10, 20, 4, 5);
+    ASSERT_EQ(expect_sum(square) / square.area(), view.mean(square));
+}
+
+TEST_P(integral_view_test, batch_is_equal) {
+    const integral_view view(result);
+    const auto rects = random_rects(50'003);
+    const auto initial = kernel::current();
+    for(auto level : {kernel::isa::scalar, kernel::isa::avx2}) {
+        kernel::select(level);
+        const auto sums = view.sum(rects);
+        ASSERT_EQ(rects.size(), sums.size());
+        for(std::size_t i = 0; i < rects.size(); ++i)
+            ASSERT_EQ(expect_sum(rects[i]), sums[i]) << rects[i];
+    }
+    kernel::select(initial);
+}
+
+TEST_P(integral_view_test, outside_rect_is_rejected) {
+    const integral_view view(result);
+    EXPECT_THROW(view.sum(cv::Rect(-1, 0, 2, 2)), std::out_of_range);
+    EXPECT_THROW(
+        view.sum(cv::Rect(0, 0, image.cols + 1, 1)), std::out_of_range);
+    EXPECT_THROW(
+        view.sum(std::vector<cv::Rect>{{0, image.rows, 1, 1}}),
+        std::out_of_range);
+}
+
+INSTANTIATE_TEST_CASE_P(
+    , integral_view_test,
+    ::testing::Values(accumulator::s32, accumulator::f64));
+
+} // namespace
+} // namespace test
+} // namespace sp
\ No newline at end of file
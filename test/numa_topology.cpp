@@ -0,0 +1,44 @@
+#include "common.hpp"
+
+#include <stdexcept>
+#include "numa_topology.hpp"
+
+namespace sp {
+namespace test {
+namespace {
+
+TEST(numa_topology, cpu_list_is_parsed) {
+    EXPECT_EQ(
+        std::vector<int>({0, 1, 2, 3, 8, 10, 11}),
+        numa_topology::parse_cpu_list("0-3,8,10-11\n"));
+    EXPECT_TRUE(numa_topology::parse_cpu_list("").empty());
+    EXPECT_THROW(numa_topology::parse_cpu_list("3-1"), std::invalid_argument);
+    EXPECT_THROW(numa_topology::parse_cpu_list("0,,2"), std::invalid_argument);
+    EXPECT_THROW(numa_topology::parse_cpu_list("a-b"), std::invalid_argument);
+}
+
+TEST(numa_topology, threads_are_spread) {
+    const numa_topology topology({{0, {0, 1, 2}}, {1, {4, 5}}});
+    EXPECT_EQ(5u, topology.cpu_count());
+    const int cpus[] = {0, 4, 1, 5, 2, 4};
+    for(std::size_t i = 0; i < 6; ++i) {
+        EXPECT_EQ(i % 2, topology.thread_node(i));
+        EXPECT_EQ(cpus[i], topology.thread_cpu(i));
+    }
+
+    EXPECT_THROW(
+        numa_topology{std::vector<numa_topology::node>()},
+        std::invalid_argument);
+    const std::vector<numa_topology::node> empty_node = {{0, {}}};
+    EXPECT_THROW(numa_topology{empty_node}, std::invalid_argument);
+}
+
+TEST(numa_topology, system_is_detected) {
+    const auto topology = numa_topology::detect();
+    EXPECT_LE(1u, topology.get_nodes().size());
+    EXPECT_LE(topology.get_nodes().size(), topology.cpu_count());
+}
+
+} // namespace
+} // namespace test
+} // namespace sp
\ No newline at end of file
@@ -0,0 +1,125 @@
+#include "common.hpp"
+
+#include <cstdint>
+#include <sstream>
+#include "integral_view.hpp"
+#include "padded_layout.hpp"
+#include "processing_context.hpp"
+#include "text_writer.hpp"
+
+namespace sp {
+namespace test {
+namespace {
+
+bool is_aligned(const cv::Mat& mat) {
+    const auto address = reinterpret_cast<std::uintptr_t>(mat.data);
+    return address % padded::alignment == 0
+        && mat.step[0] % padded::alignment == 0;
+}
+
+template<typename T>
+bool is_bordered(const cv::Mat& table) {
+    const auto cn = table.channels();
+    for(auto j = 0; j < table.cols * cn; ++j)
+        if(table.ptr<T>(0)[j] != 0)
+            return false;
+    for(auto i = 0; i < table.rows; ++i)
+        for(auto c = 0; c < cn; ++c)
+            if(table.ptr<T>(i)[c] != 0)
+                return false;
+    return true;
+}
+
+class padded_layout_test : public ::testing::Test {
+protected:
+    void SetUp() override {
+        image.create(37, 53, CV_8UC3);
+        cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(255));
+        for(auto c = 0; c < image.channels(); ++c) {
+            contexts.push_back(std::make_unique<processing_context>(
+                "padded", image, c, accumulator::automatic,
+                output::sum | output::sqsum | output::padded));
+            plain.push_back(std::make_unique<processing_context>(
+                "plain", image, c, accumulator::automatic, output::sqsum));
+        }
+        processing_context::execute(contexts, cv::Range(0, image.rows));
+        processing_context::execute(plain, cv::Range(0, image.rows));
+    }
+
+    cv::Mat image;
+    std::vector<processing_context::ptr> contexts;
+    std::vector<processing_context::ptr> plain;
+};
+
+TEST_F(padded_layout_test, results_are_inside_border) {
+    for(std::size_t c = 0; c < contexts.size(); ++c) {
+        const auto& table = contexts[c]->get_padded();
+        ASSERT_EQ(CV_32SC1, table.type());
+        EXPECT_EQ(cv::Size(54, 38), table.size());
+        EXPECT_TRUE(is_aligned(table));
+        EXPECT_TRUE(is_bordered<std::int32_t>(table));
+        EXPECT_TRUE(is_aligned(contexts[c]->get_padded_sqsum()));
+        EXPECT_TRUE(is_bordered<double>(contexts[c]->get_padded_sqsum()));
+
+        EXPECT_EQ(table.ptr(1) + table.elemSize(),
+                  contexts[c]->get_result().data);
+        EXPECT_EQ(0, cv::norm(
+            plain[c]->get_result(), contexts[c]->get_result(),
+            cv::NORM_INF));
+        EXPECT_EQ(0, cv::norm(
+            plain[c]->get_sqsum(), contexts[c]->get_sqsum(), cv::NORM_INF));
+    }
+
+    EXPECT_TRUE(plain.front()->get_padded().empty());
+}
+
+TEST_F(padded_layout_test, sums_are_equal) {
+    const cv::Rect rects[] = {
+        {0, 0, image.cols, image.rows}, {0, 0, 1, 1}, {5, 0, 3, 7},
+        {0, 9, 4, 2}, {image.cols - 1, image.rows - 1, 1, 1}, {7, 7, 0, 3},
+    };
+
+    std::vector<cv::Mat> results;
+    for(const auto& context : contexts)
+        results.push_back(context->get_result());
+    const auto interleaved = padded::interleave(results);
+    ASSERT_EQ(CV_32SC3, interleaved.type());
+    EXPECT_TRUE(is_aligned(interleaved));
+    EXPECT_TRUE(is_bordered<std::int32_t>(interleaved));
+
+    for(std::size_t c = 0; c < contexts.size(); ++c) {
+        const integral_view view(plain[c]->get_result());
+        const auto& table = contexts[c]->get_padded();
+        for(const auto& rect : rects) {
+            const auto expect = view.sum(rect);
+            EXPECT_EQ(expect, padded::sum<std::int32_t>(table, rect));
+            EXPECT_EQ(
+                expect, padded::sum<std::int32_t>(
+                            interleaved, rect, static_cast<int>(c)));
+        }
+    }
+}
+
+TEST_F(padded_layout_test, text_is_unchanged) {
+    std::vector<cv::Mat> results;
+    for(const auto& context : plain)
+        results.push_back(context->get_result());
+    std::stringstream expect;
+    text_writer().write(expect, results);
+
+    results.clear();
+    for(const auto& context : contexts)
+        results.push_back(context->get_result());
+    std::stringstream planar;
+    text_writer().write(planar, results);
+    EXPECT_EQ(expect.str(), planar.str());
+
+    std::stringstream interleaved;
+    text_writer().write(
+        interleaved, {padded::inner(padded::interleave(results))});
+    EXPECT_EQ(expect.str(), interleaved.str());
+}
+
+} // namespace
+} // namespace test
+} // namespace sp
\ No newline at end of file
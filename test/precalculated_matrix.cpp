@@ -1,9 +1,11 @@
 #include "common.hpp"
 
+#include <iomanip>
 #include <iostream>
 
 #include "boost/filesystem.hpp"
 #include "integral_processing.hpp"
+#include "text_writer.hpp"
 #include "opencv2/imgproc.hpp"
 
 namespace fs = boost::filesystem;
@@ -181,6 +183,32 @@ TEST_P(precalculated_matrix, mat_is_equal) {
     }
 }
 
+TEST_P(precalculated_matrix, text_is_equal) {
+    const auto computed_mats = execute(GetParam());
+    ASSERT_NE(0, computed_mats.size());
+
+    // expected text is formatted by the stream itself
+    std::stringstream expect;
+    expect << std::fixed << std::setprecision(1);
+    for(std::size_t i = 0; i < computed_mats.size(); ++i) {
+        const auto& result = computed_mats[i];
+        for(auto row = 0; row < result.rows; ++row) {
+            for(auto col = 0; col < result.cols; ++col) {
+                expect << result.at<double>(row, col);
+                expect << (col != result.cols - 1 ? " " : "\n");
+            }
+        }
+        if(i != computed_mats.size() - 1)
+            expect << "\n";
+    }
+
+    // small buffer forces several flushes
+    std::stringstream output;
+    text_writer writer(64);
+    writer.write(output, computed_mats);
+    ASSERT_EQ(expect.str(), output.str());
+}
+
 INSTANTIATE_TEST_CASE_P(
     , precalculated_matrix, ::testing::ValuesIn(input_files));
 
@@ -1,7 +1,12 @@
 ﻿#include "common.hpp"
 
+#include <cmath>
+#include <limits>
+#include <stdexcept>
 #include <unordered_map>
+#include "integral_kernels.hpp"
 #include "integral_processing.hpp"
+#include "integral_stream.hpp"
 #include "opencv2/imgproc.hpp"
 
 namespace sp {
@@ -23,6 +28,16 @@ class random_matrix
 public:
     void SetUp() override;
 
+protected:
+    /** @brief Returns whether the computed integral image equals expected.
+
+    Sums of the integer matrices are compared exactly. Floating-point sums
+    and sums beyond 2^53 depend on the order of additions, so they may differ
+    by rounding errors bounded relative to the largest sum.
+    */
+    ::testing::AssertionResult is_equal(
+        const cv::Mat& result, const cv::Mat& expect) const;
+
 protected:
     cv::Mat random_mat;
     cv::Mat integral_mat;
@@ -33,7 +48,11 @@ void random_matrix::SetUp() {
     std::unordered_map<int, int> type_map{
         std::make_pair(CV_8U, CV_8UC(channels)),
         std::make_pair(CV_16U, CV_16UC(channels)),
+        std::make_pair(CV_8S, CV_8SC(channels)),
         std::make_pair(CV_16S, CV_16SC(channels)),
+        std::make_pair(CV_32S, CV_32SC(channels)),
+        std::make_pair(CV_32F, CV_32FC(channels)),
+        std::make_pair(CV_64F, CV_64FC(channels)),
     };
 
     const auto depth = GetParam().depth;
@@ -49,16 +68,41 @@ void random_matrix::SetUp() {
         std::make_pair(1, std::make_pair(cv::Scalar(l), cv::Scalar(h))),
         std::make_pair(2, std::make_pair(cv::Scalar(l, l), cv::Scalar(h, h))),
         std::make_pair(3, std::make_pair(cv::Scalar(l, l, l), cv::Scalar(h, h, h))),
+        std::make_pair(4, std::make_pair(cv::Scalar::all(l), cv::Scalar::all(h))),
     };
     ASSERT_TRUE(!!scalars.count(channels));
     const auto& scalar = scalars[channels];
     cv::randu(random_mat, scalar.first, scalar.second);
 
-    cv::integral(random_mat, integral_mat, CV_64F);
+    // OpenCV doesn't integrate CV_8S and CV_32S matrices, while their
+    // elements are exact in double
+    cv::Mat widened;
+    random_mat.convertTo(widened, CV_64F);
+    cv::integral(widened, integral_mat, CV_64F);
     integral_mat(cv::Range(1, rows + 1), cv::Range(1, cols + 1))
         .copyTo(integral_mat);
 }
 
+::testing::AssertionResult random_matrix::is_equal(
+    const cv::Mat& result, const cv::Mat& expect) const {
+    if(random_mat.depth() < CV_32S) {
+        cv::Mat cmp;
+        cv::bitwise_xor(result, expect, cmp);
+        const auto different = cv::countNonZero(cmp);
+        if(different == 0)
+            return ::testing::AssertionSuccess();
+        return ::testing::AssertionFailure()
+            << different << " elements are different";
+    }
+
+    const auto tolerance = 1e-9 * cv::norm(expect, cv::NORM_INF);
+    const auto difference = cv::norm(result, expect, cv::NORM_INF);
+    if(difference <= tolerance)
+        return ::testing::AssertionSuccess();
+    return ::testing::AssertionFailure()
+        << "difference " << difference << " exceeds " << tolerance;
+}
+
 static const param_t params[] = {
     {10, 10, 1, CV_8U, 0, 100}, //
     {10, 10, 2, CV_8U, 0, 100}, //
@@ -66,6 +110,8 @@ static const param_t params[] = {
     {100, 100, 1, CV_8U, 0, 100}, //
     {100, 100, 2, CV_8U, 0, 100}, //
     {100, 100, 3, CV_8U, 0, 100}, //
+    {150, 100, 2, CV_16U, 0, 65'535}, //
+    {100, 201, 3, CV_16S, -40'000, 40'000}, //
     {1'001, 10'001, 1, CV_16U, 0, 3'400}, //
     {1'001, 10'001, 2, CV_16U, 0, 100}, //
     {1'001, 1'0001, 3, CV_16U, 0, 100}, //
@@ -78,6 +124,17 @@ static const param_t params[] = {
     {4'096, 2'560, 1, CV_16S, -3'000'000, 3'000'000}, //
     {4'096, 2'560, 2, CV_16S, -3'000'000, 3'000'000}, //
     {4'096, 2'560, 3, CV_16S, -3'000'000, 3'000'000}, //
+    {100, 201, 3, CV_8S, -128, 128}, //
+    {37, 45, 4, CV_8U, 0, 256}, //
+    {45, 37, 4, CV_8S, -128, 128}, //
+    {1'001, 1'001, 2, CV_8S, -128, 128}, //
+    {150, 100, 2, CV_32S, -2'000'000'000, 2'000'000'000}, //
+    {1'001, 1'001, 1, CV_32S, -100'000, 100'000}, //
+    {100, 201, 3, CV_32F, -1'000, 1'000}, //
+    {1'001, 1'001, 1, CV_32F, -1'000, 1'000}, //
+    {3'141, 278, 2, CV_32F, 0, 1'000'000}, //
+    {150, 100, 2, CV_64F, -1e9, 1e9}, //
+    {1'001, 1'001, 3, CV_64F, -1, 1}, //
 };
 
 TEST_P(random_matrix, mat_is_equal) {
@@ -99,14 +156,302 @@ TEST_P(random_matrix, mat_is_equal) {
         const auto& result = computed_mats[i];
         const auto& expect = mats_by_channel[i];
 
-        cv::Mat cmp;
-        cv::bitwise_xor(result, expect, cmp);
-        ASSERT_EQ(cv::countNonZero(cmp), 0);
+        ASSERT_TRUE(is_equal(result, expect));
+    }
+}
+
+TEST_P(random_matrix, bands_are_equal) {
+    const auto channels = integral_mat.channels();
+    std::vector<cv::Mat> mats_by_channel(channels);
+    cv::split(integral_mat, mats_by_channel);
+
+    const auto rows = random_mat.rows;
+    const std::vector<cv::Range> bands = {
+        {0, rows / 3}, {rows / 3, rows / 2}, {rows / 2, rows - 1},
+        {rows - 1, rows}};
+    for(auto i = 0; i < channels; ++i) {
+        processing_context task("random", random_mat, i);
+        for(const auto& band : bands)
+            task.execute(band);
+        task.propagate(bands);
+        for(const auto& band : bands)
+            task.apply_carry(band);
+
+        ASSERT_TRUE(is_equal(task.get_result(), mats_by_channel[i])) << i;
+    }
+}
+
+TEST_P(random_matrix, fused_channels_are_equal) {
+    const auto channels = integral_mat.channels();
+    std::vector<cv::Mat> mats_by_channel(channels);
+    cv::split(integral_mat, mats_by_channel);
+
+    std::vector<processing_context::ptr> tasks;
+    for(auto i = 0; i < channels; ++i)
+        tasks.emplace_back(
+            std::make_unique<processing_context>("random", random_mat, i));
+
+    const auto rows = random_mat.rows;
+    const std::vector<cv::Range> bands = {{0, rows / 2}, {rows / 2, rows}};
+    for(const auto& band : bands)
+        processing_context::execute(tasks, band);
+    for(auto i = 0; i < channels; ++i) {
+        tasks[i]->propagate(bands);
+        for(const auto& band : bands)
+            tasks[i]->apply_carry(band);
+
+        ASSERT_TRUE(is_equal(tasks[i]->get_result(), mats_by_channel[i]))
+            << i;
+    }
+}
+
+TEST_P(random_matrix, kernels_are_equal) {
+    const auto channels = integral_mat.channels();
+    std::vector<cv::Mat> mats_by_channel(channels);
+    cv::split(integral_mat, mats_by_channel);
+
+    const kernel::isa levels[] = {
+        kernel::isa::scalar, kernel::isa::sse2, kernel::isa::avx2,
+        kernel::isa::avx512};
+    const accumulator accumulators[] = {
+        accumulator::f64, accumulator::automatic};
+    for(const auto level : levels) {
+        if(level > kernel::detect())
+            break;
+
+        kernel::select(level);
+        for(const auto acc : accumulators) {
+            for(auto i = 0; i < channels; ++i) {
+                processing_context task("random", random_mat, i, acc);
+                task.execute();
+
+                cv::Mat result;
+                task.get_result().convertTo(result, CV_64F);
+                EXPECT_TRUE(is_equal(result, mats_by_channel[i]))
+                    << static_cast<int>(level) << ":" << i;
+            }
+
+            // fused channels are de-interleaved by the kernels
+            std::vector<processing_context::ptr> tasks;
+            for(auto i = 0; i < channels; ++i)
+                tasks.emplace_back(std::make_unique<processing_context>(
+                    "random", random_mat, i, acc));
+            processing_context::execute(tasks, {0, random_mat.rows});
+            for(auto i = 0; i < channels; ++i) {
+                cv::Mat result;
+                tasks[i]->get_result().convertTo(result, CV_64F);
+                EXPECT_TRUE(is_equal(result, mats_by_channel[i]))
+                    << static_cast<int>(level) << ":fused:" << i;
+            }
+        }
+    }
+    kernel::select(kernel::detect());
+}
+
+TEST_P(random_matrix, accumulator_is_exact) {
+    const auto channels = integral_mat.channels();
+    std::vector<cv::Mat> mats_by_channel(channels);
+    cv::split(integral_mat, mats_by_channel);
+
+    integral_computation executor;
+    executor.set_accumulator(accumulator::automatic);
+    std::vector<cv::Mat> computed_mats;
+    executor.set_on_complete([&](const auto& tasks) {
+        for(const auto& task : tasks)
+            computed_mats.push_back(task->get_result());
+    });
+    executor.enqueue_file("random", random_mat);
+    executor.wait_for_complete();
+
+    const auto depth =
+        processing_context::result_depth(random_mat, accumulator::automatic);
+    ASSERT_EQ(integral_mat.channels(), computed_mats.size());
+    for(std::size_t i = 0; i < computed_mats.size(); ++i) {
+        ASSERT_EQ(depth, computed_mats[i].depth());
+
+        cv::Mat result;
+        computed_mats[i].convertTo(result, CV_64F);
+        ASSERT_TRUE(is_equal(result, mats_by_channel[i]));
+    }
+}
+
+TEST_P(random_matrix, s32_accumulator_is_not_promoted) {
+    const auto automatic =
+        processing_context::result_depth(random_mat, accumulator::automatic);
+    if(automatic == CV_32S) {
+        EXPECT_EQ(
+            CV_32S,
+            processing_context::result_depth(random_mat, accumulator::s32));
+        return;
     }
+
+    // matrix which may overflow 32-bit sums is rejected
+    EXPECT_THROW(
+        processing_context("random", random_mat, 0, accumulator::s32),
+        std::out_of_range);
+    EXPECT_THROW(
+        integral_stream(random_mat.size(), random_mat.type(), accumulator::s32),
+        std::out_of_range);
+    integral_computation executor;
+    executor.set_accumulator(accumulator::s32);
+    EXPECT_THROW(
+        executor.enqueue_file("random", random_mat), std::out_of_range);
+    EXPECT_EQ(0u, executor.get_stats().images_enqueued);
 }
 
 INSTANTIATE_TEST_CASE_P(, random_matrix, ::testing::ValuesIn(params));
 
+class small_random_matrix : public random_matrix {};
+
+static const param_t small_params[] = {
+    {10, 10, 1, CV_8U, 0, 100}, //
+    {10, 10, 3, CV_8U, 0, 100}, //
+    {2, 17, 1, CV_8U, 0, 255}, //
+    {23, 1, 2, CV_8U, 0, 255}, //
+    {40, 70, 2, CV_16U, 0, 65'535}, //
+    {70, 40, 3, CV_16S, -40'000, 40'000}, //
+    {10, 10, 1, CV_8S, -128, 128}, //
+    {23, 17, 1, CV_32S, -1'000'000, 1'000'000}, //
+    {40, 70, 2, CV_32F, -100, 100}, //
+    {17, 23, 3, CV_64F, -1, 1}, //
+};
+
+TEST_P(small_random_matrix, extra_outputs_are_equal) {
+    cv::Mat widened, sum, sqsum, tilted;
+    random_mat.convertTo(widened, CV_64F);
+    cv::integral(widened, sum, sqsum, tilted, CV_64F, CV_64F);
+
+    // OpenCV integral images have the extra top row and left column
+    const auto rows = cv::Range(1, random_mat.rows + 1);
+    const auto cols = cv::Range(1, random_mat.cols + 1);
+    const auto channels = random_mat.channels();
+    std::vector<cv::Mat> sqsums(channels), tilteds(channels);
+    cv::split(sqsum(rows, cols), sqsums);
+    cv::split(tilted(rows, cols), tilteds);
+
+    const accumulator accumulators[] = {
+        accumulator::f64, accumulator::automatic};
+    for(const auto acc : accumulators) {
+        integral_computation executor;
+        executor.set_accumulator(acc);
+        executor.set_outputs(output::sum | output::sqsum | output::tilted);
+        std::vector<cv::Mat> computed_sqsums, computed_tilteds;
+        executor.set_on_complete([&](const auto& tasks) {
+            for(const auto& task : tasks) {
+                computed_sqsums.push_back(task->get_sqsum());
+                computed_tilteds.push_back(task->get_tilted());
+            }
+        });
+        executor.enqueue_file("random", random_mat);
+        executor.wait_for_complete();
+
+        ASSERT_EQ(channels, computed_sqsums.size());
+        for(auto i = 0; i < channels; ++i) {
+            ASSERT_TRUE(is_equal(computed_sqsums[i], sqsums[i])) << i;
+
+            cv::Mat result;
+            computed_tilteds[i].convertTo(result, CV_64F);
+            ASSERT_TRUE(is_equal(result, tilteds[i])) << i;
+        }
+    }
+}
+
+TEST_P(small_random_matrix, fused_extra_outputs_are_equal) {
+    cv::Mat widened, sum, sqsum, tilted;
+    random_mat.convertTo(widened, CV_64F);
+    cv::integral(widened, sum, sqsum, tilted, CV_64F, CV_64F);
+
+    const auto rows = cv::Range(1, random_mat.rows + 1);
+    const auto cols = cv::Range(1, random_mat.cols + 1);
+    const auto channels = random_mat.channels();
+    std::vector<cv::Mat> sqsums(channels), tilteds(channels);
+    cv::split(sqsum(rows, cols), sqsums);
+    cv::split(tilted(rows, cols), tilteds);
+
+    std::vector<processing_context::ptr> tasks;
+    for(auto i = 0; i < channels; ++i)
+        tasks.emplace_back(std::make_unique<processing_context>(
+            "random", random_mat, i, accumulator::f64,
+            output::sqsum | output::tilted));
+    processing_context::execute(tasks, cv::Range(0, random_mat.rows));
+
+    for(auto i = 0; i < channels; ++i) {
+        ASSERT_TRUE(is_equal(tasks[i]->get_sqsum(), sqsums[i])) << i;
+        ASSERT_TRUE(is_equal(tasks[i]->get_tilted(), tilteds[i])) << i;
+    }
+}
+
+TEST_P(small_random_matrix, sqsum_bands_are_equal) {
+    cv::Mat widened, sum, sqsum;
+    random_mat.convertTo(widened, CV_64F);
+    cv::integral(widened, sum, sqsum, CV_64F, CV_64F);
+
+    const auto channels = random_mat.channels();
+    std::vector<cv::Mat> sqsums(channels);
+    cv::split(
+        sqsum(
+            cv::Range(1, random_mat.rows + 1),
+            cv::Range(1, random_mat.cols + 1)),
+        sqsums);
+
+    const auto rows = random_mat.rows;
+    const std::vector<cv::Range> bands = {{0, rows / 2}, {rows / 2, rows}};
+    for(auto i = 0; i < channels; ++i) {
+        processing_context task(
+            "random", random_mat, i, accumulator::f64, output::sqsum);
+        for(const auto& band : bands)
+            task.execute(band);
+        task.propagate(bands);
+        for(const auto& band : bands)
+            task.apply_carry(band);
+
+        ASSERT_TRUE(is_equal(task.get_sqsum(), sqsums[i])) << i;
+    }
+}
+
+INSTANTIATE_TEST_CASE_P(
+    , small_random_matrix, ::testing::ValuesIn(small_params));
+
+TEST(compensated_summation, kernels_are_identical) {
+    // large enough to be compensated
+    cv::Mat mat(300, 257, CV_64FC1);
+    cv::randu(mat, cv::Scalar::all(-1e6), cv::Scalar::all(1e6));
+
+    std::vector<cv::Mat> results;
+    for(auto level : {kernel::isa::scalar, kernel::isa::avx2}) {
+        if(level > kernel::detect())
+            break;
+        kernel::select(level);
+        processing_context task("compensated", mat, 0);
+        task.execute();
+        results.push_back(task.get_result().clone());
+    }
+    kernel::select(kernel::detect());
+
+    // sums are within few roundings of the wider ones
+    std::vector<long double> column(mat.cols, 0);
+    const auto epsilon = std::numeric_limits<double>::epsilon();
+    for(auto i = 0; i < mat.rows; ++i) {
+        long double row_sum = 0;
+        for(auto j = 0; j < mat.cols; ++j) {
+            row_sum += mat.at<double>(i, j);
+            column[j] += row_sum;
+            const auto expect = static_cast<double>(column[j]);
+            ASSERT_NEAR(
+                expect, results[0].at<double>(i, j),
+                2 * epsilon * std::abs(expect) + 1e-9)
+                << i << ":" << j;
+        }
+    }
+
+    // columns are added by the vector kernel in the same order
+    for(std::size_t k = 1; k < results.size(); ++k) {
+        cv::Mat cmp;
+        cv::bitwise_xor(results[k], results[0], cmp);
+        EXPECT_EQ(0, cv::countNonZero(cmp)) << k;
+    }
+}
+
 } // namespace
 } // namespace test
 } // namespace sp
\ No newline at end of file
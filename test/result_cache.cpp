@@ -0,0 +1,174 @@
+#include "common.hpp"
+
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include "async_writer.hpp"
+#include "boost/filesystem.hpp"
+#include "integral_file.hpp"
+#include "integral_stream.hpp"
+#include "result_cache.hpp"
+#include "strip_writer.hpp"
+#include "text_writer.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace sp {
+namespace test {
+namespace {
+
+class result_cache_test : public ::testing::Test {
+protected:
+    void SetUp() override {
+        root = fs::temp_directory_path() / fs::unique_path();
+        fs::create_directories(root);
+    }
+
+    void TearDown() override {
+        fs::remove_all(root);
+    }
+
+    std::string write(const std::string& name, const std::string& content) {
+        const auto path = (root / name).string();
+        std::ofstream(path, std::ios::binary) << content;
+        return path;
+    }
+
+    std::string read(const std::string& path) {
+        std::ifstream input(path, std::ios::binary);
+        return std::string(
+            std::istreambuf_iterator<char>(input),
+            std::istreambuf_iterator<char>());
+    }
+
+    fs::path root;
+};
+
+TEST(result_cache, hash_is_xxh64) {
+    EXPECT_EQ(0xef46db3751d8e999ull, result_cache::hash("", 0));
+    EXPECT_EQ(0x44bc2cf5ad770999ull, result_cache::hash("abc", 3));
+}
+
+TEST(result_cache, key_depends_on_content) {
+    cv::Mat mat(40, 30, CV_8UC3);
+    cv::randu(mat, cv::Scalar::all(0), cv::Scalar::all(255));
+    const auto key = result_cache::make_key(mat, "text");
+
+    // submatrix with the same pixels has the same key
+    cv::Mat wide(40, 50, CV_8UC3, cv::Scalar::all(0));
+    auto roi = wide.colRange(10, 40);
+    mat.copyTo(roi);
+    EXPECT_EQ(key, result_cache::make_key(roi, "text"));
+
+    EXPECT_NE(key, result_cache::make_key(mat, "binary"));
+    const cv::Mat flat(mat.rows, mat.cols * 3, CV_8UC1, mat.data);
+    EXPECT_NE(key, result_cache::make_key(flat, "text"));
+    auto changed = mat.clone();
+    changed.ptr(39)[89] ^= 1;
+    EXPECT_NE(key, result_cache::make_key(changed, "text"));
+}
+
+TEST_F(result_cache_test, output_is_fetched) {
+    result_cache cache((root / "cache").string(), 1 << 20);
+    const auto output = write("a.integral", "0.0 1.0\n");
+    EXPECT_FALSE(cache.fetch(1, output));
+    cache.store(1, output);
+    EXPECT_EQ(1u, cache.get_count());
+
+    const auto fetched = (root / "b.integral").string();
+    ASSERT_TRUE(cache.fetch(1, fetched));
+    EXPECT_EQ("0.0 1.0\n", read(fetched));
+    EXPECT_EQ(1u, cache.get_hits());
+    EXPECT_EQ(1u, cache.get_misses());
+
+    // rewritten output doesn't change the cached one
+    integral_file(fetched, cv::Size(2, 2), 1, CV_8U, CV_64F).close();
+    ASSERT_TRUE(cache.fetch(1, output));
+    EXPECT_EQ("0.0 1.0\n", read(output));
+
+    // cache is reopened with its entries
+    result_cache reopened((root / "cache").string(), 1 << 20);
+    EXPECT_EQ(1u, reopened.get_count());
+    EXPECT_EQ(cache.get_size(), reopened.get_size());
+}
+
+TEST_F(result_cache_test, writers_replace_fetched_output) {
+    result_cache cache((root / "cache").string(), 1 << 20);
+    const auto content = std::string("0.0 1.0\n");
+    cache.store(1, write("a.integral", content));
+    const auto size = cache.get_size();
+
+    // every writer of the tool replaces the output instead of truncating it
+    const cv::Mat mat(3, 4, CV_8UC2, cv::Scalar::all(1));
+    const std::vector<cv::Mat> channels = {
+        cv::Mat(mat.size(), CV_64F, cv::Scalar::all(2))};
+    const auto fetched = (root / "b.integral").string();
+    const std::vector<std::function<void()>> writers = {
+        [&] {
+            integral_stream stream(mat.size(), mat.type());
+            strip_writer writer(fetched, stream, false);
+            writer.write(stream.push(mat), 0);
+            writer.close();
+        },
+        [&] {
+            integral_stream stream(mat.size(), mat.type());
+            strip_writer writer(fetched, stream, true);
+            writer.write(stream.push(mat), 0);
+            writer.close();
+        },
+        [&] { text_writer().write(fetched, channels); },
+        [&] {
+            async_writer writer;
+            text_writer().write(writer, fetched, channels);
+            writer.drain();
+        },
+        [&] { integral_file(fetched, mat.size(), 2, CV_8U, CV_64F).close(); },
+    };
+    for(std::size_t i = 0; i < writers.size(); ++i) {
+        ASSERT_TRUE(cache.fetch(1, fetched));
+        writers[i]();
+        EXPECT_NE(content, read(fetched)) << i;
+        const auto cached = (root / "c.integral").string();
+        ASSERT_TRUE(cache.fetch(1, cached));
+        EXPECT_EQ(content, read(cached)) << i;
+    }
+    EXPECT_EQ(size, cache.get_size());
+}
+
+TEST_F(result_cache_test, lost_entry_is_stored_again) {
+    result_cache cache((root / "cache").string(), 1 << 20);
+    const auto output = write("a.integral", "0.0 1.0\n");
+    cache.store(1, output);
+    fs::remove_all(root / "cache");
+    fs::create_directories(root / "cache");
+
+    const auto fetched = (root / "b.integral").string();
+    EXPECT_FALSE(cache.fetch(1, fetched));
+    EXPECT_EQ(0u, cache.get_count());
+    EXPECT_EQ(0u, cache.get_size());
+
+    cache.store(1, output);
+    ASSERT_TRUE(cache.fetch(1, fetched));
+    EXPECT_EQ("0.0 1.0\n", read(fetched));
+    EXPECT_EQ(8u, cache.get_size());
+}
+
+TEST_F(result_cache_test, least_recent_is_evicted) {
+    result_cache cache((root / "cache").string(), 25);
+    const auto output = write("out.integral", "");
+    cache.store(1, write("1.integral", std::string(10, '1')));
+    cache.store(2, write("2.integral", std::string(10, '2')));
+    ASSERT_TRUE(cache.fetch(1, output));
+
+    cache.store(3, write("3.integral", std::string(10, '3')));
+    EXPECT_EQ(2u, cache.get_count());
+    EXPECT_EQ(20u, cache.get_size());
+    EXPECT_TRUE(cache.fetch(1, output));
+    EXPECT_FALSE(cache.fetch(2, output));
+    EXPECT_TRUE(cache.fetch(3, output));
+    EXPECT_EQ(std::string(10, '3'), read(output));
+}
+
+} // namespace
+} // namespace test
+} // namespace sp
\ No newline at end of file
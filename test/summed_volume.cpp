@@ -0,0 +1,75 @@
+#include "common.hpp"
+
+#include "integral_processing.hpp"
+#include "summed_volume.hpp"
+
+namespace sp {
+namespace test {
+namespace {
+
+//! @brief Sums the channel over the cube element by element.
+double cube_sum(
+    const std::vector<cv::Mat>& frames, const cv::Rect& rect, int first,
+    int last, int channel) {
+    double sum = 0;
+    for(auto t = first; t <= last; ++t) {
+        const auto channels = frames[t].channels();
+        for(auto i = rect.y; i < rect.y + rect.height; ++i) {
+            const auto row = frames[t].ptr<std::uint8_t>(i);
+            for(auto j = rect.x; j < rect.x + rect.width; ++j)
+                sum += row[j * channels + channel];
+        }
+    }
+    return sum;
+}
+
+TEST(summed_volume, cubes_are_summed) {
+    const cv::Size size(23, 17);
+    std::vector<cv::Mat> frames(7);
+    for(auto& frame : frames) {
+        frame.create(size, CV_8UC2);
+        cv::randu(frame, cv::Scalar::all(0), cv::Scalar::all(255));
+    }
+
+    const cv::Rect rects[] = {{0, 0, 23, 17}, {5, 3, 1, 1}, {7, 2, 10, 14}};
+    summed_volume volume(size, 2, 3);
+    for(auto t = 0; t < static_cast<int>(frames.size()); ++t) {
+        volume.push(frames[t]);
+        for(auto first = std::max(0, t - 2); first <= t; ++first)
+            for(const auto& rect : rects)
+                for(auto c = 0; c < 2; ++c)
+                    EXPECT_EQ(
+                        cube_sum(frames, rect, first, t, c),
+                        volume.sum(rect, first, t, c))
+                        << t << ":" << first << ":" << c;
+    }
+
+    EXPECT_EQ(7, volume.get_frames());
+    EXPECT_THROW(volume.sum(rects[0], 3, 6, 0), std::out_of_range);
+    EXPECT_THROW(volume.sum(rects[0], 2, 4, 0), std::out_of_range);
+    EXPECT_THROW(volume.sum(rects[0], 5, 7, 0), std::out_of_range);
+    EXPECT_THROW(volume.sum(rects[0], 5, 6, 2), std::out_of_range);
+    EXPECT_THROW(volume.push(cv::Mat(size, CV_8UC3)), std::invalid_argument);
+}
+
+TEST(summed_volume, computed_frames_are_pushed) {
+    const cv::Size size(40, 30);
+    summed_volume computed(size, 3, 2);
+    summed_volume pushed(size, 3, 2);
+    integral_computation executor;
+    executor.set_accumulator(accumulator::automatic);
+    for(auto t = 0; t < 4; ++t) {
+        cv::Mat frame(size, CV_8UC3);
+        cv::randu(frame, cv::Scalar::all(0), cv::Scalar::all(255));
+        computed.push(executor.submit("frame", frame).get());
+        pushed.push(frame);
+    }
+
+    const cv::Rect rect(3, 4, 20, 10);
+    for(auto c = 0; c < 3; ++c)
+        EXPECT_EQ(pushed.sum(rect, 2, 3, c), computed.sum(rect, 2, 3, c));
+}
+
+} // namespace
+} // namespace test
+} // namespace sp
\ No newline at end of file
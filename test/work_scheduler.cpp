@@ -0,0 +1,80 @@
+#include "common.hpp"
+
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <vector>
+#include "work_scheduler.hpp"
+
+namespace sp {
+namespace test {
+namespace {
+
+TEST(work_scheduler, items_are_completed) {
+    constexpr auto count = 1000;
+    std::atomic<int> completed{0};
+    {
+        work_scheduler scheduler(4);
+        for(auto i = 0; i < count; ++i) {
+            // items posted by the items are completed by join() as well
+            scheduler.post(
+                [&] {
+                    scheduler.post([&] { ++completed; }, priority::bulk);
+                    ++completed;
+                },
+                i % 2 ? priority::latency : priority::bulk);
+        }
+        scheduler.join();
+        EXPECT_EQ(2 * count, completed);
+    }
+}
+
+TEST(work_scheduler, latency_is_taken_first) {
+    work_scheduler scheduler(1);
+    std::promise<void> release;
+    auto released = release.get_future().share();
+    scheduler.post([released] { released.wait(); }, priority::bulk);
+
+    // the single thread is blocked, so all the items are queued at once
+    std::mutex mutex;
+    std::vector<int> order;
+    auto record = [&](int item) {
+        return [&, item] {
+            std::lock_guard<std::mutex> lock(mutex);
+            order.push_back(item);
+        };
+    };
+    scheduler.post(record(1), priority::bulk);
+    scheduler.post(record(2), priority::latency);
+    scheduler.post(record(3), priority::bulk);
+    scheduler.post(record(4), priority::latency);
+    release.set_value();
+    scheduler.join();
+
+    EXPECT_EQ(std::vector<int>({2, 4, 1, 3}), order);
+}
+
+TEST(work_scheduler, node_items_are_completed) {
+    // two nodes sharing the CPUs of the system are emulated on any system
+    const auto cpus = numa_topology::detect().get_nodes().front().cpus;
+    const numa_topology topology({{0, cpus}, {1, cpus}});
+    std::atomic<int> completed{0};
+    work_scheduler scheduler(4, &topology);
+    const auto nodes = static_cast<int>(scheduler.node_count());
+    EXPECT_EQ(2, nodes);
+    for(auto i = 0; i < 100; ++i) {
+        const auto node = i % (nodes + 1) - 1;
+        scheduler.post(
+            [&, node] {
+                scheduler.post([&] { ++completed; }, priority::bulk, node);
+                ++completed;
+            },
+            priority::bulk, node);
+    }
+    scheduler.join();
+    EXPECT_EQ(200, completed);
+}
+
+} // namespace
+} // namespace test
+} // namespace sp
\ No newline at end of file
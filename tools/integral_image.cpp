@@ -1,13 +1,27 @@
+#include <cstdio>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <vector>
+#include "boost/asio/post.hpp"
+#include "boost/asio/thread_pool.hpp"
 #include "boost/filesystem.hpp"
 #include "boost/program_options.hpp"
-#include "boost/thread/thread.hpp"
+#include "async_writer.hpp"
+#include "box_filter.hpp"
+#include "image_decoder.hpp"
+#include "integral_file.hpp"
 #include "integral_processing.hpp"
-#include "opencv2/imgcodecs.hpp"
+#include "integral_stream.hpp"
+#include "numa_topology.hpp"
+#include "pnm_reader.hpp"
+#include "result_cache.hpp"
+#include "strip_writer.hpp"
+#include "text_writer.hpp"
 
 namespace fs = boost::filesystem;
 namespace opt = boost::program_options;
@@ -15,14 +29,93 @@ namespace opt = boost::program_options;
 namespace {
 
 int thread_count;
+int decoder_count;
+int writer_count;
+std::size_t max_in_flight;
+std::size_t max_memory;
+sp::accumulator accumulator;
+bool binary_format;
+bool quiet;
+bool pinned;
+bool direct_io;
+bool print_stats;
+int stream_rows;
+int box_size;
+std::string trace_path;
+std::string cache_path;
+std::size_t cache_size;
+std::string cache_options;
 std::vector<std::string> files;
 
+// Binary files are mapped by the enqueuing thread and closed by the writer.
+// Several inputs may have the same id, so the mapping is identified by the
+// pages of its first channel instead.
+std::mutex mapped_mutex;
+std::map<const void*, std::unique_ptr<sp::integral_file>> mapped_files;
+// file mapped by the last enqueue of the thread, which is unmapped if the
+// enqueue fails
+thread_local const void* last_mapped = nullptr;
+
+// keys are computed by the decoding thread and stored by the writer
+std::unique_ptr<sp::result_cache> cache;
+std::mutex keys_mutex;
+std::map<std::string, sp::result_cache::key_t> cache_keys;
+
+// text outputs of all the writing threads are written by the shared buffers
+std::unique_ptr<sp::async_writer> output_writer;
+
+sp::accumulator parse_accumulator(const std::string& name) {
+    static const std::map<std::string, sp::accumulator> names = {
+        std::make_pair("auto", sp::accumulator::automatic),
+        std::make_pair("s32", sp::accumulator::s32),
+        std::make_pair("f64", sp::accumulator::f64),
+    };
+
+    const auto it = names.find(name);
+    if(it != names.end())
+        return it->second;
+
+    std::stringstream error;
+    error << "unsupported accumulator specified: " << name
+          << "; allowed accumulators: auto, s32, f64";
+    throw std::invalid_argument(error.str());
+}
+
 void validate_params(int argc, char* argv[]) {
     opt::options_description desc;
     desc.add_options()(
         ",i", opt::value<std::vector<std::string>>(), "list of input files")(
         ",t", opt::value<int>()->default_value(0),
-        "specify processing thread numbers");
+        "specify processing thread numbers")(
+        ",a", opt::value<std::string>()->default_value("auto"),
+        "specify accumulator type: auto, s32 or f64; s32 rejects images "
+        "whose sums may overflow it")(
+        ",d", opt::value<int>()->default_value(0),
+        "specify decoding thread numbers")(
+        ",w", opt::value<int>()->default_value(1),
+        "specify writing thread numbers")(
+        ",n", opt::value<std::size_t>()->default_value(0),
+        "specify maximal number of images in flight")(
+        ",m", opt::value<std::size_t>()->default_value(0),
+        "specify maximal memory of images in flight, MiB")(
+        ",f", opt::value<std::string>()->default_value("text"),
+        "specify output format: text or binary")(
+        ",q", "don't log completed tasks")(
+        "pin", "pin processing threads to the CPUs of the NUMA nodes")(
+        "direct", "write text outputs bypassing the page cache")(
+        "stats", "print execution statistics")(
+        ",s", opt::value<int>()->default_value(0),
+        "stream images by strips of the rows number, 0 to disable")(
+        "box", opt::value<int>()->default_value(0),
+        "write local means and variances of the windows of the size instead "
+        "of integral images, 0 to disable; binary .box files have the header "
+        "of .integral ones with the mean and the variance of each channel")(
+        "trace", opt::value<std::string>(),
+        "write Chrome trace of the execution to the file")(
+        "cache", opt::value<std::string>(),
+        "reuse outputs of the same images cached in the directory")(
+        "cache-size", opt::value<std::size_t>()->default_value(1024),
+        "specify maximal size of the cache, MiB");
     opt::variables_map vm;
     opt::store(opt::parse_command_line(argc, argv, desc), vm);
     opt::notify(vm);
@@ -34,8 +127,50 @@ void validate_params(int argc, char* argv[]) {
             std::back_inserter(files));
     }
 
+    const auto accumulator_name = vm["-a"].as<std::string>();
+    accumulator = parse_accumulator(accumulator_name);
+
+    const auto format = vm["-f"].as<std::string>();
+    if(format != "text" && format != "binary") {
+        std::stringstream error;
+        error << "unsupported format specified: " << format
+              << "; allowed formats: text, binary";
+        throw std::invalid_argument(error.str());
+    }
+    binary_format = format == "binary";
+    quiet = vm.count("-q") != 0;
+    print_stats = vm.count("stats") != 0;
+    pinned = vm.count("pin") != 0;
+    direct_io = vm.count("direct") != 0;
+    stream_rows = std::max(vm["-s"].as<int>(), 0);
+    box_size = std::max(vm["box"].as<int>(), 0);
+    if(box_size > 0 && stream_rows > 0)
+        throw std::invalid_argument(
+            "box filter requires whole integral images; disable streaming");
+    if(vm.count("trace"))
+        trace_path = vm["trace"].as<std::string>();
+    if(vm.count("cache"))
+        cache_path = vm["cache"].as<std::string>();
+    cache_size = vm["cache-size"].as<std::size_t>() << 20;
+    // outputs of the same image differ by these options only
+    cache_options = format + " " + accumulator_name + " "
+        + std::to_string(sp::integral_file::version);
+    if(box_size > 0)
+        cache_options += " box " + std::to_string(box_size);
+
+    // Decoding, computation and writing overlap, so the number of images in
+    // flight is enough to keep every stage busy.
+    const auto allow_threads = sp::numa_topology::detect().cpu_count();
+    decoder_count = vm["-d"].as<int>();
+    if(decoder_count <= 0)
+        decoder_count = allow_threads;
+    writer_count = std::max(vm["-w"].as<int>(), 1);
+    max_in_flight = vm["-n"].as<std::size_t>();
+    if(max_in_flight == 0)
+        max_in_flight = 2 * allow_threads + writer_count;
+    max_memory = vm["-m"].as<std::size_t>() << 20;
+
     thread_count = vm["-t"].as<int>();
-    const auto allow_threads = boost::thread::hardware_concurrency();
     if(thread_count >= 0 && thread_count < static_cast<int>(allow_threads))
         return;
 
@@ -45,35 +180,228 @@ void validate_params(int argc, char* argv[]) {
     throw std::out_of_range(error.str());
 }
 
-void write_on_disk(const sp::integral_computation::task_set_t& tasks) {
-    const auto id = tasks.front()->get_id();
+std::string output_path(const std::string& id) {
     const auto dot_index = id.find_last_of(".");
-    const auto dst = std::string(id.substr(0, dot_index)).append(".integral");
+    return std::string(id.substr(0, dot_index))
+        .append(box_size > 0 ? ".box" : ".integral");
+}
+
+std::vector<cv::Mat> map_on_disk(
+    const std::string& id, const cv::Mat& image, int result_depth) {
+    auto file = std::make_unique<sp::integral_file>(
+        output_path(id), image.size(), image.channels(), image.depth(),
+        result_depth);
+    auto results = file->get_channels();
+
+    std::lock_guard<std::mutex> lock(mapped_mutex);
+    last_mapped = results.front().data;
+    mapped_files[last_mapped] = std::move(file);
+    return results;
+}
+
+//! @brief Returns the mapped file of the results, which is forgotten.
+std::unique_ptr<sp::integral_file> release_mapped(const void* key) {
+    std::lock_guard<std::mutex> lock(mapped_mutex);
+    const auto it = mapped_files.find(key);
+    if(it == mapped_files.end())
+        return nullptr;
+    auto file = std::move(it->second);
+    mapped_files.erase(it);
+    return file;
+}
+
+//! @brief Reports the written output and stores it to the cache.
+void finish_output(
+    const std::string& id, const std::string& dst,
+    std::exception_ptr error = nullptr) {
     const auto filename = fs::path(dst).filename().string();
+    if(error) {
+        try {
+            std::rethrow_exception(error);
+        }
+        catch(const std::exception& exception) {
+            std::cerr << exception.what() << std::endl;
+        }
+        std::lock_guard<std::mutex> lock(keys_mutex);
+        cache_keys.erase(id);
+        return;
+    }
+    if(!quiet)
+        std::cout << filename << ": merge complete" << std::endl;
+
+    if(!cache)
+        return;
 
-    std::cout << filename << ": merging..." << std::endl;
-    std::ofstream output(dst);
-    output << std::fixed << std::setprecision(1);
+    sp::result_cache::key_t key;
+    {
+        std::lock_guard<std::mutex> lock(keys_mutex);
+        const auto it = cache_keys.find(id);
+        if(it == cache_keys.end())
+            return;
+        key = it->second;
+        cache_keys.erase(it);
+    }
+    cache->store(key, dst);
+}
+
+//! @brief Formats text output, which is completed in the background.
+void write_text(
+    const std::string& id, const std::string& dst,
+    const std::vector<cv::Mat>& channels, bool full_precision = false) {
+    // rows are formatted directly into the buffers of the shared writer
+    thread_local sp::text_writer writer;
+    writer.set_full_precision(full_precision);
+    writer.write(
+        *output_writer, dst, channels, [id, dst](std::exception_ptr error) {
+            finish_output(id, dst, error);
+        });
+}
 
-    auto task_count = tasks.size();
+/** @brief Writes local means and variances of the channels.
+
+Means and variances of each channel follow each other, so the binary file
+has twice as many channels of CV_64F depth as the image, see
+integral_file.hpp. Text values are written with full precision.
+*/
+void write_boxes(
+    const sp::integral_computation::task_set_t& tasks, const std::string& id,
+    const std::string& dst) {
+    const sp::box_filter filter(box_size);
+    std::vector<cv::Mat> planes;
+    planes.reserve(2 * tasks.size());
     for(const auto& task : tasks) {
-        const auto& result = task->get_result();
-        for(auto i = 0; i < result.rows; ++i) {
-            const auto row = result.ptr<double>(i);
-            for(auto j = 0; j < result.cols; ++j) {
-                const auto value = row[j];
-                output << value;
-                if(j != result.cols - 1)
-                    output << " ";
-            }
-            output << "\n";
+        cv::Mat mean, variance;
+        filter.mean_variance(
+            task->get_result(), task->get_sqsum(), mean, variance);
+        planes.push_back(mean);
+        planes.push_back(variance);
+    }
+
+    if(binary_format) {
+        const auto& image = tasks.front()->get_image();
+        sp::integral_file file(
+            dst, image.size(), static_cast<int>(planes.size()),
+            image.depth(), CV_64F);
+        auto channels = file.get_channels();
+        for(std::size_t c = 0; c < planes.size(); ++c)
+            planes[c].copyTo(channels[c]);
+        file.close();
+        finish_output(id, dst);
+    }
+    else {
+        write_text(id, dst, planes, true);
+    }
+}
+
+void write_on_disk(const sp::integral_computation::task_set_t& tasks) {
+    const auto id = tasks.front()->get_id();
+    const auto dst = output_path(id);
+    const auto filename = fs::path(dst).filename().string();
+
+    if(!quiet)
+        std::cout << filename << ": merging..." << std::endl;
+    if(box_size > 0)
+        write_boxes(tasks, id, dst);
+    else if(binary_format) {
+        // results are already in the mapped pages
+        const auto file = release_mapped(tasks.front()->get_result().data);
+        if(!file) {
+            std::cerr << "Unable to find mapped output: " << dst << std::endl;
+            return;
         }
-        if(--task_count)
-            output << "\n";
+        file->close();
+        finish_output(id, dst);
+    }
+    else {
+        std::vector<cv::Mat> results;
+        results.reserve(tasks.size());
+        for(const auto& task : tasks)
+            results.push_back(task->get_result());
+        write_text(id, dst, results);
+    }
+}
+
+//! @brief Removes output of the failed image and forgets its cache key.
+void discard_output(
+    const sp::integral_computation::task_set_t& tasks, std::exception_ptr) {
+    // failure is reported by the executor, partial output mustn't be cached
+    const auto id = tasks.front()->get_id();
+    if(box_size == 0 && binary_format
+       && release_mapped(tasks.front()->get_result().data))
+        std::remove(output_path(id).c_str());
+
+    std::lock_guard<std::mutex> lock(keys_mutex);
+    cache_keys.erase(id);
+}
+
+//! @brief Places the cached output of the image or remembers its key.
+bool fetch_cached(const std::string& file, const cv::Mat& image) {
+    const auto key = sp::result_cache::make_key(image, cache_options);
+    if(cache->fetch(key, output_path(file)))
+        return true;
+
+    std::lock_guard<std::mutex> lock(keys_mutex);
+    cache_keys[file] = key;
+    return false;
+}
+
+//! @brief Computes the image by strips, writing each strip before the next.
+void stream_file(const std::string& file) {
+    // netpbm image is read by strips, others are decoded whole, but their
+    // integral images are streamed anyway; both are decoded as by
+    // cv::IMREAD_COLOR, so the output doesn't depend on streaming
+    std::unique_ptr<sp::pnm_reader> reader;
+    cv::Mat image;
+    if(sp::pnm_reader::is_pnm(file))
+        reader = std::make_unique<sp::pnm_reader>(file);
+    else
+        image = sp::decode_image(file);
+    if(!reader && image.empty())
+        throw std::runtime_error("unable to decode");
+
+    const auto size = reader ? reader->get_size() : image.size();
+    const auto type = reader ? reader->get_type() : image.type();
+    sp::integral_stream stream(size, type, accumulator);
+    sp::strip_writer writer(output_path(file), stream, binary_format);
+    cv::Mat strip;
+    while(!stream.is_complete()) {
+        const auto row = stream.get_rows();
+        if(reader)
+            reader->read(strip, stream_rows);
+        else
+            strip = image.rowRange(
+                row, std::min(row + stream_rows, size.height));
+        writer.write(stream.push(strip), row);
+    }
+    writer.close();
+}
+
+void write_stats(const sp::execution_stats& stats) {
+    const auto to_ms = [](std::int64_t ns) { return ns / 1e6; };
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "stage      count    total, ms     mean, ms      max, ms\n";
+    for(std::size_t i = 0; i < sp::stage_count; ++i) {
+        const auto& stage = stats.stages[i];
+        const auto mean = stage.count ? stage.total_ns / stage.count : 0;
+        std::cout << std::left << std::setw(8)
+                  << sp::stage_name(static_cast<sp::stage>(i)) << std::right
+                  << std::setw(8) << stage.count << std::setw(13)
+                  << to_ms(stage.total_ns) << std::setw(13) << to_ms(mean)
+                  << std::setw(13) << to_ms(stage.max_ns) << "\n";
     }
 
-    output.flush();
-    std::cout << filename << ": merge complete" << std::endl;
+    std::cout << "images: " << stats.images_completed << "/"
+              << stats.images_enqueued
+              << ", max queue depth: " << stats.max_queue_depth
+              << ", elapsed: " << to_ms(stats.elapsed_ns) << " ms\n";
+    if(cache)
+        std::cout << "cache hits: " << cache->get_hits() << "/"
+                  << cache->get_hits() + cache->get_misses() << ", size: "
+                  << (cache->get_size() >> 20) << " MiB\n";
+    for(const auto& thread : stats.thread_busy_ns)
+        std::cout << "thread " << thread.first
+                  << " busy: " << to_ms(thread.second) << " ms\n";
+    std::cout << std::flush;
 }
 
 } // namespace
@@ -87,19 +415,91 @@ int main(int argc, char* argv[]) {
         return EXIT_FAILURE;
     }
 
-    sp::integral_computation executor(thread_count);
+    if(stream_rows > 0) {
+        for(const auto& file : files) {
+            try {
+                stream_file(file);
+                if(!quiet)
+                    std::cout << "Task completed: " << file << std::endl;
+            }
+            catch(const std::exception& exception) {
+                std::cerr << "Unable to process: " << file << ", "
+                          << exception.what() << std::endl;
+            }
+        }
+        return 0;
+    }
+
+    // the whole image is hashed, so the streamed images aren't cached
+    if(!cache_path.empty()) {
+        try {
+            cache = std::make_unique<sp::result_cache>(cache_path, cache_size);
+        }
+        catch(const std::exception& exception) {
+            std::cerr << "Unable to open cache: " << exception.what()
+                      << std::endl;
+        }
+    }
+
+    // each writing thread formats into one buffer while the rest are written
+    output_writer = std::make_unique<sp::async_writer>(
+        1 << 20, std::max(16u, 4u * writer_count), direct_io);
+    sp::integral_computation executor(thread_count, writer_count, pinned);
+    executor.set_accumulator(accumulator);
+    executor.set_in_flight_limit(max_in_flight, max_memory);
     executor.set_on_complete(write_on_disk);
+    executor.set_on_failure(discard_output);
+    executor.set_logging(!quiet);
+    executor.get_trace().set_keep_events(!trace_path.empty());
+    if(box_size > 0)
+        executor.set_outputs(sp::output::sum | sp::output::sqsum);
+    else if(binary_format)
+        executor.set_result_allocator(map_on_disk);
+
+    // Decoders are blocked by the executor while too many images are in
+    // flight, so the decoded images don't pile up in memory.
+    boost::asio::thread_pool decoders(decoder_count);
     std::for_each(
-        std::begin(files), std::end(files), [&executor](const auto& file) {
-            auto image = cv::imread(file);
-            if(image.empty()) {
-                std::cerr << "Unable to process: " << file << std::endl;
-                return;
-            }
-            executor.enqueue_file(file, image);
+        std::begin(files), std::end(files), [&](const auto& file) {
+            boost::asio::post(decoders, [&executor, file] {
+                const auto begin = sp::execution_trace::clock::now();
+                auto image = sp::decode_image(file);
+                executor.get_trace().record(
+                    sp::stage::decode, file, -1, begin,
+                    sp::execution_trace::clock::now());
+                if(image.empty()) {
+                    std::cerr << "Unable to process: " << file << std::endl;
+                    return;
+                }
+                try {
+                    if(cache && fetch_cached(file, image)) {
+                        if(!quiet)
+                            std::cout << "Task cached: " << file << std::endl;
+                        return;
+                    }
+                    last_mapped = nullptr;
+                    executor.enqueue_file(file, image);
+                }
+                catch(const std::exception& exception) {
+                    // output mapped before the failure is left unwritten
+                    if(release_mapped(last_mapped))
+                        std::remove(output_path(file).c_str());
+                    std::cerr << "Unable to process: " << file << ", "
+                              << exception.what() << std::endl;
+                }
+            });
         });
 
+    decoders.join();
     executor.wait_for_complete();
+    output_writer->drain();
+
+    if(print_stats)
+        write_stats(executor.get_stats());
+    if(!trace_path.empty()) {
+        std::ofstream trace(trace_path);
+        executor.get_trace().write_chrome_trace(trace);
+    }
 
     return 0;
 }
\ No newline at end of file